@@ -0,0 +1,290 @@
+
+#include "model.hpp"
+#include "cmdparser.hpp"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <set>
+
+namespace
+{
+    /** Hex float literal, round-trips every float exactly */
+    std::string literal(prkl::real value)
+    {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%af", double(value));
+        return buffer;
+    }
+
+    template<typename value_type, typename to_string>
+    void write_array(std::ofstream &out, char const* type, std::string const& name, value_type const* values, prkl::integer count, to_string convert)
+    {
+        out << "        alignas(64) inline constexpr " << type << " " << name << "[" << std::max<prkl::integer>(count, 1) << "] = {";
+        for(prkl::integer i = 0; i < count; i++)
+        {
+            out << (i % 8 == 0 ? "\n            " : " ") << convert(values[i]) << ",";
+        }
+        out << "\n        };\n";
+    }
+
+    void write_array(std::ofstream &out, std::string const& name, prkl::real const* values, prkl::integer count)
+    {
+        write_array(out, "float", name, values, count, literal);
+    }
+
+    char const* activation_name(prkl::ann_activation activation)
+    {
+        switch(activation)
+        {
+            default:
+            case prkl::ann_activation::swish:
+                return "swish";
+            case prkl::ann_activation::tanh:
+                return "tanh_activation";
+            case prkl::ann_activation::relu:
+                return "relu";
+            case prkl::ann_activation::leaky_relu:
+                return "leaky_relu";
+            case prkl::ann_activation::sigmoid:
+                return "sigmoid";
+            case prkl::ann_activation::linear:
+                return "linear";
+        }
+    }
+
+    /** Same formulas as the library, so the generated code computes what the model does */
+    void write_activation(std::ofstream &out, prkl::ann_activation activation)
+    {
+        switch(activation)
+        {
+            default:
+            case prkl::ann_activation::swish:
+                out << "        inline float swish(float x, float)\n        {\n"
+                    << "            float safe_x = std::max(-10.0f, std::min(10.0f, x));\n"
+                    << "            return safe_x / (1.0f + std::exp(-safe_x));\n        }\n";
+                break;
+            case prkl::ann_activation::tanh:
+                out << "        inline float tanh_activation(float x, float)\n        {\n"
+                    << "            float ex = std::exp(x);\n            float enx = std::exp(-x);\n"
+                    << "            return (ex - enx) / (ex + enx);\n        }\n";
+                break;
+            case prkl::ann_activation::relu:
+                out << "        inline float relu(float x, float)\n        {\n            return std::max(0.0f, x);\n        }\n";
+                break;
+            case prkl::ann_activation::leaky_relu:
+                out << "        inline float leaky_relu(float x, float alpha)\n        {\n            return x > 0.0f ? x : alpha * x;\n        }\n";
+                break;
+            case prkl::ann_activation::sigmoid:
+                out << "        inline float sigmoid(float x, float)\n        {\n            return 1.0f / (1.0f + std::exp(-x));\n        }\n";
+                break;
+            case prkl::ann_activation::linear:
+                out << "        inline float linear(float x, float)\n        {\n            return x;\n        }\n";
+                break;
+        }
+    }
+
+    std::string activation_call(prkl::ann_layer_base const* layer, char const* argument)
+    {
+        return std::string(activation_name(layer->activation_func)) + "(" + argument + ", " + literal(layer->leaky_alpha) + ")";
+    }
+
+    /** 
+     * The dot products keep 16 independent partial sums, a fixed summation order the compiler can vectorize without fast-math. 
+     * The sizes are constants, so the loops unroll and the tails disappear at compile time 
+     */
+    void write_dense(std::ofstream &out, prkl::ann_dense_layer const* layer, std::string const& name)
+    {
+        prkl::integer num_weights = layer->num_neurons * layer->num_inputs;
+        write_array(out, name + "_weights", layer->weights, num_weights);
+        write_array(out, name + "_biases", layer->biases, layer->num_neurons);
+
+        out << "        inline void " << name << "(float const* __restrict inputs, float* __restrict outputs)\n        {\n"
+            << "            constexpr int num_neurons = " << layer->num_neurons << ";\n"
+            << "            constexpr int num_inputs = " << layer->num_inputs << ";\n"
+            << "            constexpr int num_lanes = 16;\n"
+            << "            constexpr int num_vectorized = num_inputs / num_lanes * num_lanes;\n"
+            << "            for(int n = 0; n < num_neurons; n++)\n            {\n"
+            << "                float const* neuron_weights = " << name << "_weights + n * num_inputs;\n"
+            << "                float lanes[num_lanes] = {};\n"
+            << "                for(int i = 0; i < num_vectorized; i += num_lanes)\n"
+            << "                    for(int l = 0; l < num_lanes; l++)\n"
+            << "                        lanes[l] += inputs[i + l] * neuron_weights[i + l];\n"
+            << "                float sum = " << name << "_biases[n];\n"
+            << "                for(int i = num_vectorized; i < num_inputs; i++)\n"
+            << "                    sum += inputs[i] * neuron_weights[i];\n"
+            << "                for(int l = 0; l < num_lanes; l++)\n"
+            << "                    sum += lanes[l];\n"
+            << "                outputs[n] = " << activation_call(layer, "sum") << ";\n"
+            << "            }\n        }\n\n";
+    }
+
+    void write_sparse(std::ofstream &out, prkl::ann_sparse_layer const* layer, std::string const& name)
+    {
+        auto to_integer = [](uint32_t value) { return std::to_string(value); };
+        write_array(out, "uint32_t", name + "_row_offsets", layer->row_offsets.data(), layer->row_offsets.size(), to_integer);
+        write_array(out, "uint32_t", name + "_columns", layer->columns.data(), layer->columns.size(), to_integer);
+        write_array(out, name + "_values", layer->values.data(), layer->values.size());
+        write_array(out, name + "_biases", layer->biases.data(), layer->num_neurons);
+
+        out << "        inline void " << name << "(float const* __restrict inputs, float* __restrict outputs)\n        {\n"
+            << "            constexpr int num_neurons = " << layer->num_neurons << ";\n"
+            << "            for(int n = 0; n < num_neurons; n++)\n            {\n"
+            << "                float sum = " << name << "_biases[n];\n"
+            << "                for(uint32_t w = " << name << "_row_offsets[n]; w < " << name << "_row_offsets[n + 1]; w++)\n"
+            << "                    sum += inputs[" << name << "_columns[w]] * " << name << "_values[w];\n"
+            << "                outputs[n] = " << activation_call(layer, "sum") << ";\n"
+            << "            }\n        }\n\n";
+    }
+
+    void write_quantized(std::ofstream &out, prkl::ann_quantized_layer const* layer, std::string const& name)
+    {
+        // the rows without their kernel padding, the generated loop runs over the real inputs only
+        std::vector<int8_t> weights(layer->num_neurons * layer->num_inputs);
+        for(prkl::integer n = 0; n < layer->num_neurons; n++)
+        {
+            std::copy_n(layer->weights.data() + n * layer->num_padded_inputs, layer->num_inputs, weights.data() + n * layer->num_inputs);
+        }
+
+        auto to_integer = [](auto value) { return std::to_string(int32_t(value)); };
+        write_array(out, "int8_t", name + "_weights", weights.data(), weights.size(), to_integer);
+        write_array(out, "int32_t", name + "_weight_sums", layer->weight_sums.data(), layer->num_neurons, to_integer);
+        write_array(out, name + "_weight_scales", layer->weight_scales.data(), layer->num_neurons);
+        write_array(out, name + "_biases", layer->biases.data(), layer->num_neurons);
+
+        out << "        inline void " << name << "(float const* __restrict inputs, float* __restrict outputs)\n        {\n"
+            << "            constexpr int num_neurons = " << layer->num_neurons << ";\n"
+            << "            constexpr int num_inputs = " << layer->num_inputs << ";\n"
+            << "            constexpr float input_scale = " << literal(layer->input_scale) << ";\n"
+            << "            constexpr int32_t zero_point = " << layer->input_zero_point << ";\n"
+            << "            alignas(64) uint8_t codes[num_inputs];\n"
+            << "            for(int i = 0; i < num_inputs; i++)\n            {\n"
+            << "                float code = std::clamp(inputs[i] * (1.0f / input_scale) + float(zero_point), 0.0f, 127.0f);\n"
+            << "                codes[i] = uint8_t(int32_t(code + 0.5f));\n"
+            << "            }\n"
+            << "            for(int n = 0; n < num_neurons; n++)\n            {\n"
+            << "                int8_t const* neuron_weights = " << name << "_weights + n * num_inputs;\n"
+            << "                int32_t accumulator = 0;\n"
+            << "                for(int i = 0; i < num_inputs; i++)\n"
+            << "                    accumulator += int32_t(codes[i]) * int32_t(neuron_weights[i]);\n"
+            << "                accumulator -= zero_point * " << name << "_weight_sums[n];\n"
+            << "                float sum = float(accumulator) * (input_scale * " << name << "_weight_scales[n]) + " << name << "_biases[n];\n"
+            << "                outputs[n] = " << activation_call(layer, "sum") << ";\n"
+            << "            }\n        }\n\n";
+    }
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+    cli::Parser parser(argc, argv);
+    parser.set_required<std::string>("m", "model", "Path to trained model (.prklmodel file)");
+    parser.set_required<std::string>("o", "output", "Path to the generated header (.hpp file)");
+    parser.set_optional<std::string>("n", "namespace", "prkl_model", "Namespace of the generated code, so several models can be compiled into one program");
+    parser.run_and_exit_if_error();
+
+    std::string model_path = parser.get<std::string>("m");
+    std::string output_path = parser.get<std::string>("o");
+    std::string name_space = parser.get<std::string>("n");
+
+    std::cout << " --- Loading model --- " << std::endl;
+    prkl::ann_model model(model_path.c_str());
+    if(model.layers.size() < 2)
+    {
+        std::cerr << "Failed to load model: " << model_path << std::endl;
+        return 1;
+    }
+
+    std::ofstream out(output_path);
+    if(!out)
+    {
+        std::cerr << "Failed to open file for writing: " << output_path << std::endl;
+        return 1;
+    }
+
+    prkl::integer num_layers = model.layers.size();
+    prkl::integer num_inputs = model.layers.front()->num_activations();
+    prkl::integer num_outputs = model.layers.back()->num_activations();
+
+    std::cout << " --- Generating code --- " << std::endl;
+    out << "\n// Generated by prkl-codegen from " << std::filesystem::path(model_path).filename().string() << ", do not edit\n"
+        << "#pragma once\n\n#include <algorithm>\n#include <cmath>\n#include <cstdint>\n\n"
+        << "namespace " << name_space << "\n{\n\n"
+        << "    inline constexpr int num_inputs = " << num_inputs << ";\n"
+        << "    inline constexpr int num_outputs = " << num_outputs << ";\n\n"
+        << "    namespace detail\n    {\n";
+
+    std::set<prkl::ann_activation> activations;
+    for(prkl::integer layer_index = 1; layer_index < num_layers; layer_index++)
+    {
+        activations.insert(model.layers[layer_index]->activation_func);
+    }
+    for(prkl::ann_activation activation : activations)
+    {
+        write_activation(out, activation);
+        out << "\n";
+    }
+
+    for(prkl::integer layer_index = 1; layer_index < num_layers; layer_index++)
+    {
+        prkl::ann_layer_base const* layer = model.layers[layer_index];
+        std::string name = "layer" + std::to_string(layer_index);
+        if(auto dense = dynamic_cast<prkl::ann_dense_layer const*>(layer))
+        {
+            write_dense(out, dense, name);
+        }
+        else if(auto sparse = dynamic_cast<prkl::ann_sparse_layer const*>(layer))
+        {
+            write_sparse(out, sparse, name);
+        }
+        else if(auto quantized = dynamic_cast<prkl::ann_quantized_layer const*>(layer))
+        {
+            write_quantized(out, quantized, name);
+        }
+        else
+        {
+            std::cerr << "Unsupported layer type in layer " << layer_index << std::endl;
+            return 1;
+        }
+        std::cout << "Layer " << layer_index << ": " << layer->num_activations() << " neurons, " << activation_name(layer->activation_func) << std::endl;
+    }
+
+    if(model.evaluation_type == prkl::ann_evaluation_type::multiclass_classification)
+    {
+        out << "        inline void softmax(float *values)\n        {\n"
+            << "            float max_value = values[0];\n"
+            << "            for(int i = 1; i < num_outputs; i++)\n                max_value = std::max(max_value, values[i]);\n"
+            << "            float sum = 0.0f;\n"
+            << "            for(int i = 0; i < num_outputs; i++)\n            {\n"
+            << "                values[i] = std::exp(std::max(values[i] - max_value, -80.0f));\n                sum += values[i];\n            }\n"
+            << "            sum += 1e-08f;\n"
+            << "            for(int i = 0; i < num_outputs; i++)\n                values[i] /= sum;\n        }\n\n";
+    }
+    out << "    }\n\n";
+
+    // the hidden activations live on the stack, the whole forward pass never allocates
+    out << "    /** Runs one sample through the model, inputs holds num_inputs values and outputs receives num_outputs */\n"
+        << "    inline void forward(float const* inputs, float *outputs)\n    {\n";
+    for(prkl::integer layer_index = 1; layer_index + 1 < num_layers; layer_index++)
+    {
+        out << "        alignas(64) float activations" << layer_index << "[" << model.layers[layer_index]->num_activations() << "];\n";
+    }
+    for(prkl::integer layer_index = 1; layer_index < num_layers; layer_index++)
+    {
+        std::string layer_inputs = layer_index == 1 ? "inputs" : "activations" + std::to_string(layer_index - 1);
+        std::string layer_outputs = layer_index + 1 == num_layers ? "outputs" : "activations" + std::to_string(layer_index);
+        out << "        detail::layer" << layer_index << "(" << layer_inputs << ", " << layer_outputs << ");\n";
+    }
+    if(model.evaluation_type == prkl::ann_evaluation_type::multiclass_classification)
+    {
+        out << "        detail::softmax(outputs);\n";
+    }
+    out << "    }\n\n}\n";
+
+    if(!out)
+    {
+        std::cerr << "Failed to write: " << output_path << std::endl;
+        return 1;
+    }
+
+    std::cout << "Wrote " << output_path << " (" << std::filesystem::file_size(output_path) << " bytes)" << std::endl;
+    return 0;
+}
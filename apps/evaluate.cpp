@@ -1,13 +1,66 @@
 
 #include "model.hpp"
+#include "inference.hpp"
 #include "cmdparser.hpp"
 #include <iostream>
+#include <chrono>
+
+namespace
+{
+    struct measurement
+    {
+        prkl::real success_rate{0.0f};
+        double throughput{0.0}; // pairs per second, batched across all cores
+        double median_latency{0.0}; // microseconds for a single pair on one thread
+        double tail_latency{0.0}; // 99th percentile of the same
+    };
+
+    measurement measure(prkl::ann_model const& model, prkl::ann_set const& evaluation_set)
+    {
+        measurement result;
+        prkl::integer num_misses = 0;
+        double best_seconds = std::numeric_limits<double>::infinity();
+        for(prkl::integer pass = 0; pass < 5; pass++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            num_misses = model.count_misses(evaluation_set);
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+            best_seconds = std::min(best_seconds, seconds.count());
+        }
+        result.success_rate = 1.0 - prkl::real(num_misses) / prkl::real(evaluation_set.pairs.size());
+        result.throughput = double(evaluation_set.pairs.size()) / best_seconds;
+
+        prkl::ann_inference_context context(model, 1);
+        std::vector<prkl::real> outputs(model.layers.back()->num_activations());
+        std::vector<double> latencies;
+        latencies.reserve(evaluation_set.pairs.size());
+        for(prkl::ann_setpair const& pair : evaluation_set.pairs)
+        {
+            auto start = std::chrono::steady_clock::now();
+            model.infer(pair.input, outputs, 1, context);
+            std::chrono::duration<double, std::micro> microseconds = std::chrono::steady_clock::now() - start;
+            latencies.push_back(microseconds.count());
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        result.median_latency = latencies[latencies.size() / 2];
+        result.tail_latency = latencies[latencies.size() * 99 / 100];
+        return result;
+    }
+
+    void print(char const* name, measurement const& m)
+    {
+        std::cout << name << ": " << (100.0 * m.success_rate) << "% success, " << m.throughput << " pairs/s, "
+                  << m.median_latency << " us p50, " << m.tail_latency << " us p99 per pair" << std::endl;
+    }
+}
 
 int32_t main(int32_t argc, char **argv)
 {
     cli::Parser parser(argc, argv);
     parser.set_required<std::string>("m", "model", "Path to model (.prklmodel file)");
     parser.set_required<std::string>("e", "evaluation-set", "", "Path to evaluation set (.prklset file)");
+    parser.set_optional<std::string>("q", "quantized", "", "Path to a quantized version of the model (.prklmodel file), compares both side by side");
     parser.run_and_exit_if_error();
 
     std::string evaluation_set_path = parser.get<std::string>("e");
@@ -16,9 +69,15 @@ int32_t main(int32_t argc, char **argv)
     prkl::ann_set evaluation_set = prkl::ann_set(evaluation_set_path.c_str());
     
     std::string model_path = parser.get<std::string>("m");
+    std::string quantized_path = parser.get<std::string>("q");
 
     std::cout << " --- Loading model --- " << std::endl;
     prkl::ann_model model(model_path.c_str());
+    if(model.layers.size() < 2)
+    {
+        std::cerr << "Failed to load model: " << model_path << std::endl;
+        return 1;
+    }
 
     if(model.input()->num_activations() != evaluation_set.num_inputs || model.output()->num_activations() != evaluation_set.num_outputs)
     {
@@ -26,7 +85,22 @@ int32_t main(int32_t argc, char **argv)
         return 1;
     }
 
-    std::cout << " --- Evaluating model --- " << std::endl;
-    model.evaluate(evaluation_set);
+    if(quantized_path.empty())
+    {
+        std::cout << " --- Evaluating model --- " << std::endl;
+        model.evaluate(evaluation_set);
+        return 0;
+    }
+
+    prkl::ann_model quantized(quantized_path.c_str());
+    if(quantized.layers.size() != model.layers.size() || quantized.output()->num_activations() != evaluation_set.num_outputs)
+    {
+        std::cerr << "Quantized model does not match the model: " << quantized_path << std::endl;
+        return 1;
+    }
+
+    std::cout << " --- Evaluating models --- " << std::endl;
+    print("fp32", measure(model, evaluation_set));
+    print("int8", measure(quantized, evaluation_set));
     return 0;
-}
\ No newline at end of file
+}
@@ -1,12 +1,13 @@
 
 #include "model.hpp"
+#include "static_mlp.hpp"
 #include "cmdparser.hpp"
 #include <iostream>
 #include <iomanip>
 
 prkl::ann_set generate_set_dot(prkl::integer num_pairs)
 {
-    auto &rnd = prkl::random_device();
+    prkl::ann_random_stream rnd(prkl::nondeterministic_seed(), prkl::ann_random_purpose::augmentation, 0);
     std::uniform_real_distribution<prkl::real> dist(-1.0, 1.0);
 
     prkl::ann_set set(6, 1);
@@ -95,9 +96,8 @@ int32_t main(int32_t argc, char **argv)
     
     prkl::ann_set eval_dot = generate_set_dot(10000);
 
-    prkl::ann_layer_base *input_layer = model_dot.input();
-    prkl::ann_layer_base *output_layer = model_dot.output();
-    prkl::integer num_miss = 0;
+    prkl::ann_inference_context context(model_dot, 1);
+    prkl::real actual = 0.0f;
     prkl::integer num_pairs = eval_dot.pairs.size();
 
     prkl::real total_loss =0.0f;
@@ -107,19 +107,13 @@ int32_t main(int32_t argc, char **argv)
     {
         prkl::ann_setpair &eval_pair = eval_dot.pairs[e];
 
-        for(prkl::integer i = 0; i < input_layer->num_activations(); i++)
+        if(!model_dot.infer(eval_pair.input, { &actual, 1 }, 1, context))
         {
-            input_layer->set_activation(i, eval_pair.input[i]);
-        }
-
-        if(!model_dot.forward_propagate())
-        {
-            std::cerr << "forward propagation failed: evaluation failed!" << std::endl;
+            std::cerr << "inference failed: evaluation failed!" << std::endl;
             return 0.0;
         }
 
         prkl::real expected = eval_pair.output[0];
-        prkl::real actual = output_layer->get_activation(0);
         prkl::real loss = std::fabs(actual - expected); 
         total_loss += loss;
         if(loss < min_loss)
@@ -138,6 +132,36 @@ int32_t main(int32_t argc, char **argv)
     
     std::cout << "Difference: avg: "<<std::setprecision(6) << std::fixed << (total_loss / (prkl::real)num_pairs) << ", min: " << min_loss << ", max: " << max_loss << std::endl;
 
+    // the same topology with its shape fixed at compile time, trained with plain per-sample SGD
+    using static_dot = prkl::static_mlp<6, prkl::static_dense<64, prkl::ann_activation::relu>, prkl::static_dense<32, prkl::ann_activation::relu>, prkl::static_dense<1, prkl::ann_activation::linear>>;
+    static_dot static_model;
+    static_model.randomize_weights(model_dot.settings.seed);
+
+    for(prkl::integer epoch = 0; epoch < 50; epoch++)
+    {
+        for(prkl::ann_setpair const& pair : set_dot.pairs)
+        {
+            static_dot::input_array inputs;
+            std::copy(pair.input.begin(), pair.input.end(), inputs.begin());
+            static_model.train_step(inputs, { pair.output[0] }, 0.01f);
+        }
+    }
+
+    total_loss = 0.0f;
+    max_loss = 0.0f;
+    min_loss = std::numeric_limits<prkl::real>::infinity();
+    for(prkl::ann_setpair const& eval_pair : eval_dot.pairs)
+    {
+        static_dot::input_array inputs;
+        std::copy(eval_pair.input.begin(), eval_pair.input.end(), inputs.begin());
+        prkl::real loss = std::fabs(static_model.forward(inputs)[0] - eval_pair.output[0]);
+        total_loss += loss;
+        min_loss = std::min(min_loss, loss);
+        max_loss = std::max(max_loss, loss);
+    }
+
+    std::cout << "Difference (static_mlp): avg: " << (total_loss / (prkl::real)num_pairs) << ", min: " << min_loss << ", max: " << max_loss << std::endl;
+
 
     return 0;
 }
\ No newline at end of file
@@ -37,14 +37,21 @@ int32_t main(int32_t argc, char **argv)
     std::cout << " --- Training model ---" << std::endl;
     model.train(training_set, 20);
 
+    model.evaluate(evaluation_set);
+
     std::cout << " --- Running inference ---" << std::endl;
-    if(!model.forward_propagate())
+    prkl::ann_inference_context context;
+    std::vector<prkl::real> probabilities(10);
+    prkl::ann_setpair const& pair = evaluation_set.pairs.front();
+    if(!model.infer(pair.input, probabilities, 1, context))
     {
-        std::cerr << "forward propagation failed" << std::endl;
+        std::cerr << "inference failed" << std::endl;
         return 1;
     }
 
-    model.evaluate(evaluation_set);
+    auto strongest = std::max_element(probabilities.begin(), probabilities.end());
+    auto expected = std::max_element(pair.output.begin(), pair.output.end());
+    std::cout << "First evaluation digit: " << (strongest - probabilities.begin()) << " (" << (*strongest * 100.0f) << "%), expected " << (expected - pair.output.begin()) << std::endl;
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,94 @@
+
+#include "model.hpp"
+#include "cmdparser.hpp"
+#include <iostream>
+#include <chrono>
+#include <filesystem>
+
+namespace
+{
+    /** Success rate and the best of a few timed passes over the evaluation set, in pairs per second */
+    std::pair<prkl::real, double> measure(prkl::ann_model const& model, prkl::ann_set const& evaluation_set)
+    {
+        prkl::integer num_misses = 0;
+        double best_seconds = std::numeric_limits<double>::infinity();
+        for(prkl::integer pass = 0; pass < 5; pass++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            num_misses = model.count_misses(evaluation_set);
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+            best_seconds = std::min(best_seconds, seconds.count());
+        }
+
+        prkl::real success_rate = 1.0 - prkl::real(num_misses) / prkl::real(evaluation_set.pairs.size());
+        return { success_rate, double(evaluation_set.pairs.size()) / best_seconds };
+    }
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+    cli::Parser parser(argc, argv);
+    parser.set_required<std::string>("m", "model", "Path to trained model (.prklmodel file)");
+    parser.set_required<std::string>("o", "output", "Path to output file for the pruned model (.prklmodel file)");
+    parser.set_optional<prkl::real>("s", "sparsity", 0.9f, "Fraction of the weights of every pruned layer to zero, smallest magnitudes first");
+    parser.set_optional<prkl::real>("t", "threshold", 0.0f, "Zero weights below this magnitude instead of pruning to a target sparsity");
+    parser.set_optional<bool>("a", "all", false, "Also prune the output layer, which is small and the most sensitive to pruning");
+    parser.set_optional<prkl::real>("l", "min-sparsity", 0.6f, "Layers at least this sparse are stored and run in compressed sparse row form");
+    parser.set_optional<std::string>("e", "evaluation-set", "", "Path to evaluation set (.prklset file), reports success rate and throughput before and after");
+    parser.run_and_exit_if_error();
+
+    std::string model_path = parser.get<std::string>("m");
+    std::string output_path = parser.get<std::string>("o");
+    prkl::real sparsity = parser.get<prkl::real>("s");
+    prkl::real threshold = parser.get<prkl::real>("t");
+    bool prune_output = parser.get<bool>("a");
+    prkl::real min_sparsity = parser.get<prkl::real>("l");
+    std::string evaluation_set_path = parser.get<std::string>("e");
+
+    std::cout << " --- Loading model --- " << std::endl;
+    prkl::ann_model model(model_path.c_str());
+    if(model.layers.size() < 2)
+    {
+        std::cerr << "Failed to load model: " << model_path << std::endl;
+        return 1;
+    }
+
+    prkl::ann_set evaluation_set;
+    std::pair<prkl::real, double> before;
+    if(!evaluation_set_path.empty())
+    {
+        evaluation_set = prkl::ann_set(evaluation_set_path.c_str());
+        before = measure(model, evaluation_set);
+    }
+
+    std::cout << " --- Pruning --- " << std::endl;
+    prkl::integer last_layer = prune_output ? model.layers.size() : model.layers.size() - 1;
+    for(prkl::integer layer_index = 1; layer_index < last_layer; layer_index++)
+    {
+        prkl::ann_dense_layer *layer = dynamic_cast<prkl::ann_dense_layer*>(model.layers[layer_index]);
+        if(!layer || layer->num_inputs == 0)
+            continue;
+
+        prkl::real layer_threshold = threshold > 0.0f ? threshold : layer->pruning_threshold(sparsity);
+        prkl::integer num_zero = layer->prune(layer_threshold);
+        prkl::integer num_weights = layer->num_neurons * layer->num_inputs;
+        std::cout << "Layer " << layer_index << ": " << (100.0 * num_zero / num_weights) << "% of " << num_weights << " weights are zero (threshold " << layer_threshold << ")" << std::endl;
+    }
+
+    prkl::integer num_sparse = model.sparsify(min_sparsity);
+    std::cout << "Stored " << num_sparse << " layers in sparse form" << std::endl;
+
+    if(!evaluation_set_path.empty())
+    {
+        std::pair<prkl::real, double> after = measure(model, evaluation_set);
+        std::cout << "Success rate: " << (before.first * 100.0) << "% before, " << (after.first * 100.0) << "% after" << std::endl;
+        std::cout << "Throughput: " << before.second << " pairs/s before, " << after.second << " pairs/s after" << std::endl;
+    }
+
+    std::cout << "Writing model: " << output_path << std::endl;
+    if(!model.write_file(output_path.c_str()))
+        return 1;
+
+    std::cout << "Model size: " << std::filesystem::file_size(model_path) << " bytes before, " << std::filesystem::file_size(output_path) << " bytes after" << std::endl;
+    return 0;
+}
@@ -0,0 +1,92 @@
+
+#include "model.hpp"
+#include "cmdparser.hpp"
+#include <iostream>
+#include <chrono>
+#include <filesystem>
+
+namespace
+{
+    /** Success rate and the best of a few timed passes over the evaluation set, in pairs per second */
+    std::pair<prkl::real, double> measure(prkl::ann_model const& model, prkl::ann_set const& evaluation_set)
+    {
+        prkl::integer num_misses = 0;
+        double best_seconds = std::numeric_limits<double>::infinity();
+        for(prkl::integer pass = 0; pass < 5; pass++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            num_misses = model.count_misses(evaluation_set);
+            std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+            best_seconds = std::min(best_seconds, seconds.count());
+        }
+
+        prkl::real success_rate = 1.0 - prkl::real(num_misses) / prkl::real(evaluation_set.pairs.size());
+        return { success_rate, double(evaluation_set.pairs.size()) / best_seconds };
+    }
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+    cli::Parser parser(argc, argv);
+    parser.set_required<std::string>("m", "model", "Path to trained model (.prklmodel file)");
+    parser.set_required<std::string>("o", "output", "Path to output file for the quantized model (.prklmodel file)");
+    parser.set_required<std::string>("c", "calibration-set", "Path to calibration set (.prklset file), a few hundred representative pairs are enough");
+    parser.set_optional<bool>("k", "keep-output", false, "Keep the output layer in fp32, which is small and the most sensitive to quantization");
+    parser.set_optional<std::string>("e", "evaluation-set", "", "Path to evaluation set (.prklset file), reports success rate and throughput before and after");
+    parser.run_and_exit_if_error();
+
+    std::string model_path = parser.get<std::string>("m");
+    std::string output_path = parser.get<std::string>("o");
+    std::string calibration_set_path = parser.get<std::string>("c");
+    bool keep_output = parser.get<bool>("k");
+    std::string evaluation_set_path = parser.get<std::string>("e");
+
+    std::cout << " --- Loading model --- " << std::endl;
+    prkl::ann_model model(model_path.c_str());
+    if(model.layers.size() < 2)
+    {
+        std::cerr << "Failed to load model: " << model_path << std::endl;
+        return 1;
+    }
+
+    prkl::ann_set calibration_set(calibration_set_path.c_str());
+    if(calibration_set.pairs.empty() || calibration_set.num_inputs != model.input()->num_activations())
+    {
+        std::cerr << "Incompatible calibration set" << std::endl;
+        return 1;
+    }
+
+    prkl::ann_set evaluation_set;
+    std::pair<prkl::real, double> before;
+    if(!evaluation_set_path.empty())
+    {
+        evaluation_set = prkl::ann_set(evaluation_set_path.c_str());
+        before = measure(model, evaluation_set);
+    }
+
+    std::cout << " --- Quantizing --- " << std::endl;
+    prkl::integer num_quantized = model.quantize(calibration_set, !keep_output);
+    std::cout << "Quantized " << num_quantized << " layers to int8, calibrated on " << calibration_set.pairs.size() << " pairs" << std::endl;
+    for(prkl::integer layer_index = 1; layer_index < model.layers.size(); layer_index++)
+    {
+        prkl::ann_quantized_layer *layer = dynamic_cast<prkl::ann_quantized_layer*>(model.layers[layer_index]);
+        if(!layer)
+            continue;
+
+        std::cout << "Layer " << layer_index << ": input scale " << layer->input_scale << ", zero point " << layer->input_zero_point << std::endl;
+    }
+
+    if(!evaluation_set_path.empty())
+    {
+        std::pair<prkl::real, double> after = measure(model, evaluation_set);
+        std::cout << "Success rate: " << (before.first * 100.0) << "% before, " << (after.first * 100.0) << "% after" << std::endl;
+        std::cout << "Throughput: " << before.second << " pairs/s before, " << after.second << " pairs/s after" << std::endl;
+    }
+
+    std::cout << "Writing model: " << output_path << std::endl;
+    if(!model.write_file(output_path.c_str()))
+        return 1;
+
+    std::cout << "Model size: " << std::filesystem::file_size(model_path) << " bytes before, " << std::filesystem::file_size(output_path) << " bytes after" << std::endl;
+    return 0;
+}
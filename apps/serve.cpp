@@ -0,0 +1,813 @@
+
+#include "model.hpp"
+#include "publication.hpp"
+#include "cmdparser.hpp"
+#ifdef PRKL_SHARED_MEMORY
+#include "shared_memory.hpp"
+#endif
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <list>
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+
+/*
+ * Protocol, every field big-endian like the .prklmodel format. A connection sends any number of requests and gets one
+ * response per request, in order:
+ *   request:  u32 model index (order of -m), u32 count, count float inputs
+ *   response: u32 status, u32 count, count float outputs
+ * A request for model index 0xffffffff with no inputs returns the counters as count bytes of text instead of outputs.
+ * Co-located clients on Linux can skip the sockets and use prkl::ann_shm_client on the shared memory segment (-x) instead.
+ */
+
+namespace
+{
+    using clock_type = std::chrono::steady_clock;
+
+    enum class serve_status : uint32_t
+    {
+        ok = 0,
+        unknown_model,
+        input_mismatch
+    };
+
+    constexpr uint32_t stats_request = 0xffffffff;
+    constexpr uint32_t max_request_values = 1 << 24; // anything larger is not a model input, the connection is dropped
+
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> reload_requested{false};
+
+    bool read_exact(int fd, void *data, size_t size)
+    {
+        char *bytes = static_cast<char*>(data);
+        while(size > 0)
+        {
+            ssize_t received = ::recv(fd, bytes, size, 0);
+            if(received <= 0)
+                return false;
+            bytes += received;
+            size -= received;
+        }
+        return true;
+    }
+
+    bool write_exact(int fd, void const* data, size_t size)
+    {
+        char const* bytes = static_cast<char const*>(data);
+        while(size > 0)
+        {
+            ssize_t sent = ::send(fd, bytes, size, MSG_NOSIGNAL);
+            if(sent <= 0)
+                return false;
+            bytes += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    uint32_t float_bits_be(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return htonl(bits);
+    }
+
+    float float_from_be(uint32_t bits)
+    {
+        bits = ntohl(bits);
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    /** Request and throughput totals, and the latencies of the most recent requests for the percentiles */
+    struct serve_counters
+    {
+        struct snapshot
+        {
+            uint64_t requests{0};
+            uint64_t batches{0};
+            double median_latency{0.0};
+            double tail_latency{0.0};
+        };
+
+        void record_batch(std::vector<double> const& batch_latencies)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(double latency : batch_latencies)
+            {
+                latencies[requests % latencies.size()] = latency;
+                requests++;
+            }
+            batches++;
+        }
+
+        snapshot take() const
+        {
+            snapshot result;
+            std::vector<double> recent;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                result.requests = requests;
+                result.batches = batches;
+                recent.assign(latencies.begin(), latencies.begin() + std::min<uint64_t>(requests, latencies.size()));
+            }
+
+            if(!recent.empty())
+            {
+                std::nth_element(recent.begin(), recent.begin() + recent.size() / 2, recent.end());
+                result.median_latency = recent[recent.size() / 2];
+                std::nth_element(recent.begin(), recent.begin() + recent.size() * 99 / 100, recent.end());
+                result.tail_latency = recent[recent.size() * 99 / 100];
+            }
+            return result;
+        }
+
+        mutable std::mutex mutex;
+        std::vector<double> latencies = std::vector<double>(65536); // microseconds, a ring over the last requests
+        uint64_t requests{0};
+        uint64_t batches{0};
+    };
+
+    std::string format_counters(serve_counters::snapshot const& counters, uint64_t interval_requests, double interval_seconds)
+    {
+        std::ostringstream text;
+        text << counters.requests << " requests in " << counters.batches << " batches ("
+             << (counters.batches ? double(counters.requests) / counters.batches : 0.0) << " per batch), "
+             << (interval_seconds > 0.0 ? interval_requests / interval_seconds : 0.0) << " requests/s, "
+             << counters.median_latency << " us p50, " << counters.tail_latency << " us p99";
+        return text.str();
+    }
+
+    /**
+     * A model as served: its file, the shapes requests are checked against, and the weights behind a publisher so a reload
+     * can swap them while inferences run. Reloads keep the shapes, so the checks never need the weights
+     */
+    struct served_model
+    {
+        served_model(std::string const& in_path, std::filesystem::file_time_type in_modified, std::unique_ptr<prkl::ann_model> model, prkl::integer num_readers)
+            : path(in_path)
+            , modified(in_modified)
+            , num_inputs(model->layers.front()->num_activations())
+            , num_outputs(model->layers.back()->num_activations())
+            , publisher(num_readers, std::move(model))
+        {
+        }
+
+        std::string path;
+        std::filesystem::file_time_type modified;
+        prkl::integer num_inputs;
+        prkl::integer num_outputs;
+        prkl::ann_model_publisher publisher;
+    };
+
+    std::unique_ptr<prkl::ann_model> load_model(std::string const& path)
+    {
+        std::unique_ptr<prkl::ann_model> model = std::make_unique<prkl::ann_model>(path.c_str());
+        if(model->layers.size() < 2)
+        {
+            std::cerr << "Failed to load model: " << path << std::endl;
+            return nullptr;
+        }
+        return model;
+    }
+
+    /**
+     * Reloads every model whose file changed since it was loaded, or all of them when forced, and publishes them in place of
+     * the old ones. Requests in flight finish on the old weights. A file that fails to load or changes the shapes is skipped
+     * and the old model stays
+     */
+    void reload_models(std::deque<served_model> &models, bool force)
+    {
+        for(prkl::integer model_index = 0; model_index < models.size(); model_index++)
+        {
+            served_model &served = models[model_index];
+            std::error_code error;
+            std::filesystem::file_time_type modified = std::filesystem::last_write_time(served.path, error);
+            if(error || (!force && modified == served.modified))
+                continue;
+
+            // a file caught halfway through writing fails here and is picked up again once its time stamp moves on
+            served.modified = modified;
+            std::unique_ptr<prkl::ann_model> model = load_model(served.path);
+            if(!model)
+                continue;
+
+            if(model->layers.front()->num_activations() != served.num_inputs || model->layers.back()->num_activations() != served.num_outputs)
+            {
+                std::cerr << "Not reloading model " << model_index << ": " << served.path << " changed its shape, restart to serve it" << std::endl;
+                continue;
+            }
+
+            served.publisher.publish(std::move(model));
+            std::cout << "Reloaded model " << model_index << ": " << served.path << std::endl;
+        }
+    }
+
+    struct pending_request
+    {
+        uint32_t model_index{0};
+        std::vector<prkl::real> inputs;
+        std::vector<prkl::real> outputs;
+        clock_type::time_point arrival;
+        std::promise<void> done;
+    };
+
+    /**
+     * Coalesces the requests of all connections into batches. A batch goes out once it holds max_batch requests for one model,
+     * or once its oldest request has waited max_delay, whichever comes first, so no request waits longer than the budget
+     * for company. Every connection has at most one request in flight, so once all connections wait for a response no
+     * request can join and the batch goes out right away. The workers share the models read-only through ann_model::infer,
+     * each with its own contexts and its own reader index for the model publishers
+     */
+    struct serve_batcher
+    {
+        serve_batcher(std::deque<served_model> const& in_models, serve_counters &in_counters, prkl::integer in_max_batch, std::chrono::microseconds in_max_delay)
+            : models(in_models)
+            , counters(in_counters)
+            , max_batch(in_max_batch)
+            , max_delay(in_max_delay)
+        {
+        }
+
+        void submit(pending_request *request)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(request);
+                num_in_flight++;
+            }
+            condition.notify_one();
+        }
+
+        void connect()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            num_connections++;
+        }
+
+        /** A closed connection can leave every remaining one waiting, the held back batch may go now */
+        void disconnect()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                num_connections--;
+            }
+            condition.notify_all();
+        }
+
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopped = true;
+            }
+            condition.notify_all();
+        }
+
+        void work(prkl::integer reader_index)
+        {
+            std::vector<prkl::ann_inference_context> contexts(models.size());
+            std::vector<pending_request*> batch;
+            std::vector<prkl::real> inputs;
+            std::vector<prkl::real> outputs;
+            std::vector<double> latencies;
+
+            std::unique_lock<std::mutex> lock(mutex);
+            while(true)
+            {
+                condition.wait(lock, [this]{ return stopped || !queue.empty(); });
+                if(queue.empty())
+                    return;
+
+                // hold the oldest request back until its model has a full batch or its budget is spent
+                clock_type::time_point deadline = queue.front()->arrival + max_delay;
+                while(!stopped && !queue.empty() && num_in_flight < num_connections && count_queued(queue.front()->model_index) < max_batch && clock_type::now() < deadline)
+                {
+                    condition.wait_until(lock, deadline);
+                }
+
+                // another worker may have taken the batch in the meantime
+                if(queue.empty())
+                    continue;
+
+                uint32_t model_index = queue.front()->model_index;
+                batch.clear();
+                for(auto it = queue.begin(); it != queue.end() && batch.size() < max_batch;)
+                {
+                    if((*it)->model_index == model_index)
+                    {
+                        batch.push_back(*it);
+                        it = queue.erase(it);
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+
+                if(!queue.empty())
+                    condition.notify_one();
+
+                lock.unlock();
+                run(reader_index, model_index, batch, contexts[model_index], inputs, outputs, latencies);
+                lock.lock();
+                num_in_flight -= batch.size();
+            }
+        }
+
+        prkl::integer count_queued(uint32_t model_index) const
+        {
+            return std::count_if(queue.begin(), queue.end(), [model_index](pending_request const* request) { return request->model_index == model_index; });
+        }
+
+        void run(prkl::integer reader_index, uint32_t model_index, std::vector<pending_request*> const& batch, prkl::ann_inference_context &context, std::vector<prkl::real> &inputs, std::vector<prkl::real> &outputs, std::vector<double> &latencies)
+        {
+            served_model const& served = models[model_index];
+            prkl::integer num_inputs = served.num_inputs;
+            prkl::integer num_outputs = served.num_outputs;
+
+            inputs.resize(batch.size() * num_inputs);
+            outputs.resize(batch.size() * num_outputs);
+            for(prkl::integer b = 0; b < batch.size(); b++)
+            {
+                std::copy(batch[b]->inputs.begin(), batch[b]->inputs.end(), inputs.begin() + b * num_inputs);
+            }
+
+            {
+                prkl::ann_model_publisher::read_guard guard = served.publisher.read(reader_index);
+                guard.model().infer(inputs, outputs, batch.size(), context);
+            }
+
+            clock_type::time_point now = clock_type::now();
+            latencies.clear();
+            for(prkl::integer b = 0; b < batch.size(); b++)
+            {
+                pending_request *request = batch[b];
+                request->outputs.assign(outputs.begin() + b * num_outputs, outputs.begin() + (b + 1) * num_outputs);
+                latencies.push_back(std::chrono::duration<double, std::micro>(now - request->arrival).count());
+                request->done.set_value();
+            }
+            counters.record_batch(latencies);
+        }
+
+        std::deque<served_model> const& models;
+        serve_counters &counters;
+        prkl::integer max_batch;
+        std::chrono::microseconds max_delay;
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::deque<pending_request*> queue; // oldest first
+        prkl::integer num_in_flight{0}; // queued or running
+        prkl::integer num_connections{0};
+        bool stopped{false};
+    };
+
+    void write_response(int fd, serve_status status, std::vector<uint32_t> &buffer, uint32_t count)
+    {
+        buffer[0] = htonl((uint32_t)status);
+        buffer[1] = htonl(count);
+        write_exact(fd, buffer.data(), buffer.size() * sizeof(uint32_t));
+    }
+
+    /** A connection and the thread serving it, the accept loop owns both so it can shut them down and join them on stop */
+    struct serve_connection_thread
+    {
+        int fd{-1};
+        std::thread thread;
+        std::atomic<bool> finished{false};
+    };
+
+    /** Serves the requests of one connection until it closes, a thread per connection blocks on its own socket */
+    void serve_connection(int fd, std::deque<served_model> const& models, serve_batcher &batcher, serve_counters const& counters, clock_type::time_point start, std::atomic<bool> &finished)
+    {
+        batcher.connect();
+        std::vector<uint32_t> buffer;
+        pending_request request;
+        while(true)
+        {
+            uint32_t header[2];
+            if(!read_exact(fd, header, sizeof(header)))
+                break;
+
+            uint32_t model_index = ntohl(header[0]);
+            uint32_t count = ntohl(header[1]);
+            if(count > max_request_values)
+                break;
+
+            buffer.resize(2 + count);
+            if(!read_exact(fd, buffer.data() + 2, count * sizeof(uint32_t)))
+                break;
+
+            if(model_index == stats_request)
+            {
+                serve_counters::snapshot snapshot = counters.take();
+                std::chrono::duration<double> seconds = clock_type::now() - start;
+                std::string text = format_counters(snapshot, snapshot.requests, seconds.count());
+                buffer.assign(2 + (text.size() + 3) / 4, 0);
+                std::memcpy(buffer.data() + 2, text.data(), text.size());
+                buffer[0] = htonl((uint32_t)serve_status::ok);
+                buffer[1] = htonl((uint32_t)text.size());
+                write_exact(fd, buffer.data(), 2 * sizeof(uint32_t) + text.size());
+                continue;
+            }
+
+            if(model_index >= models.size())
+            {
+                buffer.resize(2);
+                write_response(fd, serve_status::unknown_model, buffer, 0);
+                continue;
+            }
+
+            if(count != models[model_index].num_inputs)
+            {
+                buffer.resize(2);
+                write_response(fd, serve_status::input_mismatch, buffer, 0);
+                continue;
+            }
+
+            request.model_index = model_index;
+            request.inputs.resize(count);
+            for(uint32_t i = 0; i < count; i++)
+            {
+                request.inputs[i] = float_from_be(buffer[2 + i]);
+            }
+
+            request.done = std::promise<void>();
+            std::future<void> done = request.done.get_future();
+            request.arrival = clock_type::now();
+            batcher.submit(&request);
+            done.wait();
+
+            uint32_t num_outputs = request.outputs.size();
+            buffer.resize(2 + num_outputs);
+            for(uint32_t o = 0; o < num_outputs; o++)
+            {
+                buffer[2 + o] = float_bits_be(request.outputs[o]);
+            }
+            write_response(fd, serve_status::ok, buffer, num_outputs);
+        }
+
+        // the fd stays open until the accept loop joins this thread, so shutting it down never hits a reused descriptor
+        batcher.disconnect();
+        finished = true;
+    }
+
+#ifdef PRKL_SHARED_MEMORY
+    /**
+     * Serving loop of the shared memory transport. Whatever arrived while the previous batch ran forms the next one, so the
+     * batches grow with the load without holding a request back. A lone request runs in place in its slot without a copy
+     */
+    void serve_shared_memory(prkl::ann_shm_server &server, std::deque<served_model> const& models, serve_counters &counters, prkl::integer max_batch, prkl::integer reader_index)
+    {
+        std::vector<prkl::ann_inference_context> contexts(models.size());
+        std::vector<prkl::integer> taken;
+        std::vector<prkl::integer> batch;
+        std::vector<prkl::real> inputs;
+        std::vector<prkl::real> outputs;
+        std::vector<double> latencies;
+        clock_type::time_point last_reclaim = clock_type::now();
+
+        while(!stopping)
+        {
+            // slots of crashed clients come back once a second, checking every owner costs a system call each
+            if(clock_type::now() - last_reclaim >= std::chrono::seconds(1))
+            {
+                server.reclaim();
+                last_reclaim = clock_type::now();
+            }
+
+            taken.clear();
+            if(server.wait(taken, server.header->num_slots, std::chrono::milliseconds(200)) == 0)
+                continue;
+
+            // turn away what no model can run, so every slot left is a valid request
+            std::erase_if(taken, [&](prkl::integer slot_index)
+            {
+                prkl::ann_shm_slot &slot = server.slot(slot_index);
+                if(slot.model_index >= models.size())
+                    server.complete(slot_index, prkl::ann_shm_status::unknown_model, 0);
+                else if(slot.count != models[slot.model_index].num_inputs)
+                    server.complete(slot_index, prkl::ann_shm_status::input_mismatch, 0);
+                else
+                    return false;
+                return true;
+            });
+
+            while(!taken.empty())
+            {
+                uint32_t model_index = server.slot(taken.front()).model_index;
+                batch.clear();
+                std::erase_if(taken, [&](prkl::integer slot_index)
+                {
+                    if(batch.size() == max_batch || server.slot(slot_index).model_index != model_index)
+                        return false;
+                    batch.push_back(slot_index);
+                    return true;
+                });
+
+                served_model const& served = models[model_index];
+                prkl::integer num_inputs = served.num_inputs;
+                prkl::integer num_outputs = served.num_outputs;
+                prkl::ann_model_publisher::read_guard guard = served.publisher.read(reader_index);
+                prkl::ann_model const& model = guard.model();
+                if(batch.size() == 1)
+                {
+                    // inputs and outputs share the slot, infer reads every input before it writes an output
+                    prkl::real *data = server.slot(batch.front()).data();
+                    model.infer({ data, num_inputs }, { data, num_outputs }, 1, contexts[model_index]);
+                }
+                else
+                {
+                    inputs.resize(batch.size() * num_inputs);
+                    outputs.resize(batch.size() * num_outputs);
+                    for(prkl::integer b = 0; b < batch.size(); b++)
+                    {
+                        prkl::real const* data = server.slot(batch[b]).data();
+                        std::copy(data, data + num_inputs, inputs.begin() + b * num_inputs);
+                    }
+
+                    model.infer(inputs, outputs, batch.size(), contexts[model_index]);
+                    for(prkl::integer b = 0; b < batch.size(); b++)
+                    {
+                        std::copy(outputs.begin() + b * num_outputs, outputs.begin() + (b + 1) * num_outputs, server.slot(batch[b]).data());
+                    }
+                }
+
+                uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count();
+                latencies.clear();
+                for(prkl::integer slot_index : batch)
+                {
+                    latencies.push_back((now - server.slot(slot_index).submit_time) / 1000.0);
+                    server.complete(slot_index, prkl::ann_shm_status::ok, num_outputs);
+                }
+                counters.record_batch(latencies);
+            }
+        }
+    }
+#endif
+
+    int listen_unix(std::string const& path)
+    {
+        sockaddr_un address{};
+        if(path.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "Unix socket path too long: " << path << std::endl;
+            return -1;
+        }
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        ::unlink(path.c_str());
+        if(fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(fd, SOMAXCONN) != 0)
+        {
+            std::cerr << "Failed to listen on Unix socket: " << path << std::endl;
+            if(fd >= 0)
+                ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    int listen_tcp(std::string const& host, uint16_t port)
+    {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        if(::inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1)
+        {
+            std::cerr << "Invalid IPv4 address: " << host << std::endl;
+            return -1;
+        }
+
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        int enable = 1;
+        if(fd >= 0)
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+        if(fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(fd, SOMAXCONN) != 0)
+        {
+            std::cerr << "Failed to listen on " << host << ":" << port << std::endl;
+            if(fd >= 0)
+                ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+    cli::Parser parser(argc, argv);
+    parser.set_required<std::vector<std::string>>("m", "models", "Paths to the models to serve (.prklmodel files), requests pick one by its position in this list");
+    parser.set_optional<std::string>("u", "unix-socket", "", "Path of a Unix socket to listen on");
+    parser.set_optional<prkl::integer>("p", "port", 0, "TCP port to listen on, 0 for none");
+    parser.set_optional<std::string>("a", "address", "127.0.0.1", "IPv4 address to listen on for TCP");
+    parser.set_optional<prkl::integer>("b", "max-batch", 32, "Most requests of one model run as one batch");
+    parser.set_optional<prkl::integer>("l", "max-delay", 500, "Longest a request waits for a batch to fill, in microseconds");
+    parser.set_optional<prkl::integer>("w", "workers", 0, "Number of inference worker threads, 0 for one per core");
+    parser.set_optional<prkl::integer>("s", "stats-interval", 10, "Seconds between counter reports on stdout, 0 to disable");
+    parser.set_optional<prkl::integer>("r", "reload-interval", 0, "Seconds between checks for changed model files, which are reloaded without a restart. 0 reloads only on SIGHUP");
+#ifdef PRKL_SHARED_MEMORY
+    parser.set_optional<std::string>("x", "shared-memory", "", "Name of a POSIX shared memory segment to serve co-located clients on, such as /prkl-serve");
+    parser.set_optional<prkl::integer>("n", "slots", 64, "Number of request slots in the shared memory segment, the most requests in flight at once");
+#endif
+    parser.run_and_exit_if_error();
+
+    std::vector<std::string> model_paths = parser.get<std::vector<std::string>>("m");
+    std::string unix_path = parser.get<std::string>("u");
+    prkl::integer port = parser.get<prkl::integer>("p");
+    std::string address = parser.get<std::string>("a");
+    prkl::integer max_batch = std::max<prkl::integer>(1, parser.get<prkl::integer>("b"));
+    std::chrono::microseconds max_delay(parser.get<prkl::integer>("l"));
+    prkl::integer num_workers = parser.get<prkl::integer>("w");
+    prkl::integer stats_interval = parser.get<prkl::integer>("s");
+    prkl::integer reload_interval = parser.get<prkl::integer>("r");
+    std::string shared_memory_name;
+#ifdef PRKL_SHARED_MEMORY
+    shared_memory_name = parser.get<std::string>("x");
+    prkl::integer num_slots = std::max<prkl::integer>(1, parser.get<prkl::integer>("n"));
+#endif
+
+    if(unix_path.empty() && port == 0 && shared_memory_name.empty())
+    {
+        std::cerr << "Nothing to listen on, give a Unix socket (-u), a TCP port (-p) or a shared memory segment (-x)" << std::endl;
+        return 1;
+    }
+    if(num_workers == 0)
+        num_workers = std::max(1u, std::thread::hardware_concurrency());
+
+    // every worker reads the models, and so does the shared memory loop behind them
+    prkl::integer num_readers = num_workers + 1;
+
+    std::cout << " --- Loading models --- " << std::endl;
+    std::deque<served_model> models;
+    for(std::string const& path : model_paths)
+    {
+        std::error_code error;
+        std::filesystem::file_time_type modified = std::filesystem::last_write_time(path, error);
+        std::unique_ptr<prkl::ann_model> model = load_model(path);
+        if(!model)
+            return 1;
+
+        served_model &served = models.emplace_back(path, modified, std::move(model), num_readers);
+        std::cout << "Model " << (models.size() - 1) << ": " << path << ", " << served.num_inputs << " inputs, " << served.num_outputs << " outputs" << std::endl;
+    }
+
+    std::vector<pollfd> listeners;
+    if(!unix_path.empty())
+    {
+        int fd = listen_unix(unix_path);
+        if(fd < 0)
+            return 1;
+        listeners.push_back({fd, POLLIN, 0});
+        std::cout << "Listening on " << unix_path << std::endl;
+    }
+    if(port != 0)
+    {
+        int fd = listen_tcp(address, (uint16_t)port);
+        if(fd < 0)
+            return 1;
+        listeners.push_back({fd, POLLIN, 0});
+        std::cout << "Listening on " << address << ":" << port << std::endl;
+    }
+
+#ifdef PRKL_SHARED_MEMORY
+    // slots hold the inputs and then the outputs of a request, so they fit the widest of either
+    prkl::ann_shm_server shared_memory;
+    if(!shared_memory_name.empty())
+    {
+        prkl::integer slot_capacity = 0;
+        for(served_model const& served : models)
+            slot_capacity = std::max({ slot_capacity, served.num_inputs, served.num_outputs });
+
+        if(!shared_memory.create(shared_memory_name, num_slots, slot_capacity))
+            return 1;
+        std::cout << "Serving on shared memory " << shared_memory_name << ", " << num_slots << " slots" << std::endl;
+    }
+#endif
+
+    std::signal(SIGINT, [](int) { stopping = true; });
+    std::signal(SIGTERM, [](int) { stopping = true; });
+    std::signal(SIGHUP, [](int) { reload_requested = true; });
+
+    serve_counters counters;
+    serve_batcher batcher(models, counters, max_batch, max_delay);
+    std::vector<std::thread> workers;
+    for(prkl::integer w = 0; w < num_workers; w++)
+    {
+        workers.emplace_back(&serve_batcher::work, &batcher, w);
+    }
+    std::cout << "Batches of up to " << max_batch << " within " << max_delay.count() << " us, on " << num_workers << " workers" << std::endl;
+
+#ifdef PRKL_SHARED_MEMORY
+    std::thread shared_memory_loop;
+    if(!shared_memory_name.empty())
+        shared_memory_loop = std::thread(serve_shared_memory, std::ref(shared_memory), std::cref(models), std::ref(counters), max_batch, num_workers);
+#endif
+
+    clock_type::time_point start = clock_type::now();
+    clock_type::time_point last_report = start;
+    clock_type::time_point last_reload = start;
+    uint64_t last_requests = 0;
+    std::list<serve_connection_thread> connections;
+    while(!stopping)
+    {
+        // the timeout bounds how late a stop request or a counter report can be
+        if(::poll(listeners.data(), listeners.size(), 200) > 0)
+        {
+            for(pollfd const& listener : listeners)
+            {
+                if(!(listener.revents & POLLIN))
+                    continue;
+
+                int fd = ::accept(listener.fd, nullptr, nullptr);
+                if(fd < 0)
+                    continue;
+
+                int enable = 1;
+                ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)); // fails harmlessly on Unix sockets
+                serve_connection_thread &connection = connections.emplace_back();
+                connection.fd = fd;
+                connection.thread = std::thread(serve_connection, fd, std::cref(models), std::ref(batcher), std::cref(counters), start, std::ref(connection.finished));
+            }
+        }
+
+        for(auto c = connections.begin(); c != connections.end(); )
+        {
+            if(!c->finished)
+            {
+                ++c;
+                continue;
+            }
+            c->thread.join();
+            ::close(c->fd);
+            c = connections.erase(c);
+        }
+
+        clock_type::time_point now = clock_type::now();
+        bool forced_reload = reload_requested.exchange(false);
+        if(forced_reload || (reload_interval > 0 && now - last_reload >= std::chrono::seconds(reload_interval)))
+        {
+            reload_models(models, forced_reload);
+            last_reload = now;
+        }
+
+        // old weights go once the last inference that could hold them is done, no reader ever waits for this
+        for(served_model &served : models)
+            served.publisher.reclaim();
+
+        if(stats_interval > 0 && now - last_report >= std::chrono::seconds(stats_interval))
+        {
+            serve_counters::snapshot snapshot = counters.take();
+            std::chrono::duration<double> seconds = now - last_report;
+            if(snapshot.requests != last_requests)
+                std::cout << format_counters(snapshot, snapshot.requests - last_requests, seconds.count()) << std::endl;
+            last_report = now;
+            last_requests = snapshot.requests;
+        }
+    }
+
+    std::cout << " --- Stopping --- " << std::endl;
+    for(pollfd const& listener : listeners)
+        ::close(listener.fd);
+    if(!unix_path.empty())
+        ::unlink(unix_path.c_str());
+
+    // connections go before the batcher, a request already submitted still gets its response
+    for(serve_connection_thread &connection : connections)
+        ::shutdown(connection.fd, SHUT_RDWR);
+    for(serve_connection_thread &connection : connections)
+    {
+        connection.thread.join();
+        ::close(connection.fd);
+    }
+
+    batcher.stop();
+    for(std::thread &worker : workers)
+        worker.join();
+#ifdef PRKL_SHARED_MEMORY
+    if(shared_memory_loop.joinable())
+        shared_memory_loop.join();
+#endif
+
+    serve_counters::snapshot snapshot = counters.take();
+    std::chrono::duration<double> seconds = clock_type::now() - start;
+    std::cout << format_counters(snapshot, snapshot.requests, seconds.count()) << std::endl;
+    return 0;
+}
@@ -0,0 +1,207 @@
+
+#include "model.hpp"
+#include "cmdparser.hpp"
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+
+namespace
+{
+    struct sweep_trial
+    {
+        std::string name;
+        prkl::ann_model model;
+        prkl::real success_rate{0.0f};
+    };
+
+    /** Applies one swept hyperparameter to a trial model, returns false for unknown names or values */
+    bool apply_parameter(prkl::ann_model &model, std::string const& name, nlohmann::json const& value)
+    {
+        bool numeric = name == "learning_rate" || name == "grad_limit" || name == "loss_edge" || name == "min_rate" || name == "momentum" || name == "weight_decay";
+        if(numeric && !value.is_number())
+        {
+            std::cerr << "Sweep parameter " << name << " needs numeric values" << std::endl;
+            return false;
+        }
+        bool textual = name == "optimizer" || name == "schedule" || name == "precision";
+        if(textual && !value.is_string())
+        {
+            std::cerr << "Sweep parameter " << name << " needs string values" << std::endl;
+            return false;
+        }
+
+        if(name == "learning_rate")
+            model.settings.base_rate = value.template get<prkl::real>();
+        else if(name == "grad_limit")
+            model.settings.grad_limit = value.template get<prkl::real>();
+        else if(name == "loss_edge")
+            model.settings.loss_edge = value.template get<prkl::real>();
+        else if(name == "min_rate")
+            model.settings.min_rate = value.template get<prkl::real>();
+        else if(name == "momentum")
+            model.optimizer.momentum = value.template get<prkl::real>();
+        else if(name == "weight_decay")
+            model.optimizer.weight_decay = value.template get<prkl::real>();
+        else if(name == "optimizer")
+            return prkl::optimizer_type_from_string(value.template get<std::string>(), model.optimizer.type);
+        else if(name == "schedule")
+            return model.schedule.parse(value.template get<std::string>());
+        else if(name == "precision")
+            return prkl::precision_from_string(value.template get<std::string>(), model.precision);
+        else
+            return false;
+
+        return true;
+    }
+}
+
+int32_t main(int32_t argc, char **argv)
+{
+    cli::Parser parser(argc, argv);
+    parser.set_required<std::string>("t", "training-set", "Path to training set (.prklset file)");
+    parser.set_required<std::string>("e", "evaluation-set", "Path to evaluation set (.prklset file), trials are ranked by their success rate on it");
+    parser.set_required<std::string>("c", "config", "Path to model config (.json file), shared by all trials");
+    parser.set_required<std::string>("s", "sweep", "Path to sweep config (.json file), an object of hyperparameter names to arrays of values");
+    parser.set_optional<prkl::integer>("n", "rung-epochs", 1, "Epochs every trial trains in the first rung, each later rung trains reduction-factor times longer");
+    parser.set_optional<prkl::integer>("f", "reduction-factor", 2, "Only the best 1/reduction-factor of the trials advance to the next rung");
+    parser.set_optional<prkl::integer>("j", "threads", 0, "Number of trials trained concurrently (0 = all available cores), the cores are split evenly between them");
+    parser.set_optional<std::string>("o", "output", "", "Path to output file for the winning model (.prklmodel file)");
+    parser.run_and_exit_if_error();
+
+    std::string config_path = parser.get<std::string>("c");
+    std::ifstream config_file(config_path);
+    if(!config_file)
+    {
+        std::cerr << "Failed to read model configuration: " << config_path << std::endl;
+        return 1;
+    }
+    nlohmann::json config = nlohmann::json::parse(config_file);
+
+    std::string sweep_path = parser.get<std::string>("s");
+    std::ifstream sweep_file(sweep_path);
+    if(!sweep_file)
+    {
+        std::cerr << "Failed to read sweep configuration: " << sweep_path << std::endl;
+        return 1;
+    }
+    nlohmann::json sweep = nlohmann::json::parse(sweep_file);
+
+    prkl::integer rung_epochs = std::max(parser.get<prkl::integer>("n"), (prkl::integer)1);
+    prkl::integer reduction_factor = std::max(parser.get<prkl::integer>("f"), (prkl::integer)2);
+    prkl::integer num_threads = parser.get<prkl::integer>("j");
+    if(num_threads == 0)
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::string output_path = parser.get<std::string>("o");
+
+    // the sets are loaded once and only ever read, every trial trains on the same memory
+    std::cout << " --- Loading sets --- " << std::endl;
+    prkl::ann_set const training_set(parser.get<std::string>("t").c_str());
+    prkl::ann_set const evaluation_set(parser.get<std::string>("e").c_str());
+
+    // trials are cloned from one template, so they all start from the same initial weights and only differ in the swept values
+    std::cout << " --- Building trials --- " << std::endl;
+    prkl::ann_model template_model(config);
+    template_model.settings.verbose = false;
+    template_model.settings.hogwild = false;
+    template_model.settings.async_evaluation = false;
+    template_model.settings.evaluation_threads = 1;
+    template_model.settings.checkpoint_path.clear();
+    template_model.settings.telemetry_path.clear();
+
+    std::vector<std::pair<std::string, nlohmann::json>> dimensions;
+    prkl::integer num_trials = 1;
+    for(auto& [name, values] : sweep.items())
+    {
+        if(!values.is_array() || values.empty())
+        {
+            std::cerr << "Sweep parameter must be a non-empty array of values: " << name << std::endl;
+            return 1;
+        }
+        dimensions.emplace_back(name, values);
+        num_trials *= values.size();
+    }
+
+    std::vector<sweep_trial> trials;
+    trials.reserve(num_trials);
+    for(prkl::integer t = 0; t < num_trials; t++)
+    {
+        sweep_trial &trial = trials.emplace_back(sweep_trial{"", template_model.clone()});
+
+        // mixed radix decomposition of the trial index, one digit per dimension
+        std::stringstream name;
+        prkl::integer remainder = t;
+        for(auto const& [parameter, values] : dimensions)
+        {
+            nlohmann::json const& value = values[remainder % values.size()];
+            remainder /= values.size();
+
+            if(!apply_parameter(trial.model, parameter, value))
+            {
+                std::cerr << "Unrecognized sweep parameter or value: " << parameter << " = " << value.dump() << std::endl;
+                return 1;
+            }
+            name << parameter << "=" << (value.is_string() ? value.template get<std::string>() : value.dump()) << " ";
+        }
+        trial.name = name.str();
+    }
+
+    std::cout << "Sweeping " << num_trials << " trials on " << num_threads << " threads" << std::endl;
+
+    // successive halving: every rung trains the surviving trials further, then keeps the best 1/reduction_factor
+    std::vector<prkl::integer> survivors(num_trials);
+    for(prkl::integer t = 0; t < num_trials; t++)
+        survivors[t] = t;
+
+    prkl::integer epochs = rung_epochs;
+    for(prkl::integer rung = 0; ; rung++)
+    {
+        std::cout << " --- Rung " << rung << ": " << survivors.size() << " trials, " << epochs << " epochs each --- " << std::endl;
+
+        // the cores are split between the concurrent trials, each trial's layer loops only use its share
+        prkl::integer num_workers = std::min(num_threads, (prkl::integer)survivors.size());
+        prkl::integer num_cores = std::max(std::thread::hardware_concurrency(), 1u);
+        for(sweep_trial &trial : trials)
+            trial.model.settings.num_threads = std::max(num_cores / num_workers, (prkl::integer)1);
+
+        std::atomic<prkl::integer> next_survivor{0};
+        auto worker = [&]()
+        {
+            for(prkl::integer s = next_survivor++; s < survivors.size(); s = next_survivor++)
+            {
+                sweep_trial &trial = trials[survivors[s]];
+                trial.model.train(training_set, epochs, &evaluation_set);
+                trial.success_rate = 1.0 - prkl::real(trial.model.count_misses(evaluation_set)) / prkl::real(evaluation_set.pairs.size());
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for(prkl::integer w = 0; w < num_workers; w++)
+            workers.emplace_back(worker);
+        for(std::thread &w : workers)
+            w.join();
+
+        std::stable_sort(survivors.begin(), survivors.end(), [&](prkl::integer a, prkl::integer b) { return trials[a].success_rate > trials[b].success_rate; });
+        for(prkl::integer t : survivors)
+        {
+            std::cout << (trials[t].success_rate * 100.0) << "%  " << trials[t].name << std::endl;
+        }
+
+        survivors.resize((survivors.size() + reduction_factor - 1) / reduction_factor);
+        if(survivors.size() == 1)
+            break;
+
+        epochs *= reduction_factor;
+    }
+
+    sweep_trial &winner = trials[survivors.front()];
+    std::cout << "Best trial: " << winner.name << "with a success rate of " << (winner.success_rate * 100.0) << "%" << std::endl;
+
+    if(!output_path.empty())
+    {
+        std::cout << "Writing model: " << output_path << std::endl;
+        winner.model.write_file(output_path.c_str());
+    }
+
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include "model.hpp"
 #include "cmdparser.hpp"
 #include <iostream>
+#include <cmath>
 
 int32_t main(int32_t argc, char **argv)
 {
@@ -15,19 +16,52 @@ int32_t main(int32_t argc, char **argv)
     parser.set_optional<prkl::real>("m", "alr-min-rate", prkl::settings().min_rate, "Adaptive Learning Rate: Minimum rate");
     parser.set_optional<prkl::real>("l", "alr-loss-edge", prkl::settings().loss_edge, "Adaptive Learning Rate: Loss edge");
     parser.set_optional<prkl::real>("g", "grad-limit", prkl::settings().grad_limit, "Maximum gradient amplitude");
+    parser.set_optional<bool>("w", "hogwild", prkl::settings().hogwild, "Lock-free asynchronous (hogwild) training");
+    parser.set_optional<prkl::integer>("j", "threads", prkl::settings().num_threads, "Number of training threads (0 = all available)");
+    parser.set_optional<bool>("D", "deterministic", prkl::settings().deterministic, "Hogwild in lockstep rounds with fixed work partitioning, bit-identical for a given seed and thread count (implies -w)");
+    parser.set_optional<bool>("y", "async-evaluation", prkl::settings().async_evaluation, "Evaluate each epoch on a background thread while the next epoch trains");
+    parser.set_optional<prkl::integer>("v", "evaluation-threads", prkl::settings().evaluation_threads, "Number of evaluation threads (0 = all available)");
+    parser.set_optional<std::string>("u", "optimizer", "", "Optimizer: sgd, momentum, nesterov, rmsprop, adam or adamw (overrides model config)");
+    parser.set_optional<prkl::real>("k", "momentum", prkl::ann_optimizer().momentum, "Optimizer: momentum factor for momentum and nesterov (overrides model config)");
+    parser.set_optional<prkl::real>("d", "weight-decay", prkl::ann_optimizer().weight_decay, "Optimizer: decoupled weight decay for adamw (overrides model config)");
+    parser.set_optional<std::string>("r", "schedule", "", "Learning rate schedule, comma separated policies as name[:value], e.g. warmup:1,cosine:10,plateau:3 (overrides model config and ALR)");
+    parser.set_optional<std::string>("f", "precision", "", "Weight storage precision: fp32, bf16 or fp16 to train against reduced precision weights (slower than fp32), or int8 for quantization-aware training (overrides model config)");
+    parser.set_optional<prkl::integer>("F", "freeze", 0, "Freeze the first N layers after the input layer, for fine-tuning (overrides model config)");
+    parser.set_optional<bool>("N", "no-frozen-cache", !prkl::settings().cache_frozen_prefix, "Run the frozen layers every epoch instead of caching their outputs once");
+    parser.set_optional<std::string>("i", "checkpoint", "", "Path to checkpoint file, written in the background during training");
+    parser.set_optional<prkl::integer>("n", "checkpoint-interval", prkl::settings().checkpoint_interval, "Epochs between checkpoints");
+    parser.set_optional<bool>("x", "resume", prkl::settings().resume, "Resume training from the checkpoint file if it exists");
+    parser.set_optional<std::string>("q", "telemetry", "", "Path to per epoch telemetry file with phase timings and throughput (JSON lines, or CSV for .csv)");
+    parser.set_optional<std::string>("T", "teacher", "", "Path to a trained teacher model (.prklmodel file) to distill from, its softened outputs are blended into the targets");
+    parser.set_optional<prkl::real>("K", "temperature", prkl::settings().distillation_temperature, "Distillation: temperature the teacher's outputs are softened with");
+    parser.set_optional<prkl::real>("A", "soft-weight", prkl::settings().distillation_weight, "Distillation: share of the soft teacher targets in the blend with the hard targets");
+    parser.set_optional<uint64_t>("S", "seed", prkl::settings().seed, "Seed for weight initialization and all other random streams (0 = nondeterministic)");
     parser.set_optional<std::string>("o", "output", "", "Path to output file (.prklmodel file)");
+    parser.set_optional<std::string>("Q", "quantized-output", "", "Path to output file for the int8 quantized model (.prklmodel file), with the activation ranges tracked by int8 precision training");
     parser.set_optional<prkl::integer>("p", "epochs", 10, "Number of epochs");
-    parser.set_required<std::string>("c", "config", "Path to model config (.json file)");
+    parser.set_optional<std::string>("c", "config", "", "Path to model config (.json file), with --model it only overrides activations, frozen layers and learning settings");
+    parser.set_optional<std::string>("M", "model", "", "Path to a trained model (.prklmodel file) to warm start from instead of random weights");
     parser.run_and_exit_if_error();
 
     std::string config_path = parser.get<std::string>("c");
-    std::ifstream config_file(config_path);
-    if(!config_file)
+    std::string model_path = parser.get<std::string>("M");
+    if(config_path.empty() && model_path.empty())
     {
-        std::cerr << "Failed to read model configuration: " << config_path << std::endl;
+        std::cerr << "A model config, an input model or both are required" << std::endl;
         return 1;
     }
-    nlohmann::json config = nlohmann::json::parse(config_file);
+
+    nlohmann::json config;
+    if(!config_path.empty())
+    {
+        std::ifstream config_file(config_path);
+        if(!config_file)
+        {
+            std::cerr << "Failed to read model configuration: " << config_path << std::endl;
+            return 1;
+        }
+        config = nlohmann::json::parse(config_file);
+    }
 
     std::string training_set_path = parser.get<std::string>("t");
     std::string evaluation_set_path = parser.get<std::string>("e");
@@ -40,6 +74,31 @@ int32_t main(int32_t argc, char **argv)
     prkl::settings().min_rate = parser.get<prkl::real>("m");
     prkl::settings().loss_edge = parser.get<prkl::real>("l");
     prkl::settings().grad_limit = parser.get<prkl::real>("g");
+    prkl::settings().hogwild = parser.get<bool>("w");
+    prkl::settings().num_threads = parser.get<prkl::integer>("j");
+    prkl::settings().deterministic = parser.get<bool>("D");
+    prkl::settings().cache_frozen_prefix = !parser.get<bool>("N");
+    prkl::settings().async_evaluation = parser.get<bool>("y");
+    prkl::settings().evaluation_threads = parser.get<prkl::integer>("v");
+    prkl::settings().checkpoint_path = parser.get<std::string>("i");
+    prkl::settings().checkpoint_interval = parser.get<prkl::integer>("n");
+    prkl::settings().resume = parser.get<bool>("x");
+    prkl::settings().telemetry_path = parser.get<std::string>("q");
+    prkl::settings().teacher_path = parser.get<std::string>("T");
+    prkl::settings().distillation_temperature = parser.get<prkl::real>("K");
+    prkl::settings().distillation_weight = parser.get<prkl::real>("A");
+    // written as negated ranges so NaN fails them too
+    if(!(prkl::settings().distillation_weight >= 0.0f && prkl::settings().distillation_weight <= 1.0f))
+    {
+        std::cerr << "Soft target weight must be between 0 and 1: " << prkl::settings().distillation_weight << std::endl;
+        return 1;
+    }
+    if(!(prkl::settings().distillation_temperature > 0.0f && std::isfinite(prkl::settings().distillation_temperature)))
+    {
+        std::cerr << "Distillation temperature must be positive: " << prkl::settings().distillation_temperature << std::endl;
+        return 1;
+    }
+    prkl::settings().seed = parser.get<uint64_t>("S");
 
     std::string output_path = parser.get<std::string>("o");
     bool do_output = !output_path.empty();
@@ -61,9 +120,14 @@ int32_t main(int32_t argc, char **argv)
 
     std::cout << " --- Configuration ---" << std::endl;
     std::cout << "Layer configuration: " << config_path << std::endl;
+    std::cout << "Input model: " << model_path << std::endl;
     std::cout << "Training set: " << training_set_path << std::endl;
     std::cout << "Evaluation set: " << evaluation_set_path << std::endl;
     std::cout << "Output model: " << output_path << std::endl;
+    std::cout << "Checkpoint: " << prkl::settings().checkpoint_path << std::endl;
+    std::cout << "Resume: " << prkl::settings().resume << std::endl;
+    std::cout << "Telemetry: " << prkl::settings().telemetry_path << std::endl;
+    std::cout << "Teacher: " << prkl::settings().teacher_path << std::endl;
     std::cout << "Num. epochs: " << num_epochs << std::endl;
     std::cout << "Gradient limit: " << prkl::settings().grad_limit << std::endl;
     std::cout << "ALR enabled:" << prkl::settings().alr << std::endl;
@@ -72,11 +136,57 @@ int32_t main(int32_t argc, char **argv)
     std::cout << "ALR minimum rate: " <<  prkl::settings().min_rate << std::endl;
     std::cout << "ALR ease: " <<  prkl::settings().ease << std::endl;
     std::cout << "ALR ease alpha: " <<  prkl::settings().ease_alpha << std::endl;
+    std::cout << "Hogwild: " << prkl::settings().hogwild << std::endl;
+    std::cout << "Threads: " << prkl::settings().num_threads << std::endl;
+    std::cout << "Deterministic: " << prkl::settings().deterministic << std::endl;
+    std::cout << "Async evaluation: " << prkl::settings().async_evaluation << std::endl;
+    std::cout << "Evaluation threads: " << prkl::settings().evaluation_threads << std::endl;
     std::cout << " ---------------------" << std::endl;
 
 
-    prkl::ann_model model(config);
+    // a warm start keeps the weights of the input model, and the config only tweaks what doesn't change its shape
+    prkl::ann_model model = model_path.empty() ? prkl::ann_model(config) : prkl::ann_model(model_path.c_str());
+    if(model.layers.size() < 2)
+    {
+        std::cerr << "Failed to build model" << std::endl;
+        return 1;
+    }
+    if(!model_path.empty() && !config_path.empty() && !model.override_config(config))
+    {
+        std::cerr << "Model configuration doesn't fit the input model: " << config_path << std::endl;
+        return 1;
+    }
 
+    std::string optimizer_str = parser.get<std::string>("u");
+    if(!optimizer_str.empty() && !prkl::optimizer_type_from_string(optimizer_str, model.optimizer.type))
+    {
+        std::cerr << "Unrecognized optimizer: " << optimizer_str << std::endl;
+        return 1;
+    }
+    std::string schedule_str = parser.get<std::string>("r");
+    if(!schedule_str.empty() && !model.schedule.parse(schedule_str))
+    {
+        std::cerr << "Invalid learning rate schedule: " << schedule_str << std::endl;
+        return 1;
+    }
+    std::string precision_str = parser.get<std::string>("f");
+    if(!precision_str.empty() && !prkl::precision_from_string(precision_str, model.precision))
+    {
+        std::cerr << "Unrecognized precision: " << precision_str << std::endl;
+        return 1;
+    }
+    if(parser.doesArgumentExist("k", "--momentum"))
+        model.optimizer.momentum = parser.get<prkl::real>("k");
+    if(parser.doesArgumentExist("d", "--weight-decay"))
+        model.optimizer.weight_decay = parser.get<prkl::real>("d");
+    if(parser.doesArgumentExist("F", "--freeze"))
+    {
+        prkl::integer num_frozen = parser.get<prkl::integer>("F");
+        for(prkl::integer layer_index = 1; layer_index < model.layers.size(); layer_index++)
+        {
+            model.layers[layer_index]->frozen = layer_index <= num_frozen;
+        }
+    }
 
     std::cout << " --- Training model --- " << std::endl;
     if(!model.train(training_set, num_epochs, do_evaluation ? &evaluation_set : nullptr))
@@ -97,5 +207,22 @@ int32_t main(int32_t argc, char **argv)
         model.write_file(output_path.c_str());
     }
 
+    std::string quantized_output_path = parser.get<std::string>("Q");
+    if(!quantized_output_path.empty())
+    {
+        // without quantization-aware training the ranges come from a post-training calibration on the training set
+        std::vector<prkl::ann_quantization_range> ranges = model.activation_ranges.empty() ? model.calibrate(training_set) : model.activation_ranges;
+        prkl::integer num_quantized = model.quantize(ranges, true);
+        std::cout << "Quantized " << num_quantized << " layers to int8" << std::endl;
+        if(do_evaluation)
+        {
+            std::cout << " --- Evaluating quantized model --- " << std::endl;
+            model.evaluate(evaluation_set);
+        }
+
+        std::cout << "Writing quantized model: " << quantized_output_path << std::endl;
+        model.write_file(quantized_output_path.c_str());
+    }
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,286 @@
+
+#include "checkpoint.hpp"
+
+#include <iostream>
+#include <cstdio>
+
+#define ann_checkpoint_magic 248912394734577844
+#define ann_checkpoint_version 3
+
+namespace
+{
+    void write_reals(std::ofstream &file, std::vector<prkl::real> const& values)
+    {
+        prkl::write_uint64_be(file, values.size());
+        for(prkl::real value : values)
+        {
+            prkl::write_float_be(file, value);
+        }
+    }
+
+    void read_reals(std::ifstream &file, std::vector<prkl::real> &values)
+    {
+        values.resize(prkl::read_uint64_be(file));
+        for(prkl::real &value : values)
+        {
+            value = prkl::read_float_be(file);
+        }
+    }
+}
+
+void prkl::ann_checkpoint::resize(ann_model const& model)
+{
+    integer num_parameters = 0;
+    integer num_training_state = 0;
+    for(ann_layer_base *l : model.layers)
+    {
+        num_parameters += l->num_parameters();
+        num_training_state += l->num_training_state();
+    }
+
+    parameters.resize(num_parameters);
+    best_parameters.resize(num_parameters);
+    training_state.resize(num_training_state);
+    schedule_policies = model.schedule.policies;
+}
+
+void prkl::ann_checkpoint::capture(ann_model const& model, ann_snapshot const& best_model)
+{
+    assert(best_model.parameters.size() == best_parameters.size() && "checkpoint was sized for a different model");
+
+    real *parameter_cursor = parameters.data();
+    real *state_cursor = training_state.data();
+    for(ann_layer_base *l : model.layers)
+    {
+        l->read_parameters(parameter_cursor);
+        parameter_cursor += l->num_parameters();
+        l->read_training_state(state_cursor);
+        state_cursor += l->num_training_state();
+    }
+
+    std::copy(best_model.parameters.begin(), best_model.parameters.end(), best_parameters.begin());
+    num_steps = model.num_steps;
+    schedule_policies = model.schedule.policies;
+
+    seed = model.settings.seed;
+}
+
+bool prkl::ann_checkpoint::restore(ann_model &model, ann_snapshot &best_model) const
+{
+    integer num_parameters = 0;
+    integer num_training_state = 0;
+    for(ann_layer_base *l : model.layers)
+    {
+        num_parameters += l->num_parameters();
+        num_training_state += l->num_training_state();
+    }
+
+    if(num_parameters != parameters.size() || num_parameters != best_parameters.size())
+    {
+        std::cerr << "checkpoint mismatch: checkpoint has " << parameters.size() << " parameters but model has " << num_parameters << std::endl;
+        return false;
+    }
+
+    if(num_training_state != training_state.size())
+    {
+        std::cerr << "checkpoint mismatch: optimizer or precision differs from the checkpointed run" << std::endl;
+        return false;
+    }
+
+    real const* parameter_cursor = parameters.data();
+    real const* state_cursor = training_state.data();
+    for(ann_layer_base *l : model.layers)
+    {
+        l->write_parameters(parameter_cursor);
+        parameter_cursor += l->num_parameters();
+        l->write_training_state(state_cursor);
+        state_cursor += l->num_training_state();
+    }
+
+    best_model.parameters.resize(best_parameters.size());
+    std::copy(best_parameters.begin(), best_parameters.end(), best_model.parameters.begin());
+    model.num_steps = num_steps;
+
+    // only the runtime state is taken from the checkpoint, the policy parameters come from the current configuration
+    bool same_schedule = schedule_policies.size() == model.schedule.policies.size();
+    for(integer p = 0; same_schedule && p < schedule_policies.size(); p++)
+    {
+        same_schedule = schedule_policies[p].type == model.schedule.policies[p].type;
+    }
+
+    if(same_schedule)
+    {
+        for(integer p = 0; p < schedule_policies.size(); p++)
+        {
+            ann_schedule_policy &policy = model.schedule.policies[p];
+            policy.last_loss = schedule_policies[p].last_loss;
+            policy.best_result = schedule_policies[p].best_result;
+            policy.bad_epochs = schedule_policies[p].bad_epochs;
+            policy.current_factor = schedule_policies[p].current_factor;
+        }
+    }
+    else
+    {
+        std::cerr << "checkpoint schedule differs from the configured schedule, schedule state starts fresh" << std::endl;
+    }
+
+    // streams are counter-based and keyed by the seed, so the seed is all the random state there is
+    if(seed != 0)
+        model.settings.seed = seed;
+
+    return true;
+}
+
+bool prkl::ann_checkpoint::write_file(char const* path) const
+{
+    std::ofstream file(path, std::ios::binary);
+    if(!file)
+    {
+        std::cerr << "failed to open file for writing: " << path << std::endl;
+        return false;
+    }
+
+    write_uint64_be(file, ann_checkpoint_magic);
+    write_uint64_be(file, ann_checkpoint_version);
+
+    write_uint64_be(file, next_epoch);
+    write_uint64_be(file, num_steps);
+    write_float_be(file, best_success_rate);
+    write_float_be(file, min_loss);
+    write_float_be(file, last_success_rate);
+    write_uint64_be(file, shittier_epochs);
+
+    write_uint64_be(file, evaluation_pending);
+    write_uint64_be(file, pending_epoch);
+    write_float_be(file, pending_loss);
+
+    write_uint64_be(file, schedule_policies.size());
+    for(ann_schedule_policy const& policy : schedule_policies)
+    {
+        write_uint64_be(file, (uint64_t)policy.type);
+        write_float_be(file, policy.last_loss);
+        write_float_be(file, policy.best_result);
+        write_uint64_be(file, policy.bad_epochs);
+        write_float_be(file, policy.current_factor);
+    }
+
+    write_uint64_be(file, seed);
+    write_uint64_be(file, stopped);
+
+    write_reals(file, parameters);
+    write_reals(file, training_state);
+    write_reals(file, best_parameters);
+
+    file.flush();
+    if(!file)
+    {
+        std::cerr << "failed to write checkpoint: " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool prkl::ann_checkpoint::read_file(char const* path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file)
+    {
+        std::cerr << "failed to open file for reading: " << path << std::endl;
+        return false;
+    }
+
+    if(read_uint64_be(file) != ann_checkpoint_magic)
+    {
+        std::cerr << "invalid checkpoint, magic mismatch" << std::endl;
+        return false;
+    }
+
+    integer version = read_uint64_be(file);
+    if(version > ann_checkpoint_version)
+    {
+        std::cerr << "unsupported checkpoint version, please update this software to the latest version in order to resume from this checkpoint" << std::endl;
+        return false;
+    }
+
+    next_epoch = read_uint64_be(file);
+    num_steps = read_uint64_be(file);
+    best_success_rate = read_float_be(file);
+    min_loss = read_float_be(file);
+    last_success_rate = read_float_be(file);
+    shittier_epochs = read_uint64_be(file);
+
+    evaluation_pending = read_uint64_be(file) != 0;
+    pending_epoch = read_uint64_be(file);
+    pending_loss = read_float_be(file);
+
+    schedule_policies.resize(read_uint64_be(file));
+    for(ann_schedule_policy &policy : schedule_policies)
+    {
+        policy.type = (ann_schedule_type)read_uint64_be(file);
+        policy.last_loss = read_float_be(file);
+        policy.best_result = read_float_be(file);
+        policy.bad_epochs = read_uint64_be(file);
+        policy.current_factor = read_float_be(file);
+    }
+
+    if(version >= 2)
+    {
+        seed = read_uint64_be(file);
+    }
+    else
+    {
+        // version 1 stored the state of the old global mt19937, which nothing draws from during training
+        std::string random_state(read_uint64_be(file), '\0');
+        file.read(random_state.data(), random_state.size());
+        seed = 0;
+    }
+
+    stopped = version >= 3 && read_uint64_be(file) != 0;
+
+    read_reals(file, parameters);
+    read_reals(file, training_state);
+    read_reals(file, best_parameters);
+
+    if(!file)
+    {
+        std::cerr << "truncated checkpoint: " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+prkl::ann_checkpoint_writer::~ann_checkpoint_writer()
+{
+    wait();
+}
+
+void prkl::ann_checkpoint_writer::wait()
+{
+    if(pending.valid())
+    {
+        pending.get();
+    }
+}
+
+void prkl::ann_checkpoint_writer::write_async(ann_checkpoint const& checkpoint, std::string const& path)
+{
+    wait();
+
+    pending = std::async(std::launch::async, [&checkpoint, path]()
+    {
+        // a crash mid-write must never leave a torn checkpoint behind, so the previous one is only replaced once this one is complete
+        std::string temporary_path = path + ".tmp";
+        if(!checkpoint.write_file(temporary_path.c_str()))
+            return false;
+
+        if(std::rename(temporary_path.c_str(), path.c_str()) != 0)
+        {
+            std::cerr << "failed to move checkpoint into place: " << path << std::endl;
+            return false;
+        }
+
+        return true;
+    });
+}
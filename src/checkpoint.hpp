@@ -0,0 +1,66 @@
+
+#pragma once
+
+#include "model.hpp"
+
+#include <future>
+
+namespace prkl
+{
+
+    /** Everything needed to resume training exactly where it left off, captured in place at an epoch boundary */
+    struct ann_checkpoint
+    {
+        /** Sizes the buffers for the model, this is the only place a checkpoint allocates */
+        void resize(ann_model const& model);
+
+        /** Copies the parameters, training state and schedule state of the model, and the best snapshot. The caller fills in the training cursor */
+        void capture(ann_model const& model, ann_snapshot const& best_model);
+
+        /** Copies everything back into the model and the best snapshot, fails if the checkpoint was taken from a different topology or optimizer */
+        bool restore(ann_model &model, ann_snapshot &best_model) const;
+
+        bool write_file(char const* path) const;
+        bool read_file(char const* path);
+
+        // training cursor: pairs are trained in set order and checkpoints are taken at epoch boundaries, so the next epoch is the data cursor
+        integer next_epoch{0};
+        integer num_steps{0};
+        real best_success_rate{0.0f};
+        real min_loss{0.0f};
+        real last_success_rate{0.0f};
+        integer shittier_epochs{0};
+        // training stopped early because the loss or success rate diverged, resuming only restores the best model
+        bool stopped{false};
+
+        // an async evaluation of the parameters was still in flight, it is relaunched on resume
+        bool evaluation_pending{false};
+        integer pending_epoch{0};
+        real pending_loss{0.0f};
+
+        std::vector<ann_schedule_policy> schedule_policies;
+        uint64_t seed{0};
+
+        std::vector<real> parameters;
+        std::vector<real> training_state;
+        std::vector<real> best_parameters;
+    };
+
+    /** Writes checkpoints on a background thread, so the training loop never waits for I/O unless the previous write is still running */
+    struct ann_checkpoint_writer
+    {
+        ann_checkpoint_writer()=default;
+        ann_checkpoint_writer(ann_checkpoint_writer const&)=delete;
+        ann_checkpoint_writer &operator=(ann_checkpoint_writer const&)=delete;
+        ~ann_checkpoint_writer();
+
+        /** Blocks until the previous write is done, after which the checkpoint it was reading may be refilled */
+        void wait();
+
+        /** Starts writing the checkpoint to a temporary file that is renamed over path once complete, the checkpoint must stay untouched until wait() */
+        void write_async(ann_checkpoint const& checkpoint, std::string const& path);
+
+        std::future<bool> pending;
+    };
+
+}
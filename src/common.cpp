@@ -2,13 +2,6 @@
 #include "layer.hpp"
 
 #include <vector>
-std::mt19937& prkl::random_device()
-{
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    return gen;
-}
-
 
 prkl::ann_settings &prkl::settings()
 {
@@ -43,7 +36,7 @@ prkl::real prkl::activation_derivative(prkl::ann_layer_base const* layer, prkl::
     {
         default:
         case ann_activation::swish:
-            return swish_derivative(x);
+            return swish_derivative(x, layer->grad_limit);
         case ann_activation::tanh:
             return tanh_derivative(x);
         case ann_activation::relu:
@@ -76,8 +76,48 @@ namespace prkl
     
         bool early_exit{true};
         real early_exit_treshold{(real)0.2};
+
+        /** Lock-free asynchronous SGD: worker threads train on disjoint samples and update the shared weights without synchronization */
+        bool hogwild{false};
+        /** Number of training threads, 0 means use all available */
+        integer num_threads{0};
+        /** Parallel training with fixed work partitioning and reduction order, so a seed and thread count always give the same model. Implies the hogwild workers */
+        bool deterministic{false};
+        /** Fine-tuning: run the training set through the frozen layers in front of the first trainable one once, instead of every epoch */
+        bool cache_frozen_prefix{true};
+
+        /** Pairs per batch when evaluating, each thread evaluates whole batches */
+        integer evaluation_batch_size{64};
+        /** Evaluate epoch snapshots on a background thread while the next epoch trains */
+        bool async_evaluation{false};
+        /** Number of evaluation threads, 0 means use all available */
+        integer evaluation_threads{0};
+
+        /** Checkpoint file written in the background during training, empty disables checkpoints */
+        std::string checkpoint_path;
+        /** Epochs between checkpoints, the last epoch is always checkpointed */
+        integer checkpoint_interval{1};
+        /** Resume training from the checkpoint file if it exists */
+        bool resume{false};
+
+        /** Per epoch telemetry file, JSON lines or CSV when it ends in .csv. Empty disables telemetry and the phase timers */
+        std::string telemetry_path;
+
+        /** Knowledge distillation: trained model whose softened outputs are blended into the training targets, empty disables it */
+        std::string teacher_path;
+        /** Temperature the teacher's outputs are softened with, higher moves more probability onto the classes it considers close */
+        real distillation_temperature{(real)2.0};
+        /** Share of the soft teacher targets in the blend, the hard targets of the training set get the rest */
+        real distillation_weight{(real)0.5};
+
+        /** Progress output while training and evaluating */
+        bool verbose{true};
+
+        /** Seed for every random stream of a model, 0 draws a nondeterministic one when the model is constructed */
+        uint64_t seed{0};
     };
 
+    /** Process wide defaults, every model copies them into its own settings when it is constructed */
     ann_settings &settings(); 
 
     struct ann_layer_base;
@@ -88,24 +128,24 @@ namespace prkl
       
     }
 
-    inline real adaptive_learning_rate(real loss) 
+    inline real adaptive_learning_rate(ann_settings const& settings, real loss) 
     {    
-        real rate = settings().base_rate;
-        if(!settings().alr)
+        real rate = settings.base_rate;
+        if(!settings.alr)
             return rate; 
 
-        if(loss < settings().loss_edge)
+        if(loss < settings.loss_edge)
         {
-            real rate_alpha = std::clamp(loss/settings().loss_edge, (real)0.0, (real)1.0);
-            if(settings().ease)
+            real rate_alpha = std::clamp(loss/settings.loss_edge, (real)0.0, (real)1.0);
+            if(settings.ease)
             {
                 real rate_beta = ease_in_sine(rate_alpha);
-                rate_alpha = std::lerp(rate_alpha, rate_beta, settings().ease_alpha);
+                rate_alpha = std::lerp(rate_alpha, rate_beta, settings.ease_alpha);
             }
-            rate = std::lerp(settings().min_rate, settings().base_rate, rate_alpha);
+            rate = std::lerp(settings.min_rate, settings.base_rate, rate_alpha);
         }
         
-        return std::max(settings().min_rate, rate);
+        return std::max(settings.min_rate, rate);
     }
 
     inline real swish(real x) 
@@ -118,14 +158,14 @@ namespace prkl
         return returner;
     }
 
-    inline real swish_derivative(real x) 
+    inline real swish_derivative(real x, real grad_limit) 
     {
         real safe_x = std::max(-10.0f, std::min(10.0f, x));
         real sigmoid_x = (real)1.0 / ((real)1.0 + std::exp(-safe_x));
         real returner = sigmoid_x + safe_x * sigmoid_x * ((real)1.0 - sigmoid_x);
 
         // clip the derivative to prevent exploding gradients
-        returner = std::max(-settings().grad_limit, std::min(settings().grad_limit, returner));
+        returner = std::max(-grad_limit, std::min(grad_limit, returner));
 
         assert(!std::isnan(returner) && "NaN detected in swish_derivative()");
         return returner;
@@ -187,9 +227,6 @@ namespace prkl
 
 
 
-    std::mt19937& random_device();
-
-
     inline uint64_t read_uint64_be(std::ifstream &file)
     {
         uint64_t val;
@@ -199,6 +236,14 @@ namespace prkl
         return val;
     }
     
+    inline uint32_t read_uint32_be(std::ifstream &file)
+    {
+        uint32_t val;
+        file.read(reinterpret_cast<char*>(&val), sizeof(val));
+
+        return ntohl(val);
+    }
+
     inline float read_float_be(std::ifstream &file)
     {
         uint32_t val;
@@ -211,12 +256,28 @@ namespace prkl
         return result;
     }
 
+    /** Bytes left in a file opened for reading, so sizes read from it can be checked before anything is allocated for them */
+    inline uint64_t remaining_bytes(std::ifstream &file)
+    {
+        std::streampos position = file.tellg();
+        file.seekg(0, std::ios::end);
+        std::streampos end = file.tellg();
+        file.seekg(position);
+        return file && end >= position ? uint64_t(end - position) : 0;
+    }
+
     inline void write_uint64_be(std::ofstream &file, uint64_t val)
     {
         val = htonll(val);
         file.write(reinterpret_cast<const char*>(&val), sizeof(val));
     }
     
+    inline void write_uint32_be(std::ofstream &file, uint32_t val)
+    {
+        val = htonl(val);
+        file.write(reinterpret_cast<const char*>(&val), sizeof(val));
+    }
+
     inline void write_float_be(std::ofstream &file, float val)
     {
         uint32_t int_val;
@@ -230,10 +291,15 @@ namespace prkl
 
     prkl::real activation_derivative(prkl::ann_layer_base const* layer, prkl::real x);
 
+    /** First 8 bytes of every .prklmodel file, shared by ann_model and static_mlp */
+#define ann_model_magic 248912394734577843
+
     enum class ann_model_version : integer 
     {
         initial = 0,
         layer_parameters,
+        sparse_layers,
+        quantized_layers,
         count,
         latest = count - 1 
     };
@@ -244,6 +310,8 @@ namespace prkl
         dense = 1,
         convolutional = 2,
         pooling = 3,
+        sparse = 4,
+        quantized = 5,
     };
 
     /** Loss function for regression-based models */
@@ -0,0 +1,33 @@
+#include "half.hpp"
+
+bool prkl::precision_from_string(std::string const& str, ann_precision &out_precision)
+{
+    if(str == "fp32")
+        out_precision = ann_precision::fp32;
+    else if(str == "bf16")
+        out_precision = ann_precision::bf16;
+    else if(str == "fp16")
+        out_precision = ann_precision::fp16;
+    else if(str == "int8")
+        out_precision = ann_precision::int8;
+    else
+        return false;
+
+    return true;
+}
+
+char const* prkl::precision_to_string(ann_precision precision)
+{
+    switch(precision)
+    {
+        default:
+        case ann_precision::fp32:
+            return "fp32";
+        case ann_precision::bf16:
+            return "bf16";
+        case ann_precision::fp16:
+            return "fp16";
+        case ann_precision::int8:
+            return "int8";
+    }
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <type_traits>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+namespace prkl 
+{
+
+    /** Storage precision for layer weights. Math always runs in fp32, only the stored copy is reduced */
+    enum class ann_precision : integer
+    {
+        fp32 = 0,
+        bf16,
+        fp16,
+        int8 // quantization-aware training: weights rounded to int8 and back, layer inputs to their calibrated 7 bit codes
+    };
+
+    /** Brain float, the upper 16 bits of an IEEE float */
+    struct bfloat16
+    {
+        uint16_t bits;
+    };
+
+    /** IEEE 754 half precision */
+    struct float16
+    {
+        uint16_t bits;
+    };
+
+    inline uint32_t float_bits(float f)
+    {
+        uint32_t u;
+        std::memcpy(&u, &f, sizeof(u));
+        return u;
+    }
+
+    inline float bits_float(uint32_t u)
+    {
+        float f;
+        std::memcpy(&f, &u, sizeof(f));
+        return f;
+    }
+
+    inline real to_real(real x)
+    {
+        return x;
+    }
+
+    /** a where condition holds, b elsewhere. A mask instead of a branch, so the conversion loops calling it vectorize */
+    inline uint32_t select_bits(bool condition, uint32_t a, uint32_t b)
+    {
+        uint32_t mask = 0u - uint32_t(condition);
+        return (a & mask) | (b & ~mask);
+    }
+
+    inline real to_real(bfloat16 x)
+    {
+        return bits_float(uint32_t(x.bits) << 16);
+    }
+
+    inline real to_real(float16 x)
+    {
+        // branch-free variant of F. Giesen's "half_to_float_fast4", so the kernel loops vectorize
+        uint32_t const shifted_exp = 0x7c00u << 13;
+        uint32_t o = uint32_t(x.bits & 0x7fffu) << 13;
+        uint32_t exp = shifted_exp & o;
+        o += uint32_t(127 - 15) << 23;
+
+        uint32_t special = o + (uint32_t(128 - 16) << 23); // inf/nan
+        uint32_t subnormal = float_bits(bits_float(o + (1u << 23)) - bits_float(113u << 23)); // renormalized
+        o = select_bits(exp == shifted_exp, special, o);
+        o = select_bits(exp == 0, subnormal, o);
+
+        o |= uint32_t(x.bits & 0x8000u) << 16;
+        return bits_float(o);
+    }
+
+#if defined(__F16C__)
+    /** Whether kernels widen chunks of value_type with the array to_real before using them, instead of value by value */
+    template<typename value_type>
+    constexpr bool widen_in_chunks = std::is_same_v<value_type, float16>;
+
+    /** Widens count halves with the F16C conversion, 8 (16 with avx512) per instruction instead of twenty bit operations each */
+    inline void to_real(float16 const* values, real *out_values, integer count)
+    {
+        integer k = 0;
+#if defined(__AVX512F__)
+        // one 64 byte store, which the loop reading the floats back forwards from at any vector width
+        for(; k + 16 <= count; k += 16)
+            _mm512_storeu_ps(out_values + k, _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(values + k))));
+#endif
+        for(; k + 8 <= count; k += 8)
+            _mm256_storeu_ps(out_values + k, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<__m128i const*>(values + k))));
+        for(; k < count; k++)
+            out_values[k] = to_real(values[k]);
+    }
+#else
+    template<typename value_type>
+    constexpr bool widen_in_chunks = false;
+#endif
+
+    /** Round to nearest even */
+    inline bfloat16 to_bfloat16(real x)
+    {
+        uint32_t u = float_bits(x);
+        uint32_t quiet_nan = (u >> 16) | 0x40u; // keep nan a quiet nan
+        uint32_t nearest = (u + 0x7fffu + ((u >> 16) & 1u)) >> 16;
+        return bfloat16{uint16_t(select_bits((u & 0x7fffffffu) > 0x7f800000u, quiet_nan, nearest))};
+    }
+
+    /** Stochastic rounding, rounds up with probability equal to the truncated fraction. Inf has no fraction to round */
+    inline bfloat16 to_bfloat16(real x, uint32_t random_bits)
+    {
+        // nan gets no noise, which could carry it into inf or the sign, only its quiet bit (the compare is signed, sse2 has no other)
+        uint32_t u = float_bits(x);
+        uint32_t nan = 0u - uint32_t(int32_t(u & 0x7fffffffu) > int32_t(0x7f800000u));
+        return bfloat16{uint16_t(((u + (random_bits & 0xffffu & ~nan)) >> 16) | (nan & 0x40u))};
+    }
+
+    /** Round to nearest even, branch-free form of F. Giesen's "float_to_half_fast3_rtne" */
+    inline float16 to_float16(real x)
+    {
+        uint32_t const f32infty = 255u << 23;
+        uint32_t const f16max = (127u + 16u) << 23;
+        uint32_t const denorm_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+        uint32_t u = float_bits(x);
+        uint32_t sign = u & 0x80000000u;
+        u ^= sign;
+
+        uint32_t overflow = u > f32infty ? 0x7e00u : 0x7c00u; // nan stays nan, everything else overflows to inf
+        uint32_t subnormal = float_bits(bits_float(u) + bits_float(denorm_magic)) - denorm_magic; // subnormal or zero
+        uint32_t mant_odd = (u >> 13) & 1u;
+        uint32_t normal = (u + (uint32_t(15 - 127) << 23) + 0xfffu + mant_odd) >> 13;
+
+        uint32_t o = select_bits(u < (113u << 23), subnormal, normal);
+        o = select_bits(u >= f16max, overflow, o);
+        return float16{uint16_t(o | (sign >> 16))};
+    }
+
+    /** Stochastic rounding in the normal range, subnormals fall back to round to nearest even */
+    inline float16 to_float16(real x, uint32_t random_bits)
+    {
+        uint32_t const f32infty = 255u << 23;
+        uint32_t const f16max = (127u + 16u) << 23;
+        uint32_t const denorm_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+        uint32_t u = float_bits(x);
+        uint32_t sign = u & 0x80000000u;
+        u ^= sign;
+
+        uint32_t overflow = u > f32infty ? 0x7e00u : 0x7c00u;
+        uint32_t subnormal = float_bits(bits_float(u) + bits_float(denorm_magic)) - denorm_magic;
+        uint32_t stochastic = (u + (uint32_t(15 - 127) << 23) + (random_bits & 0x1fffu)) >> 13;
+
+        uint32_t o = select_bits(u < (113u << 23), subnormal, stochastic);
+        o = select_bits(u >= f16max, overflow, o);
+        return float16{uint16_t(o | (sign >> 16))};
+    }
+
+    /** Hashes a step and row into a seed for rounding_noise (C. Wellons "lowbias32") */
+    inline uint32_t rounding_seed(uint32_t step, uint32_t row)
+    {
+        uint32_t z = step ^ (row * 0x9e3779b9u);
+        z ^= z >> 16;
+        z *= 0x7feb352du;
+        z ^= z >> 15;
+        z *= 0x846ca68bu;
+        z ^= z >> 16;
+        return z;
+    }
+
+    /** Increment of rounding_noise from one index to the next */
+    constexpr uint32_t rounding_noise_step = 0x9e3779b9u;
+
+    /** 
+     * Stochastic rounding noise: a Weyl sequence offset by a hashed seed. Every element sees uniformly distributed noise 
+     * across steps, and it reduces to a vector add inside the rounding loops, which advance it by rounding_noise_step.
+     */
+    inline uint32_t rounding_noise(uint32_t seed, uint32_t index)
+    {
+        return seed + index * rounding_noise_step;
+    }
+
+    bool precision_from_string(std::string const& str, ann_precision &out_precision);
+    char const* precision_to_string(ann_precision precision);
+}
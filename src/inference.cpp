@@ -0,0 +1,38 @@
+#include "inference.hpp"
+#include "model.hpp"
+
+prkl::ann_inference_context::ann_inference_context(ann_model const& model, integer in_max_batch)
+{
+    resize(model, in_max_batch);
+}
+
+void prkl::ann_inference_context::resize(ann_model const& model, integer in_max_batch)
+{
+    max_batch = in_max_batch;
+    offsets.resize(model.layers.size());
+
+    integer size = 0;
+    for(integer layer_index = 0; layer_index < model.layers.size(); layer_index++)
+    {
+        offsets[layer_index] = size;
+        size += model.layers[layer_index]->num_activations() * max_batch;
+    }
+
+    buffer.assign(size, (real)0.0);
+}
+
+bool prkl::ann_inference_context::fits(ann_model const& model, integer batch) const
+{
+    if(batch > max_batch || offsets.size() != model.layers.size())
+        return false;
+
+    // compares the layout instead of remembering the model, so a different model of the same shape reuses the buffers
+    integer size = 0;
+    for(integer layer_index = 0; layer_index < model.layers.size(); layer_index++)
+    {
+        if(offsets[layer_index] != size)
+            return false;
+        size += model.layers[layer_index]->num_activations() * max_batch;
+    }
+    return size == buffer.size();
+}
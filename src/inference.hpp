@@ -0,0 +1,30 @@
+#pragma once
+
+#include "layer.hpp"
+
+namespace prkl 
+{
+
+    struct ann_model;
+
+    /** 
+     * Per-caller activation buffers for batched inference. Sample-major: each layer holds max_batch rows of num_activations.
+     * This is all the mutable state of inference, one per thread lets any number of threads share one model 
+     */
+    struct ann_inference_context
+    {
+        ann_inference_context()=default;
+        ann_inference_context(ann_model const& model, integer max_batch);
+
+        void resize(ann_model const& model, integer max_batch);
+        /** True when the buffers hold batch samples of every layer of the model, a few compares per layer */
+        bool fits(ann_model const& model, integer batch) const;
+
+        real *activations(integer layer_index) { return buffer.data() + offsets[layer_index]; }
+
+        integer max_batch{0};
+        std::vector<real> buffer; // all layers, in layer order
+        std::vector<integer> offsets; // one per layer
+    };
+
+}
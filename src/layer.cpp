@@ -1,9 +1,15 @@
 
 #include "layer.hpp"
+#include "quantized_layer.hpp"
 
 #include <omp.h>
 
 prkl::ann_layer_base::ann_layer_base(nlohmann::json &cfg)
+{
+    configure(cfg);
+}
+
+void prkl::ann_layer_base::configure(nlohmann::json &cfg)
 {
     if(cfg.contains("activation_func"))
     {
@@ -49,6 +55,12 @@ prkl::ann_layer_base::ann_layer_base(nlohmann::json &cfg)
         leaky_alpha = cfg.at("leaky_alpha").template get<prkl::real>();
         std::cout << "model config: layer activation: leaky alpha:" << leaky_alpha << std::endl;
     }
+
+    if(cfg.contains("frozen"))
+    {
+        frozen = cfg.at("frozen").template get<bool>();
+        std::cout << "model config: frozen: " << frozen << std::endl;
+    }
 }
 
 prkl::ann_dense_layer::ann_dense_layer(integer in_neurons, integer in_inputs)
@@ -169,6 +181,10 @@ void prkl::ann_dense_layer::write(std::ofstream &file)
 prkl::ann_dense_layer::~ann_dense_layer()
 {
     delete[] activations;
+    delete[] moments1;
+    delete[] moments2;
+    delete[] weights_half;
+    delete[] weights_quantized;
 
     if(num_inputs > 0)
     {
@@ -177,30 +193,66 @@ prkl::ann_dense_layer::~ann_dense_layer()
     }
 }
 
-void prkl::ann_dense_layer::randomize_weights()
+void prkl::ann_dense_layer::randomize_weights(uint64_t seed, integer stream)
 {
     if(num_inputs == 0)
         return;
 
-    auto& rnd = prkl::random_device();
+    ann_random_stream rnd(seed, ann_random_purpose::weights, stream);
+    real weight_range = std::sqrt(2.0f / num_inputs);
 
-    for(integer n = 0; n < num_neurons; n++)
+    // every neuron draws from its own fixed range of the stream, so the weights come out the same for any thread count
+    #pragma omp parallel for schedule(static) if(num_neurons * num_inputs >= 65536)
+    for(natural n = 0; n < (natural)num_neurons; n++)
     {
-        real weight_range = std::sqrt(2.0f / num_inputs);
-
         // @todo use gaussian distribution instead
-        std::uniform_real_distribution<real> w_dist(-weight_range, weight_range);
-
+        uint64_t first = n * (num_inputs + 1);
         real *weight_array = get_weights_array(n);
         for(integer w = 0; w < num_inputs; w++)
         {
-            weight_array[w] = w_dist(rnd);
+            weight_array[w] = rnd.uniform_at(first + w, -weight_range, weight_range);
         }
 
         // @todo experiment with initializing biases to 0.0
-        std::uniform_real_distribution<real> bias_dist(-0.1f, 0.1f);
-        biases[n] = bias_dist(rnd);
+        biases[n] = rnd.uniform_at(first + num_inputs, -0.1f, 0.1f);
+    }
+}
+
+prkl::real prkl::ann_dense_layer::pruning_threshold(real sparsity) const
+{
+    integer num_weights = num_neurons * num_inputs;
+    integer num_pruned = integer(std::clamp(sparsity, (real)0.0, (real)1.0) * num_weights);
+    if(num_pruned == 0)
+        return 0.0f;
+    if(num_pruned >= num_weights)
+        return std::numeric_limits<real>::infinity();
+
+    std::vector<real> magnitudes(num_weights);
+    for(integer w = 0; w < num_weights; w++)
+    {
+        magnitudes[w] = std::abs(weights[w]);
+    }
+
+    std::nth_element(magnitudes.begin(), magnitudes.begin() + num_pruned, magnitudes.end());
+    return magnitudes[num_pruned];
+}
+
+prkl::integer prkl::ann_dense_layer::prune(real threshold)
+{
+    integer num_weights = num_neurons * num_inputs;
+    integer num_zero = 0;
+    for(integer w = 0; w < num_weights; w++)
+    {
+        if(std::abs(weights[w]) < threshold)
+            weights[w] = 0.0f;
+
+        num_zero += weights[w] == 0.0f;
     }
+
+    if(precision != ann_precision::fp32)
+        set_precision(precision);
+
+    return num_zero;
 }
 
 prkl::integer prkl::ann_dense_layer::min_activation_index() const
@@ -242,6 +294,8 @@ prkl::ann_layer_base *prkl::ann_dense_layer::clone() const
     prkl::ann_dense_layer* new_layer = new ann_dense_layer(num_neurons, num_inputs);
     new_layer->activation_func = activation_func;
     new_layer->leaky_alpha = leaky_alpha;
+    new_layer->grad_limit = grad_limit;
+    new_layer->frozen = frozen;
 
     std::memcpy(new_layer->activations, activations, num_neurons * sizeof(prkl::real));
 
@@ -251,9 +305,40 @@ prkl::ann_layer_base *prkl::ann_dense_layer::clone() const
         std::memcpy(new_layer->biases, biases, num_neurons * sizeof(prkl::real));
     }
 
+    new_layer->set_precision(precision);
+
     return new_layer;
 }
 
+prkl::integer prkl::ann_dense_layer::num_parameters() const
+{
+    if(num_inputs == 0)
+        return 0;
+
+    return num_neurons * num_inputs + num_neurons;
+}
+
+void prkl::ann_dense_layer::read_parameters(real *out_parameters) const
+{
+    if(num_inputs == 0)
+        return;
+
+    std::memcpy(out_parameters, weights, num_neurons * num_inputs * sizeof(prkl::real));
+    std::memcpy(out_parameters + num_neurons * num_inputs, biases, num_neurons * sizeof(prkl::real));
+}
+
+void prkl::ann_dense_layer::write_parameters(real const* parameters)
+{
+    if(num_inputs == 0)
+        return;
+
+    std::memcpy(weights, parameters, num_neurons * num_inputs * sizeof(prkl::real));
+    std::memcpy(biases, parameters + num_neurons * num_inputs, num_neurons * sizeof(prkl::real));
+
+    if(precision != ann_precision::fp32)
+        set_precision(precision);
+}
+
 prkl::integer prkl::ann_dense_layer::num_activations() const
 {
     return num_neurons;
@@ -272,42 +357,249 @@ void prkl::ann_dense_layer::set_activation(integer activation_index, real new_ac
 }
 
 void prkl::ann_dense_layer::forward(prkl::ann_layer_base const* prev_layer)
+{
+    forward(prev_layer->get_activations_array(), activations);
+}
+
+/** Type the kernels read a chunk of weight_type weights as, fp32 where they are widened a chunk at a time */
+template<typename weight_type>
+using weight_chunk_type = std::conditional_t<prkl::widen_in_chunks<weight_type>, prkl::real, weight_type>;
+
+/** 
+ * The ann_shared_access::chunk_size weights at weights, as the kernel loops read them. Shared weights are copied out into buffer
+ * first, and widen_in_chunks types are widened into it. Otherwise the weights are read in place
+ */
+template<typename access, typename weight_type>
+static weight_chunk_type<weight_type> const* load_weights(weight_type const* weights, weight_chunk_type<weight_type> *buffer)
+{
+    constexpr prkl::integer chunk_size = prkl::ann_shared_access::chunk_size;
+    if constexpr(prkl::widen_in_chunks<weight_type>)
+    {
+        weight_type chunk[chunk_size];
+        if constexpr(std::is_same_v<access, prkl::ann_shared_access>)
+        {
+            access::load_chunk(weights, chunk);
+            weights = chunk;
+        }
+        prkl::to_real(weights, buffer, chunk_size);
+        return buffer;
+    }
+    else if constexpr(std::is_same_v<access, prkl::ann_shared_access>)
+    {
+        access::load_chunk(weights, buffer);
+        return buffer;
+    }
+    else
+    {
+        return weights;
+    }
+}
+
+template<typename access, typename weight_type>
+static void dense_forward(prkl::ann_dense_layer const* layer, weight_type const* weights, prkl::real const* prev_activations, prkl::real *out_activations)
+{
+    constexpr prkl::integer chunk_size = prkl::ann_shared_access::chunk_size;
+    prkl::integer num_inputs = layer->num_inputs;
+    prkl::natural num_neurons = layer->num_neurons;
+
+    #pragma omp parallel for if(num_neurons >= 128)
+    for(prkl::natural n = 0; n < num_neurons; n++)
+    {
+        prkl::real sum = access::load(layer->biases[n]);
+
+        weight_type const* neuron_weights = weights + n * num_inputs;
+        if constexpr(std::is_same_v<access, prkl::ann_plain_access> && std::is_same_v<weight_type, prkl::real>)
+        {
+            #pragma omp simd reduction(+:sum)
+            for(prkl::integer i = 0; i < num_inputs; i++)
+            {
+                sum += prev_activations[i] * neuron_weights[i];
+            }
+        }
+        else
+        {
+            // one partial sum per lane of a chunk, they stay in registers across the chunks
+            prkl::real partial_sums[chunk_size] = {};
+            prkl::integer i = 0;
+            for(; i + chunk_size <= num_inputs; i += chunk_size)
+            {
+                weight_chunk_type<weight_type> buffer[chunk_size];
+                auto const* chunk = load_weights<access>(neuron_weights + i, buffer);
+
+                #pragma omp simd
+                for(prkl::integer k = 0; k < chunk_size; k++)
+                {
+                    partial_sums[k] += prev_activations[i + k] * prkl::to_real(chunk[k]);
+                }
+            }
+
+            for(prkl::integer k = 0; k < chunk_size; k++)
+                sum += partial_sums[k];
+            for(; i < num_inputs; i++)
+                sum += prev_activations[i] * prkl::to_real(access::load(neuron_weights[i]));
+        }
+        out_activations[n] = prkl::activation(layer, sum);
+    }
+}
+
+template<typename access>
+static void dense_forward(prkl::ann_dense_layer const* layer, prkl::real const* prev_activations, prkl::real *out_activations)
+{
+    switch(layer->precision)
+    {
+        default:
+        case prkl::ann_precision::fp32:
+            dense_forward<access>(layer, layer->weights, prev_activations, out_activations);
+            break;
+        case prkl::ann_precision::bf16:
+            dense_forward<access>(layer, reinterpret_cast<prkl::bfloat16 const*>(layer->weights_half), prev_activations, out_activations);
+            break;
+        case prkl::ann_precision::fp16:
+            dense_forward<access>(layer, reinterpret_cast<prkl::float16 const*>(layer->weights_half), prev_activations, out_activations);
+            break;
+        case prkl::ann_precision::int8:
+            dense_forward<access>(layer, layer->weights_quantized, prev_activations, out_activations);
+            break;
+    }
+}
+
+void prkl::ann_dense_layer::forward(real const* prev_activations, real *out_activations) const
 {
     if(num_inputs == 0)
         return;
 
-    #pragma omp parallel for if(num_neurons >= 128)
-    for(natural n = 0; n < num_neurons; n++)
+    if(shared_parameters)
+        dense_forward<ann_shared_access>(this, prev_activations, out_activations);
+    else
+        dense_forward<ann_plain_access>(this, prev_activations, out_activations);
+}
+
+template<typename weight_type>
+static void dense_forward_batch(prkl::ann_dense_layer const* layer, weight_type const* weights, prkl::real const* prev_activations, prkl::real *out_activations, prkl::integer batch)
+{
+    prkl::integer num_inputs = layer->num_inputs;
+    prkl::integer num_neurons = layer->num_neurons;
+
+    // four samples at a time share every weight load, and their inputs (4 * num_inputs) stay hot in cache across all neurons
+    prkl::integer b = 0;
+    for(; b + 4 <= batch; b += 4)
     {
-        activations[n] = biases[n];
+        prkl::real const* a0 = prev_activations + (b + 0) * num_inputs;
+        prkl::real const* a1 = prev_activations + (b + 1) * num_inputs;
+        prkl::real const* a2 = prev_activations + (b + 2) * num_inputs;
+        prkl::real const* a3 = prev_activations + (b + 3) * num_inputs;
 
-        real* neuron_weights = get_weights_array(n);
-        for(integer i = 0; i < num_inputs; i++)
+        for(prkl::integer n = 0; n < num_neurons; n++)
         {
-            activations[n] += prev_layer->get_activation(i) * neuron_weights[i];
+            weight_type const* neuron_weights = weights + n * num_inputs;
+            prkl::real s0 = layer->biases[n], s1 = s0, s2 = s0, s3 = s0;
+            prkl::integer first = 0;
+
+            // widened a chunk at a time, like dense_forward
+            if constexpr(prkl::widen_in_chunks<weight_type>)
+            {
+                constexpr prkl::integer chunk_size = prkl::ann_shared_access::chunk_size;
+                for(; first + chunk_size <= num_inputs; first += chunk_size)
+                {
+                    prkl::real chunk[chunk_size];
+                    load_weights<prkl::ann_plain_access>(neuron_weights + first, chunk);
+
+                    #pragma omp simd reduction(+:s0, s1, s2, s3)
+                    for(prkl::integer k = 0; k < chunk_size; k++)
+                    {
+                        s0 += a0[first + k] * chunk[k];
+                        s1 += a1[first + k] * chunk[k];
+                        s2 += a2[first + k] * chunk[k];
+                        s3 += a3[first + k] * chunk[k];
+                    }
+                }
+            }
+
+            #pragma omp simd reduction(+:s0, s1, s2, s3)
+            for(prkl::integer i = first; i < num_inputs; i++)
+            {
+                prkl::real w = prkl::to_real(neuron_weights[i]);
+                s0 += a0[i] * w;
+                s1 += a1[i] * w;
+                s2 += a2[i] * w;
+                s3 += a3[i] * w;
+            }
+
+            out_activations[(b + 0) * num_neurons + n] = prkl::activation(layer, s0);
+            out_activations[(b + 1) * num_neurons + n] = prkl::activation(layer, s1);
+            out_activations[(b + 2) * num_neurons + n] = prkl::activation(layer, s2);
+            out_activations[(b + 3) * num_neurons + n] = prkl::activation(layer, s3);
         }
-        activations[n] = activation(this, activations[n]);
     }
 
+    for(; b < batch; b++)
+    {
+        prkl::real const* sample_activations = prev_activations + b * num_inputs;
+        for(prkl::integer n = 0; n < num_neurons; n++)
+        {
+            weight_type const* neuron_weights = weights + n * num_inputs;
+            prkl::real sum = layer->biases[n];
+
+            #pragma omp simd reduction(+:sum)
+            for(prkl::integer i = 0; i < num_inputs; i++)
+            {
+                sum += sample_activations[i] * prkl::to_real(neuron_weights[i]);
+            }
+            out_activations[b * num_neurons + n] = prkl::activation(layer, sum);
+        }
+    }
+}
+
+void prkl::ann_dense_layer::forward_batch(real const* prev_activations, real *out_activations, integer batch) const
+{
+    if(num_inputs == 0)
+        return;
+
+    switch(precision)
+    {
+        default:
+        case ann_precision::fp32:
+            dense_forward_batch(this, weights, prev_activations, out_activations, batch);
+            break;
+        case ann_precision::bf16:
+            dense_forward_batch(this, reinterpret_cast<bfloat16 const*>(weights_half), prev_activations, out_activations, batch);
+            break;
+        case ann_precision::fp16:
+            dense_forward_batch(this, reinterpret_cast<float16 const*>(weights_half), prev_activations, out_activations, batch);
+            break;
+        case ann_precision::int8:
+            dense_forward_batch(this, weights_quantized, prev_activations, out_activations, batch);
+            break;
+    }
 }
 
 void prkl::ann_dense_layer::apply_softmax()
 {
-    real max_activation = activations[0];
+    apply_softmax(activations);
+}
+
+void prkl::ann_dense_layer::apply_softmax(real *inout_activations) const
+{
+    softmax(inout_activations, num_neurons);
+}
+
+void prkl::softmax(real *inout_activations, integer num_neurons)
+{
+    real max_activation = inout_activations[0];
     for (natural i = 1; i < num_neurons; i++) {
-        max_activation = std::max(max_activation, activations[i]);
+        max_activation = std::max(max_activation, inout_activations[i]);
     }
 
     real sum_exp = 0.0;
     for (natural i = 0; i < num_neurons; i++) {
-        real shifted = std::max(activations[i] - max_activation, -80.0f); // Prevent extreme underflow
-        activations[i] = std::exp(shifted);
-        sum_exp += activations[i];
+        real shifted = std::max(inout_activations[i] - max_activation, -80.0f); // Prevent extreme underflow
+        inout_activations[i] = std::exp(shifted);
+        sum_exp += inout_activations[i];
     }
 
     sum_exp += 1e-08f;  // Avoid division by zero
     for (natural i = 0; i < num_neurons; i++) {
-        activations[i] /= sum_exp;
+        inout_activations[i] /= sum_exp;
     }
 }
 
@@ -358,12 +650,27 @@ void prkl::ann_dense_layer::gradients_from_expected_output(ann_evaluation_type e
         return;
 
     out_gradients.resize(num_neurons);
+    gradients_from_expected_output(evaluation_type, loss_function, activations, expected_output, out_gradients.data(), out_loss);
+}
+
+void prkl::ann_dense_layer::gradients_from_expected_output(ann_evaluation_type evaluation_type, ann_loss_function loss_function, real const* in_activations, std::vector<real> const& expected_output, real *out_gradients, real &out_loss) const
+{
+    if(num_inputs == 0)
+        return;
+
+    output_gradients(this, evaluation_type, loss_function, in_activations, expected_output, out_gradients, out_loss);
+}
+
+void prkl::output_gradients(ann_layer_base const* layer, ann_evaluation_type evaluation_type, ann_loss_function loss_function, real const* in_activations, std::vector<real> const& expected_output, real *out_gradients, real &out_loss)
+{
+    integer num_neurons = layer->num_activations();
+
+    // serial on purpose: the loss is summed in neuron order, so it comes out bit-identical on every run
     real tmp_loss = out_loss;
 
-    #pragma omp parallel for if(num_neurons >= 128) reduction(+:tmp_loss)
     for (natural i = 0; i < num_neurons; ++i)
     {
-        real output_error = expected_output[i] - activations[i];
+        real output_error = expected_output[i] - in_activations[i];
 
         switch (evaluation_type)
         {
@@ -371,25 +678,25 @@ void prkl::ann_dense_layer::gradients_from_expected_output(ann_evaluation_type e
                 if (loss_function == ann_loss_function::mean_squared_error)
                 {
                     tmp_loss += output_error * output_error; // MSE
-                    out_gradients[i] = output_error * activation_derivative(this, activations[i]);
+                    out_gradients[i] = output_error * activation_derivative(layer, in_activations[i]);
                 }
                 else if (loss_function == ann_loss_function::mean_absolute_error)
                 {
                     tmp_loss += std::abs(output_error);  // MAE
-                    out_gradients[i] = (output_error >= 0 ? 1.0 : -1.0) * activation_derivative(this, activations[i]);
+                    out_gradients[i] = (output_error >= 0 ? 1.0 : -1.0) * activation_derivative(layer, in_activations[i]);
                 }
                 break;
             case ann_evaluation_type::multiclass_classification:
                 // Cross-entropy loss, assumes softmax was applied
-                tmp_loss -= expected_output[i] * std::log( std::max(activations[i],  1e-08f));  // Avoid log(0)
-                out_gradients[i] = output_error * activation_derivative(this, activations[i]);
+                tmp_loss -= expected_output[i] * std::log( std::max(in_activations[i],  1e-08f));  // Avoid log(0)
+                out_gradients[i] = output_error * activation_derivative(layer, in_activations[i]);
                 break;
         
             case ann_evaluation_type::binary_classification:
             case ann_evaluation_type::multilabel_classification:
                 // Binary cross-entropy loss (BCE)
-                tmp_loss -= expected_output[i] * std::log(activations[i] + 1e-5f) + (1 - expected_output[i]) * std::log(1 - activations[i] + 1e-5f);
-                out_gradients[i] = output_error * activation_derivative(this, activations[i]);
+                tmp_loss -= expected_output[i] * std::log(in_activations[i] + 1e-5f) + (1 - expected_output[i]) * std::log(1 - in_activations[i] + 1e-5f);
+                out_gradients[i] = output_error * activation_derivative(layer, in_activations[i]);
                 break;
         }
     }
@@ -402,41 +709,295 @@ void prkl::ann_dense_layer::gradients_backpropagate(ann_gradients const& next_gr
     if(num_inputs == 0)
         return;
 
-
     out_gradients.resize(num_neurons);
+    gradients_backpropagate(activations, next_gradients.data(), next_layer, out_gradients.data());
+}
 
-    #pragma omp parallel for if(num_neurons >= 128)
-    for (natural i = 0; i < num_neurons; ++i)
+void prkl::ann_dense_layer::gradients_backpropagate(real const* in_activations, real const* next_gradients, ann_layer_base const* next_layer, real *out_gradients) const
+{
+    if(num_inputs == 0)
+        return;
+
+    hidden_gradients(this, in_activations, next_gradients, next_layer, out_gradients);
+}
+
+void prkl::hidden_gradients(ann_layer_base const* layer, real const* in_activations, real const* next_gradients, ann_layer_base const* next_layer, real *out_gradients)
+{
+    integer num_neurons = layer->num_activations();
+    next_layer->gradients_to_inputs(next_gradients, out_gradients);
+
+    for (integer i = 0; i < num_neurons; ++i)
     {
-        real sum = 0.0f;
+        out_gradients[i] *= activation_derivative(layer, in_activations[i]);
+    }
+}
 
-        for (size_t j = 0; j < next_gradients.size(); ++j)
+template<typename access, typename weight_type>
+static void dense_gradients_to_inputs(prkl::ann_dense_layer const* layer, weight_type const* weights, prkl::real const* gradients, prkl::real *out_input_gradients)
+{
+    constexpr prkl::integer chunk_size = prkl::ann_shared_access::chunk_size;
+    prkl::integer num_inputs = layer->num_inputs;
+    std::fill(out_input_gradients, out_input_gradients + num_inputs, (prkl::real)0.0);
+
+    // row by row, so the weights are streamed in storage order
+    for(prkl::integer n = 0; n < layer->num_neurons; n++)
+    {
+        prkl::real gradient = gradients[n];
+        weight_type const* neuron_weights = weights + n * num_inputs;
+        if constexpr(std::is_same_v<access, prkl::ann_plain_access> && std::is_same_v<weight_type, prkl::real>)
         {
-            real* next_weights = next_layer->get_weights_array(j);
+            for(prkl::integer i = 0; i < num_inputs; i++)
+            {
+                out_input_gradients[i] += gradient * neuron_weights[i];
+            }
+        }
+        else
+        {
+            prkl::integer i = 0;
+            for(; i + chunk_size <= num_inputs; i += chunk_size)
+            {
+                weight_chunk_type<weight_type> buffer[chunk_size];
+                auto const* chunk = load_weights<access>(neuron_weights + i, buffer);
+
+                #pragma omp simd
+                for(prkl::integer k = 0; k < chunk_size; k++)
+                {
+                    out_input_gradients[i + k] += gradient * prkl::to_real(chunk[k]);
+                }
+            }
 
-            sum += next_gradients[j] * next_weights[i];
+            for(; i < num_inputs; i++)
+                out_input_gradients[i] += gradient * prkl::to_real(access::load(neuron_weights[i]));
         }
+    }
+}
 
-        out_gradients[i] = sum * activation_derivative(this, activations[i]);
+template<typename access>
+static void dense_gradients_to_inputs(prkl::ann_dense_layer const* layer, prkl::real const* gradients, prkl::real *out_input_gradients)
+{
+    switch(layer->precision)
+    {
+        default:
+        case prkl::ann_precision::fp32:
+            dense_gradients_to_inputs<access>(layer, layer->weights, gradients, out_input_gradients);
+            break;
+        case prkl::ann_precision::bf16:
+            dense_gradients_to_inputs<access>(layer, reinterpret_cast<prkl::bfloat16 const*>(layer->weights_half), gradients, out_input_gradients);
+            break;
+        case prkl::ann_precision::fp16:
+            dense_gradients_to_inputs<access>(layer, reinterpret_cast<prkl::float16 const*>(layer->weights_half), gradients, out_input_gradients);
+            break;
+        case prkl::ann_precision::int8:
+            dense_gradients_to_inputs<access>(layer, layer->weights_quantized, gradients, out_input_gradients);
+            break;
     }
 }
 
+void prkl::ann_dense_layer::gradients_to_inputs(real const* gradients, real *out_input_gradients) const
+{
+    if(num_inputs == 0)
+        return;
+
+    if(shared_parameters)
+        dense_gradients_to_inputs<ann_shared_access>(this, gradients, out_input_gradients);
+    else
+        dense_gradients_to_inputs<ann_plain_access>(this, gradients, out_input_gradients);
+}
+
 void prkl::ann_dense_layer::update_weights(ann_gradients const &layer_gradients, ann_layer_base const* prev_layer, real learning_rate)
+{
+    ann_optimizer sgd;
+    update_weights(layer_gradients.data(), prev_layer->get_activations_array(), sgd, sgd.step(learning_rate, 0));
+}
+
+void prkl::ann_dense_layer::update_weights(real const* layer_gradients, real const* prev_activations, ann_optimizer const& optimizer, ann_optimizer_step const& step)
+{
+    update_neurons(layer_gradients, prev_activations, optimizer, step, 0, num_neurons);
+}
+
+void prkl::ann_dense_layer::update_neurons(real const* layer_gradients, real const* prev_activations, ann_optimizer const& optimizer, ann_optimizer_step const& step, integer first_neuron, integer end_neuron)
 {
     if(num_inputs == 0)
         return;
 
-    for (integer i = 0; i < num_neurons; ++i)
+    static real const bias_input = (real)1.0;
+    integer num_weights = num_neurons * num_inputs;
+
+    for (integer i = first_neuron; i < end_neuron; ++i)
     {
-        real *neuron_weights = get_weights_array(i);
-        for (integer j = 0; j < num_inputs; ++j)
+        // the reduced precision copy is rounded from the fp32 master weights in the same pass, stochastic rounding keeps small 
+        // updates from vanishing
+        ann_rounded_copy rounded;
+        if(precision == ann_precision::bf16 || precision == ann_precision::fp16)
         {
-            neuron_weights[j] += learning_rate * layer_gradients[i] * prev_layer->get_activation(j);
+            rounded.bits = weights_half + i * num_inputs;
+            rounded.precision = precision;
+            rounded.noise_seed = rounding_seed(uint32_t(step.index), uint32_t(i));
+        }
+
+        real *weight_moments1 = moments1 ? moments1 + i * num_inputs : nullptr;
+        real *weight_moments2 = moments2 ? moments2 + i * num_inputs : nullptr;
+        optimizer.update(step, layer_gradients[i], prev_activations, get_weights_array(i), weight_moments1, weight_moments2, num_inputs, true, shared_parameters, rounded);
+
+        real *bias_moments1 = moments1 ? moments1 + num_weights + i : nullptr;
+        real *bias_moments2 = moments2 ? moments2 + num_weights + i : nullptr;
+        optimizer.update(step, layer_gradients[i], &bias_input, biases + i, bias_moments1, bias_moments2, 1, false, shared_parameters);
+
+        // the fake quantized copy rounds to nearest, the fp32 master weights accumulate the updates too small to change a code
+        if(precision == ann_precision::int8)
+        {
+            fake_quantize_neuron(i);
         }
-        biases[i] += learning_rate * layer_gradients[i];
     }
 }
 
+void prkl::ann_dense_layer::set_precision(ann_precision new_precision)
+{
+    precision = new_precision;
+    if(num_inputs == 0)
+        return;
+
+    if(precision != ann_precision::int8)
+    {
+        delete[] weights_quantized;
+        weights_quantized = nullptr;
+    }
+
+    if(precision == ann_precision::fp32 || precision == ann_precision::int8)
+    {
+        delete[] weights_half;
+        weights_half = nullptr;
+    }
+
+    integer num_weights = num_neurons * num_inputs;
+    if(precision == ann_precision::int8)
+    {
+        if(!weights_quantized)
+            weights_quantized = new real[num_weights];
+
+        for(integer n = 0; n < num_neurons; n++)
+        {
+            fake_quantize_neuron(n);
+        }
+        return;
+    }
+
+    if(precision == ann_precision::fp32)
+        return;
+
+    if(!weights_half)
+        weights_half = new uint16_t[num_weights];
+
+    for(integer w = 0; w < num_weights; w++)
+    {
+        weights_half[w] = precision == ann_precision::bf16 ? to_bfloat16(weights[w]).bits : to_float16(weights[w]).bits;
+    }
+}
+
+void prkl::ann_dense_layer::fake_quantize_neuron(integer neuron_index)
+{
+    real const* neuron_weights = get_weights_array(neuron_index);
+    real *neuron_quantized = weights_quantized + neuron_index * num_inputs;
+
+    if(shared_parameters)
+    {
+        // other workers keep updating the neuron, so the scale and the codes are computed from one snapshot of it
+        thread_local std::vector<real> snapshot;
+        snapshot.resize(num_inputs);
+        ann_shared_access::copy(neuron_weights, snapshot.data(), num_inputs);
+
+        real scale = weight_scale(snapshot.data(), num_inputs);
+        real inverse_scale = 1.0f / scale;
+        #pragma omp simd
+        for(integer i = 0; i < num_inputs; i++)
+        {
+            snapshot[i] = real(quantize_weight(snapshot[i], inverse_scale)) * scale;
+        }
+        ann_shared_access::copy(snapshot.data(), neuron_quantized, num_inputs);
+        return;
+    }
+
+    real scale = weight_scale(neuron_weights, num_inputs);
+    real inverse_scale = 1.0f / scale;
+    #pragma omp simd
+    for(integer i = 0; i < num_inputs; i++)
+    {
+        neuron_quantized[i] = real(quantize_weight(neuron_weights[i], inverse_scale)) * scale;
+    }
+}
+
+void prkl::ann_dense_layer::prepare_optimizer(ann_optimizer const& optimizer)
+{
+    if(num_inputs == 0)
+        return;
+
+    integer num_moments = optimizer.num_moments();
+    integer num_parameters = num_neurons * num_inputs + num_neurons;
+
+    if(num_moments >= 1 && !moments1)
+        moments1 = new real[num_parameters]();
+
+    if(num_moments >= 2 && !moments2)
+        moments2 = new real[num_parameters]();
+}
+
+prkl::integer prkl::ann_dense_layer::num_training_state() const
+{
+    integer num_parameters = this->num_parameters();
+    integer num_state = 0;
+    if(moments1)
+        num_state += num_parameters;
+    if(moments2)
+        num_state += num_parameters;
+    if(weights_half)
+        num_state += num_neurons * num_inputs;
+    return num_state;
+}
+
+void prkl::ann_dense_layer::read_training_state(real *out_state) const
+{
+    integer num_parameters = this->num_parameters();
+    if(moments1)
+    {
+        std::memcpy(out_state, moments1, num_parameters * sizeof(prkl::real));
+        out_state += num_parameters;
+    }
+    if(moments2)
+    {
+        std::memcpy(out_state, moments2, num_parameters * sizeof(prkl::real));
+        out_state += num_parameters;
+    }
+    // the stochastically rounded copies can't be recomputed from the master weights, the bit patterns are exact in a float
+    if(weights_half)
+    {
+        for(integer w = 0; w < num_neurons * num_inputs; w++)
+        {
+            out_state[w] = (real)weights_half[w];
+        }
+    }
+}
+
+void prkl::ann_dense_layer::write_training_state(real const* state)
+{
+    integer num_parameters = this->num_parameters();
+    if(moments1)
+    {
+        std::memcpy(moments1, state, num_parameters * sizeof(prkl::real));
+        state += num_parameters;
+    }
+    if(moments2)
+    {
+        std::memcpy(moments2, state, num_parameters * sizeof(prkl::real));
+        state += num_parameters;
+    }
+    if(weights_half)
+    {
+        for(integer w = 0; w < num_neurons * num_inputs; w++)
+        {
+            weights_half[w] = (uint16_t)state[w];
+        }
+    }
+}
 
 prkl::real* prkl::ann_dense_layer::get_weights_array(integer neuron_index) const
 {
@@ -444,4 +1005,8 @@ prkl::real* prkl::ann_dense_layer::get_weights_array(integer neuron_index) const
         return weights + (num_inputs * neuron_index);
 
     return nullptr;
-}
\ No newline at end of file
+}
+prkl::real* prkl::ann_dense_layer::get_activations_array() const
+{
+    return activations;
+}
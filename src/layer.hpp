@@ -2,6 +2,9 @@
 #pragma once
 
 #include "common.hpp"
+#include "optimizer.hpp"
+#include "half.hpp"
+#include "random.hpp"
 
 #include <vector>
 
@@ -18,9 +21,17 @@ namespace prkl
         ann_layer_base(nlohmann::json &cfg);
         virtual ~ann_layer_base()=default;
 
+        /** Applies the activation_func, leaky_alpha and frozen keys of a layer config, also used to override them on a loaded layer */
+        void configure(nlohmann::json &cfg);
+
         virtual void write(std::ofstream &file)=0;
 
         virtual ann_layer_base *clone() const = 0;
+
+        /** Trainable parameters (weights, then biases), copied in place so snapshots never allocate */
+        virtual integer num_parameters() const = 0;
+        virtual void read_parameters(real *out_parameters) const = 0;
+        virtual void write_parameters(real const* parameters) = 0;
         virtual integer num_activations() const = 0;
         
         virtual integer min_activation_index() const = 0;
@@ -32,13 +43,49 @@ namespace prkl
         virtual void gradients_from_expected_output(ann_evaluation_type evaluation_type,  ann_loss_function loss_function,std::vector<real> const& expected_output, ann_gradients &out_gradients, real &out_loss) const  = 0;
         virtual void gradients_backpropagate(ann_gradients const& next_gradients, ann_layer_base *next_layer,ann_gradients &out_gradients) const  = 0;
         virtual void update_weights(ann_gradients const &layer_gradients, ann_layer_base const* prev_layer, real learning_rate) = 0;
+
+        /** Buffer kernels: same math as above, but reading and writing caller-owned activation/gradient buffers instead of the layer activations */
+        virtual void forward(real const* prev_activations, real *out_activations) const = 0;
+        /** Forward for batch samples stored sample-major, runs single threaded so callers can parallelize over batches */
+        virtual void forward_batch(real const* prev_activations, real *out_activations, integer batch) const = 0;
+        virtual void apply_softmax(real *inout_activations) const = 0;
+        virtual void gradients_from_expected_output(ann_evaluation_type evaluation_type, ann_loss_function loss_function, real const* in_activations, std::vector<real> const& expected_output, real *out_gradients, real &out_loss) const = 0;
+        virtual void gradients_backpropagate(real const* in_activations, real const* next_gradients, ann_layer_base const* next_layer, real *out_gradients) const = 0;
+        virtual void update_weights(real const* layer_gradients, real const* prev_activations, ann_optimizer const& optimizer, ann_optimizer_step const& step) = 0;
+        /** update_weights restricted to the neurons [first_neuron, end_neuron), so threads can update disjoint slices of one layer */
+        virtual void update_neurons(real const* layer_gradients, real const* prev_activations, ann_optimizer const& optimizer, ann_optimizer_step const& step, integer first_neuron, integer end_neuron) = 0;
+
+        /** Computes W^T * gradients, i.e. the loss gradients with respect to this layer's inputs (num_inputs values) */
+        virtual void gradients_to_inputs(real const* gradients, real *out_input_gradients) const = 0;
+
+        /** Selects the storage precision the kernels read weights from. fp32 master weights are always kept for the updates */
+        virtual void set_precision(ann_precision precision) = 0;
+
+        /** Allocates the per-parameter optimizer state, if the optimizer needs any. Existing state is kept */
+        virtual void prepare_optimizer(ann_optimizer const& optimizer) = 0;
+
+        /** Training state besides the parameters (optimizer moments, low precision weight copies), copied in place for checkpoints */
+        virtual integer num_training_state() const = 0;
+        virtual void read_training_state(real *out_state) const = 0;
+        virtual void write_training_state(real const* state) = 0;
         
         virtual real* get_weights_array(integer neuron_index) const =0;
+        virtual real* get_activations_array() const =0;
 
         ann_activation activation_func {ann_activation::linear};
         real leaky_alpha{(real)0.01};
+        real grad_limit{(real)0.75}; // swish derivative clip, the model sets it from its settings before training
+        bool frozen{false}; // still forwards and passes gradients through while training, but its parameters never change
+        bool shared_parameters{false}; // hogwild workers train it concurrently, the training kernels then go through ann_shared_access
     };
 
+    /** Numerically stable softmax over num_neurons activations, in place */
+    void softmax(real *inout_activations, integer num_neurons);
+    /** Loss and loss gradients of an output layer against the expected output, shared by all layer types. Adds the loss to out_loss */
+    void output_gradients(ann_layer_base const* layer, ann_evaluation_type evaluation_type, ann_loss_function loss_function, real const* in_activations, std::vector<real> const& expected_output, real *out_gradients, real &out_loss);
+    /** Gradients of a hidden layer from the gradients of the layer after it, shared by all layer types */
+    void hidden_gradients(ann_layer_base const* layer, real const* in_activations, real const* next_gradients, ann_layer_base const* next_layer, real *out_gradients);
+
     struct ann_dense_layer : public ann_layer_base
     {
         ann_dense_layer(nlohmann::json &cfg);
@@ -46,12 +93,23 @@ namespace prkl
         ann_dense_layer(std::ifstream &file, ann_model_version version);
         virtual ~ann_dense_layer();
         virtual void write(std::ofstream &file) override;
-        void randomize_weights();
+        /** Scaled uniform init from a counter-based stream, bit-reproducible for a seed and stream regardless of the thread count */
+        void randomize_weights(uint64_t seed, integer stream);
+
+        /** Weight magnitude below which the given fraction of the weights lies, biases are never pruned */
+        real pruning_threshold(real sparsity) const;
+        /** Magnitude pruning: zeroes every weight whose magnitude is below threshold, returns the number of zero weights afterwards */
+        integer prune(real threshold);
+        /** Refreshes the int8 precision copy of a neuron's weights from the fp32 master weights */
+        void fake_quantize_neuron(integer neuron_index);
         
         virtual integer min_activation_index() const override;
         virtual integer max_activation_index() const override;
 
         virtual ann_layer_base *clone() const override;
+        virtual integer num_parameters() const override;
+        virtual void read_parameters(real *out_parameters) const override;
+        virtual void write_parameters(real const* parameters) override;
         virtual integer num_activations() const override;
         virtual real get_activation(integer activation_index) const override;
         virtual void set_activation(integer activation_index, real new_activation) override;
@@ -62,7 +120,22 @@ namespace prkl
         virtual void gradients_backpropagate(ann_gradients const& next_gradients, ann_layer_base *next_layer,  ann_gradients &out_gradients) const override;
         virtual void update_weights(ann_gradients const &layer_gradients, ann_layer_base const* prev_layer, real learning_rate) override;
 
+        virtual void forward(real const* prev_activations, real *out_activations) const override;
+        virtual void forward_batch(real const* prev_activations, real *out_activations, integer batch) const override;
+        virtual void apply_softmax(real *inout_activations) const override;
+        virtual void gradients_from_expected_output(ann_evaluation_type evaluation_type, ann_loss_function loss_function, real const* in_activations, std::vector<real> const& expected_output, real *out_gradients, real &out_loss) const override;
+        virtual void gradients_backpropagate(real const* in_activations, real const* next_gradients, ann_layer_base const* next_layer, real *out_gradients) const override;
+        virtual void update_weights(real const* layer_gradients, real const* prev_activations, ann_optimizer const& optimizer, ann_optimizer_step const& step) override;
+        virtual void update_neurons(real const* layer_gradients, real const* prev_activations, ann_optimizer const& optimizer, ann_optimizer_step const& step, integer first_neuron, integer end_neuron) override;
+        virtual void prepare_optimizer(ann_optimizer const& optimizer) override;
+        virtual void gradients_to_inputs(real const* gradients, real *out_input_gradients) const override;
+        virtual void set_precision(ann_precision precision) override;
+        virtual integer num_training_state() const override;
+        virtual void read_training_state(real *out_state) const override;
+        virtual void write_training_state(real const* state) override;
+
         virtual real* get_weights_array(integer neuron_index) const override;
+        virtual real* get_activations_array() const override;
 
         integer num_neurons; // how many neurons this layer has
         integer num_inputs; // how many input neurons this layer has been configured for 
@@ -70,5 +143,12 @@ namespace prkl
         real *activations; // num_neurons
         real *biases; // num_neurons
         real* weights; // num_neurons * num_inputs, stored in row-major order, x = neuron index, y = input index 
+
+        real* moments1{nullptr}; // optimizer state, num_neurons * num_inputs for the weights followed by num_neurons for the biases
+        real* moments2{nullptr}; // optimizer state, same layout as moments1
+
+        ann_precision precision{ann_precision::fp32};
+        uint16_t* weights_half{nullptr}; // bf16/fp16 copy of weights for mixed precision, same layout
+        real* weights_quantized{nullptr}; // int8 precision: weights rounded to their per neuron int8 codes and back, same layout
     };
 }
\ No newline at end of file
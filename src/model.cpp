@@ -1,13 +1,66 @@
 
 #include "model.hpp"
+#include "checkpoint.hpp"
 
 #include <iostream>
 #include <cinttypes>
+#include <chrono>
+#include <future>
+#include <filesystem>
 
-#define ann_model_magic 248912394734577843
+#include <omp.h>
+
+prkl::ann_model::ann_model()
+{
+    if(settings.seed == 0)
+        settings.seed = nondeterministic_seed();
+}
 
 prkl::ann_model::ann_model(nlohmann::json &cfg)
     : prkl::ann_model::ann_model()
+{
+    configure(cfg);
+
+    if(!cfg.contains("layers"))
+    {
+        std::cerr << "no layers in configuration" << std::endl;
+    }
+
+    for(nlohmann::json &layer : cfg.at("layers"))
+    {
+        if(!layer.contains("type"))
+        {
+            std::cerr << "invalid layer in configuration: type must be specified" << std::endl;
+            continue;
+        }
+
+        std::string type = layer.at("type").template get<std::string>();
+        if(type == "dense")
+        {
+            std::cout << "model config: dense layer --- " << std::endl;
+            prkl::ann_dense_layer *new_layer = new prkl::ann_dense_layer(layer);
+            new_layer->randomize_weights(settings.seed, layers.size());
+            layers.push_back(new_layer);
+        }
+        else if(type == "convolutional")
+        {
+            std::cerr << "invalid layer in configuration: type not yet supported:" << type << std::endl;
+            continue;
+        }
+        else if(type == "pooling")
+        {
+            std::cerr << "invalid layer in configuration: type not yet supported:" << type << std::endl;
+            continue;
+        }
+        else 
+        {
+            std::cerr << "invalid layer in configuration: type not recognized:" << type << std::endl;
+            continue;
+        }
+    }
+}
+
+void prkl::ann_model::configure(nlohmann::json &cfg)
 {
     if(cfg.contains("evaluation_type"))
     {
@@ -38,43 +91,58 @@ prkl::ann_model::ann_model(nlohmann::json &cfg)
         }
     }
 
+    if(cfg.contains("optimizer"))
+    {
+        optimizer = ann_optimizer(cfg.at("optimizer"));
+    }
+
+    if(cfg.contains("precision"))
+    {
+        std::string precision_str = cfg.at("precision").template get<std::string>();
+        if(!precision_from_string(precision_str, precision))
+            std::cerr << "unrecognized precision: " << precision_str << std::endl;
+        std::cout << "model config: precision: " << precision_to_string(precision) << std::endl;
+    }
+
+    if(cfg.contains("schedule"))
+    {
+        schedule = ann_schedule(cfg.at("schedule"));
+    }
+}
+
+bool prkl::ann_model::override_config(nlohmann::json &cfg)
+{
+    configure(cfg);
+
     if(!cfg.contains("layers"))
+        return true;
+
+    nlohmann::json &layer_configs = cfg.at("layers");
+    if(layer_configs.size() != layers.size())
     {
-        std::cerr << "no layers in configuration" << std::endl;
+        std::cerr << "config mismatch: config has " << layer_configs.size() << " layers but model has " << layers.size() << std::endl;
+        return false;
     }
 
-    for(nlohmann::json &layer : cfg.at("layers"))
+    for(integer layer_index = 0; layer_index < layers.size(); layer_index++)
     {
-        if(!layer.contains("type"))
-        {
-            std::cerr << "invalid layer in configuration: type must be specified" << std::endl;
-            continue;
-        }
+        nlohmann::json &layer = layer_configs[layer_index];
+        ann_layer_base *model_layer = layers[layer_index];
 
-        std::string type = layer.at("type").template get<std::string>();
-        if(type == "dense")
-        {
-            std::cout << "model config: dense layer --- " << std::endl;
-            prkl::ann_dense_layer *new_layer = new prkl::ann_dense_layer(layer);
-            new_layer->randomize_weights();
-            layers.push_back(new_layer);
-        }
-        else if(type == "convolutional")
-        {
-            std::cerr << "invalid layer in configuration: type not yet supported:" << type << std::endl;
-            continue;
-        }
-        else if(type == "pooling")
-        {
-            std::cerr << "invalid layer in configuration: type not yet supported:" << type << std::endl;
-            continue;
-        }
-        else 
+        integer num_inputs = layer_index > 0 ? layers[layer_index - 1]->num_activations() : 0;
+        bool same_size = (!layer.contains("num_neurons") || layer.at("num_neurons").template get<integer>() == model_layer->num_activations())
+                      && (!layer.contains("num_inputs") || layer.at("num_inputs").template get<integer>() == num_inputs);
+        if(!same_size)
         {
-            std::cerr << "invalid layer in configuration: type not recognized:" << type << std::endl;
-            continue;
+            std::cerr << "config mismatch: layer " << layer_index << " has a different size than the model layer" << std::endl;
+            return false;
         }
+
+        std::cout << "model config: layer " << layer_index << " --- " << std::endl;
+        model_layer->configure(layer);
     }
+
+    return true;
 }
 
 prkl::ann_model::ann_model(char const* path)
@@ -117,6 +185,12 @@ prkl::ann_model::ann_model(char const* path)
             case ann_layer_type::dense:
                 layers[i] = new ann_dense_layer(file, (ann_model_version)version);
             break;
+            case ann_layer_type::sparse:
+                layers[i] = new ann_sparse_layer(file, (ann_model_version)version);
+            break;
+            case ann_layer_type::quantized:
+                layers[i] = new ann_quantized_layer(file, (ann_model_version)version);
+            break;
             case ann_layer_type::convolutional:
                 std::cerr << "convolutional layers not yet supported" << std::endl;
                 return;
@@ -131,6 +205,17 @@ prkl::ann_model::ann_model(char const* path)
             break;
         }
 
+        // a truncated file or a layer that rejected its data, none of the layers can be trusted
+        if(!file)
+        {
+            std::cerr << "invalid model, layer " << i << " failed to load" << std::endl;
+            for(ann_layer_base *layer : layers)
+            {
+                delete layer;
+            }
+            layers.clear();
+            return;
+        }
     }
     
 }
@@ -197,11 +282,123 @@ prkl::ann_dense_layer *prkl::ann_model::add_dense_layer(integer num_neurons)
         prev_activations = last_layer->num_activations();
     }
     ann_dense_layer *new_layer = new ann_dense_layer(num_neurons, prev_activations);
-    new_layer->randomize_weights();
+    new_layer->randomize_weights(settings.seed, layers.size());
     layers.push_back(new_layer);
     return new_layer;
 }
 
+prkl::integer prkl::ann_model::sparsify(real min_sparsity)
+{
+    integer num_replaced = 0;
+    for(integer layer_index = 1; layer_index < layers.size(); layer_index++)
+    {
+        ann_dense_layer *dense = dynamic_cast<ann_dense_layer*>(layers[layer_index]);
+        if(!dense || dense->num_inputs == 0)
+            continue;
+
+        integer num_weights = dense->num_neurons * dense->num_inputs;
+        integer num_zero = std::count(dense->weights, dense->weights + num_weights, 0.0f);
+        if(real(num_zero) < min_sparsity * real(num_weights))
+            continue;
+
+        layers[layer_index] = new ann_sparse_layer(*dense);
+        delete dense;
+        num_replaced++;
+    }
+
+    return num_replaced;
+}
+
+std::vector<prkl::ann_quantization_range> prkl::ann_model::calibrate(ann_set const& calibration_set) const
+{
+    integer num_inputs = layers.front()->num_activations();
+    natural num_pairs = calibration_set.pairs.size();
+    integer batch_size = std::max(settings.evaluation_batch_size, (integer)1);
+    natural num_batches = (num_pairs + batch_size - 1) / batch_size;
+    integer num_threads = settings.evaluation_threads > 0 ? settings.evaluation_threads : (integer)omp_get_max_threads();
+
+    // ranges[l] is the range of the activations of layer l, which are the inputs of layer l + 1
+    std::vector<ann_quantization_range> ranges(layers.size());
+
+    #pragma omp parallel num_threads((int)num_threads)
+    {
+        ann_inference_context context(*this, batch_size);
+        std::vector<ann_quantization_range> thread_ranges(layers.size());
+
+        #pragma omp for schedule(dynamic)
+        for(natural batch_index = 0; batch_index < num_batches; batch_index++)
+        {
+            integer first = batch_index * batch_size;
+            integer batch = std::min<integer>(batch_size, num_pairs - first);
+
+            real *inputs = context.activations(0);
+            for(integer b = 0; b < batch; b++)
+            {
+                std::memcpy(inputs + b * num_inputs, calibration_set.pairs[first + b].input.data(), num_inputs * sizeof(real));
+            }
+
+            // layer by layer, so every range is observed before the next layer fake quantizes it
+            for(integer layer_index = 1; layer_index < layers.size(); layer_index++)
+            {
+                real *layer_inputs = context.activations(layer_index - 1);
+                integer num_layer_inputs = batch * layers[layer_index - 1]->num_activations();
+                thread_ranges[layer_index - 1].observe(layer_inputs, num_layer_inputs);
+                if(fake_quantizes_inputs(layer_index))
+                    activation_ranges[layer_index - 1].fake_quantize(layer_inputs, num_layer_inputs);
+
+                layers[layer_index]->forward_batch(layer_inputs, context.activations(layer_index), batch);
+            }
+        }
+
+        #pragma omp critical
+        for(integer layer_index = 0; layer_index < layers.size(); layer_index++)
+        {
+            ranges[layer_index].merge(thread_ranges[layer_index]);
+        }
+    }
+
+    return ranges;
+}
+
+prkl::integer prkl::ann_model::quantize(ann_set const& calibration_set, bool include_output)
+{
+    return quantize(calibrate(calibration_set), include_output);
+}
+
+prkl::integer prkl::ann_model::quantize(std::vector<ann_quantization_range> const& ranges, bool include_output)
+{
+    if(ranges.size() != layers.size())
+    {
+        std::cerr << "can't quantize: expected one activation range per layer" << std::endl;
+        return 0;
+    }
+
+    integer num_replaced = 0;
+    integer end_layer = include_output ? layers.size() : layers.size() - 1;
+    for(integer layer_index = 1; layer_index < end_layer; layer_index++)
+    {
+        ann_dense_layer *dense = dynamic_cast<ann_dense_layer*>(layers[layer_index]);
+        if(!dense || dense->num_inputs == 0)
+            continue;
+        if(dense->num_inputs > ann_quantized_layer::max_inputs)
+        {
+            std::cerr << "layer " << layer_index << " stays fp32, its " << dense->num_inputs << " inputs could overflow the int32 accumulator" << std::endl;
+            continue;
+        }
+
+        layers[layer_index] = new ann_quantized_layer(*dense, ranges[layer_index - 1]);
+        delete dense;
+        num_replaced++;
+    }
+
+    return num_replaced;
+}
+
+bool prkl::ann_model::fake_quantizes_inputs(integer layer_index) const
+{
+    return precision == ann_precision::int8 && activation_ranges.size() == layers.size() && dynamic_cast<ann_dense_layer const*>(layers[layer_index]);
+}
+
 prkl::ann_layer_base *prkl::ann_model::hidden(integer index)
 {
     assert(layers.size() > 2 && index + 1 < layers.size() && "hidden layer out of bounds");
@@ -221,11 +418,16 @@ prkl::ann_layer_base *prkl::ann_model::output()
 }
 
 
-prkl::ann_model prkl::ann_model::clone()
+prkl::ann_model prkl::ann_model::clone() const
 {
     ann_model returner;
     returner.evaluation_type = evaluation_type;
     returner.regression_loss_function = regression_loss_function;
+    returner.settings = settings;
+    returner.optimizer = optimizer;
+    returner.schedule = schedule;
+    returner.precision = precision;
+    returner.activation_ranges = activation_ranges;
     returner.layers.reserve(layers.size());
 
     for(ann_layer_base *l : layers)
@@ -236,95 +438,366 @@ prkl::ann_model prkl::ann_model::clone()
     return returner;
 }
 
-bool prkl::ann_model::train(ann_set &training_set, integer epochs, ann_set *underfit_set)
+bool prkl::ann_model::train(ann_set const& labeled_set, integer epochs, ann_set const* underfit_set)
 {
+    if(layers.size() < 2)
+    {
+        std::cerr << "can't train model that has less than 2 layers" << std::endl;
+        return false;
+    }
+
+    // progress goes nowhere unless verbose, errors always go to std::cerr
+    std::ostream null_stream(nullptr);
+    std::ostream &log = settings.verbose ? std::cout : null_stream;
+
     ann_layer_base *input_layer = input();
     ann_layer_base *output_layer = output();
 
-    real learning_rate = settings().base_rate;
     real best_success_rate = 0.0;
     integer shittier_epochs = 0;
 
     real min_loss = std::numeric_limits<float>::infinity();
-    ann_snapshot best_model = ann_snapshot(*this);
+    ann_snapshot best_model(*this);
 
-    if(training_set.num_inputs != input_layer->num_activations())
+    if(labeled_set.num_inputs != input_layer->num_activations())
     {
-        std::cerr << "input size mismatch: training set has " << training_set.num_inputs << " but model has " << input_layer->num_activations() << std::endl;
+        std::cerr << "input size mismatch: training set has " << labeled_set.num_inputs << " but model has " << input_layer->num_activations() << std::endl;
         return false;
     }
 
-    if(training_set.num_outputs != output_layer->num_activations())
+    if(labeled_set.num_outputs != output_layer->num_activations())
     {
-        std::cerr << "output size mismatch: training set has " << training_set.num_outputs << " but model has " << output_layer->num_activations() << std::endl;
+        std::cerr << "output size mismatch: training set has " << labeled_set.num_outputs << " but model has " << output_layer->num_activations() << std::endl;
         return false;
     }
 
-    for (integer epoch = 0; epoch < epochs; ++epoch)
+    // the teacher only runs once, its soft targets are cached in a copy of the training set for all epochs
+    ann_set distilled_set;
+    if(!settings.teacher_path.empty())
     {
-        real total_loss = 0.0f;
-        for(ann_setpair &training_pair : training_set.pairs)
+        if(!(settings.distillation_weight >= 0.0f && settings.distillation_weight <= 1.0f) || !(settings.distillation_temperature > 0.0f && std::isfinite(settings.distillation_temperature)))
         {
-            // set input activations
-            for (size_t i = 0; i < input_layer->num_activations(); ++i)
+            std::cerr << "invalid distillation settings: soft target weight " << settings.distillation_weight << " must be between 0 and 1, temperature "
+                      << settings.distillation_temperature << " must be positive" << std::endl;
+            return false;
+        }
+
+        ann_model teacher(settings.teacher_path.c_str());
+        if(teacher.layers.size() < 2 || teacher.input()->num_activations() != labeled_set.num_inputs || teacher.output()->num_activations() != labeled_set.num_outputs)
+        {
+            std::cerr << "teacher model doesn't match the training set: " << settings.teacher_path << std::endl;
+            return false;
+        }
+        if(teacher.evaluation_type != evaluation_type)
+        {
+            std::cerr << "teacher model has a different evaluation type: " << settings.teacher_path << std::endl;
+            return false;
+        }
+
+        auto distill_start = std::chrono::steady_clock::now();
+        distilled_set = teacher.distillation_set(labeled_set, settings.distillation_temperature, settings.distillation_weight);
+
+        std::chrono::duration<double> distill_time = std::chrono::steady_clock::now() - distill_start;
+        log << "Distilling from " << settings.teacher_path << " at temperature " << settings.distillation_temperature << ", soft target weight " << settings.distillation_weight 
+            << ", targets for " << distilled_set.pairs.size() << " pairs in " << distill_time.count() << "s" << std::endl;
+    }
+    ann_set const& training_set = settings.teacher_path.empty() ? labeled_set : distilled_set;
+
+    integer first_trainable = first_trainable_layer();
+    if(first_trainable == layers.size())
+    {
+        std::cerr << "can't train model with every layer frozen" << std::endl;
+        return false;
+    }
+
+    // all per-sample buffers are allocated here once, the training loop itself never allocates
+    // deterministic training is hogwild in lockstep, so it always runs on the workers
+    bool parallel_training = settings.hogwild || settings.deterministic;
+    integer num_workers = 1;
+    if(parallel_training)
+    {
+        num_workers = settings.num_threads > 0 ? settings.num_threads : (integer)omp_get_max_threads();
+        log << (settings.deterministic ? "Deterministic" : "Hogwild") << " training enabled with " << num_workers << " threads" << std::endl;
+    }
+
+    // serial training parallelizes inside the layers instead, num_threads caps those loops for the calling thread
+    // only, so concurrent trainings don't each claim every core. The previous limit is restored on return.
+    struct thread_limit
+    {
+        int previous{omp_get_max_threads()};
+        ~thread_limit() { omp_set_num_threads(previous); }
+    } serial_thread_limit;
+    if(!parallel_training && settings.num_threads > 0)
+    {
+        omp_set_num_threads((int)settings.num_threads);
+    }
+    std::vector<ann_workspace> workspaces(num_workers, ann_workspace(*this));
+
+    log << "Seed: " << settings.seed << std::endl;
+    log << "Optimizer: " << optimizer_type_to_string(optimizer.type) << std::endl;
+    log << "Learning rate schedule: " << settings.base_rate;
+    for(ann_schedule_policy const& policy : schedule.policies)
+    {
+        log << " * " << schedule_type_to_string(policy.type);
+    }
+    log << std::endl;
+    schedule.begin(training_set.pairs.size(), epochs);
+    log << "Precision: " << precision_to_string(precision) << std::endl;
+    if(first_trainable > 1)
+    {
+        log << "Frozen layers: " << (first_trainable - 1) << " in front of the first trainable layer" << std::endl;
+    }
+    for(ann_layer_base *layer : layers)
+    {
+        layer->prepare_optimizer(optimizer);
+        layer->set_precision(precision);
+        layer->grad_limit = settings.grad_limit;
+    }
+
+    // Async evaluation: the epoch boundary only copies the parameters into the candidate snapshot, and a private 
+    // evaluation model loads and evaluates it on a background thread while the next epoch trains. The result is
+    // picked up at the following boundary, a better candidate becomes the best snapshot by swapping pointers.
+    bool async_evaluation = underfit_set && settings.async_evaluation;
+    ann_snapshot *best_snapshot = &best_model;
+    ann_snapshot candidate_model;
+    ann_snapshot *candidate_snapshot = &candidate_model;
+    ann_model evaluation_model = async_evaluation ? clone() : ann_model();
+    std::future<integer> pending_evaluation;
+    integer pending_epoch = 0;
+    real pending_loss = 0.0f;
+    real last_success_rate = 0.0f;
+    if(async_evaluation)
+    {
+        candidate_model.resize(*this);
+        log << "Asynchronous evaluation enabled" << std::endl;
+    }
+
+    // copies the current parameters into the candidate snapshot and starts evaluating it in the background
+    auto launch_evaluation = [&](integer epoch, real epoch_loss)
+    {
+        candidate_snapshot->update(*this);
+        evaluation_model.activation_ranges = activation_ranges;
+        pending_epoch = epoch;
+        pending_loss = epoch_loss;
+        pending_evaluation = std::async(std::launch::async, [&evaluation_model, candidate_snapshot, underfit_set]()
+        {
+            evaluation_model.apply_snapshot(*candidate_snapshot);
+            return evaluation_model.count_misses(*underfit_set);
+        });
+    };
+
+    // waits for the pending background evaluation and records it, returns true when the success rate is diverging
+    auto finish_evaluation = [&]() -> bool
+    {
+        integer num_miss = pending_evaluation.get();
+        real success_rate = 1.0 - (prkl::real(num_miss) / prkl::real(underfit_set->pairs.size()));
+        last_success_rate = success_rate;
+
+        if(success_rate > best_success_rate)
+        {
+            best_success_rate = success_rate;
+            min_loss = pending_loss;
+            std::swap(best_snapshot, candidate_snapshot);
+            shittier_epochs = 0;
+
+            log << "Epoch " << pending_epoch << " Success Rate: " << (success_rate * 100.0) << "% (Best yet)" << std::endl;
+            return false;
+        }
+
+        log << "Epoch " << pending_epoch << " Success Rate: " << (success_rate * 100.0) << "%" << std::endl;
+        shittier_epochs++;
+        return shittier_epochs >= 4;
+    };
+
+    // Checkpoints are captured in place at the epoch boundary and written by a background thread while the next 
+    // epochs train, the loop only waits when the previous write is still running at the next checkpoint.
+    bool do_checkpoints = !settings.checkpoint_path.empty();
+    integer checkpoint_interval = std::max(settings.checkpoint_interval, (integer)1);
+    ann_checkpoint checkpoint;
+    ann_checkpoint_writer checkpoint_writer;
+    integer first_epoch = 0;
+    if(do_checkpoints)
+    {
+        checkpoint.resize(*this);
+        if(settings.resume && std::filesystem::exists(settings.checkpoint_path))
+        {
+            if(!checkpoint.read_file(settings.checkpoint_path.c_str()) || !checkpoint.restore(*this, best_model))
             {
-                input_layer->set_activation(i, training_pair.input[i]);
+                std::cerr << "failed to resume from checkpoint: " << settings.checkpoint_path << std::endl;
+                return false;
             }
 
-            // forward propagate
-            if(!forward_propagate())
+            // a run that stopped early is done, training on would only continue past the divergence it stopped at
+            first_epoch = checkpoint.stopped ? std::max(checkpoint.next_epoch, epochs) : checkpoint.next_epoch;
+            best_success_rate = checkpoint.best_success_rate;
+            min_loss = checkpoint.min_loss;
+            last_success_rate = checkpoint.last_success_rate;
+            shittier_epochs = checkpoint.shittier_epochs;
+            if(async_evaluation && checkpoint.evaluation_pending)
             {
-                std::cerr << "layer propagation failed" << std::endl;
-                return false;
+                launch_evaluation(checkpoint.pending_epoch, checkpoint.pending_loss);
             }
 
-            // calculate gradients from expected output
-            std::vector<ann_gradients> layer_gradients(layers.size()-1);
-            output_layer->gradients_from_expected_output(evaluation_type, regression_loss_function, training_pair.output, layer_gradients.back(), total_loss);
+            if(checkpoint.stopped)
+                log << "Checkpoint " << settings.checkpoint_path << " is from a run that stopped early at epoch " << checkpoint.next_epoch << ", nothing left to train" << std::endl;
+            else
+                log << "Resumed from checkpoint " << settings.checkpoint_path << " at epoch " << first_epoch << std::endl;
+        }
+        else if(settings.resume)
+        {
+            log << "No checkpoint at " << settings.checkpoint_path << ", starting from scratch" << std::endl;
+        }
+    }
+
+    // quantization-aware training rounds the inputs of every dense layer to the codes of their calibrated range, the ranges
+    // follow the weights by recalibrating at the start of every epoch
+    bool quantization_aware = precision == ann_precision::int8;
+    if(quantization_aware)
+    {
+        activation_ranges = calibrate(training_set);
+        log << "Quantization-aware training, activation ranges calibrated on " << training_set.pairs.size() << " pairs every epoch" << std::endl;
+    }
 
-            for (integer layer_index = (integer)layers.size() - 2; layer_index > 0; --layer_index)
-            {
-                ann_gradients &curr_gradients = layer_gradients[layer_index - 1];
-                ann_gradients &next_gradients = layer_gradients[layer_index];
+    // the weights of a frozen prefix never change, so when fine-tuning its outputs are computed once and every epoch starts at the first trainable layer
+    integer first_layer = 1;
+    ann_set frozen_prefix_set;
+    if(first_trainable > 1 && settings.cache_frozen_prefix)
+    {
+        auto cache_start = std::chrono::steady_clock::now();
+        frozen_prefix_set = forward_frozen_prefix(training_set);
+        first_layer = first_trainable;
 
-                ann_layer_base *current_layer = layers[layer_index];
-                ann_layer_base *next_layer = layers[layer_index + 1];
-                current_layer->gradients_backpropagate(next_gradients, next_layer, curr_gradients);
-            }
+        std::chrono::duration<double> cache_time = std::chrono::steady_clock::now() - cache_start;
+        log << "Cached the outputs of " << (first_trainable - 1) << " frozen layers for " << frozen_prefix_set.pairs.size() << " pairs in " << cache_time.count() << "s" << std::endl;
+    }
+    ann_set const& epoch_set = first_layer > 1 ? frozen_prefix_set : training_set;
+
+    // phase timers cost a clock read per phase and sample, so they only run when the telemetry has somewhere to go
+    ann_telemetry telemetry;
+    if(!settings.telemetry_path.empty() && telemetry.open(settings.telemetry_path))
+    {
+        telemetry.begin(*this, training_set.pairs.size(), first_epoch, epochs, first_layer);
+        log << "Writing telemetry to " << settings.telemetry_path << std::endl;
+    }
+    ann_phase_timer timer;
+    ann_phase_timer total_timer;
+    timer.enabled = telemetry.is_open();
+    for(ann_workspace &workspace : workspaces)
+    {
+        workspace.timer.enabled = telemetry.is_open();
+    }
 
-            for (integer layer_index = 1; layer_index < layers.size(); ++layer_index)
+    auto train_start = std::chrono::steady_clock::now();
+    integer samples_trained = 0;
+
+    for (integer epoch = first_epoch; epoch < epochs; ++epoch)
+    {
+        auto epoch_start = std::chrono::steady_clock::now();
+        timer.reset();
+        for(ann_workspace &workspace : workspaces)
+        {
+            workspace.timer.reset();
+        }
+
+        if(quantization_aware && epoch > first_epoch)
+        {
+            timer.start();
+            activation_ranges = calibrate(training_set);
+            timer.lap(ann_phase::calibration);
+        }
+
+        real total_loss = 0.0f;
+        if(settings.deterministic)
+        {
+            total_loss = train_epoch_deterministic(epoch_set, workspaces, first_layer);
+        }
+        else if(settings.hogwild)
+        {
+            total_loss = train_epoch_hogwild(epoch_set, workspaces, first_layer);
+        }
+        else
+        {
+            for(ann_setpair const& training_pair : epoch_set.pairs)
             {
-                ann_layer_base *current_layer = layers[layer_index];
-                ann_layer_base *previous_layer = layers[layer_index - 1];
-                ann_gradients &curr_gradients = layer_gradients[layer_index - 1];
-                current_layer->update_weights(curr_gradients, previous_layer, learning_rate);
+                train_step(training_pair, workspaces.front(), optimizer.step(schedule.learning_rate(num_steps, settings), num_steps), total_loss, first_layer);
+                num_steps++;
             }
         }
 
         real avg_loss = total_loss / training_set.pairs.size();
+        real learning_rate = schedule.learning_rate(num_steps - 1, settings);
+
+        std::chrono::duration<double> epoch_time = std::chrono::steady_clock::now() - epoch_start;
+        double samples_per_second = double(training_set.pairs.size()) / epoch_time.count();
+        samples_trained += training_set.pairs.size();
+
+        for(ann_workspace &workspace : workspaces)
+        {
+            timer.add(workspace.timer);
+        }
+
+        real epoch_result = -avg_loss;
+        bool evaluated = false;
+        integer evaluated_epoch = 0;
+        bool stop_training = false;
+        if(async_evaluation)
+        {
+            log << "Epoch " << epoch << " Learning Rate: " << learning_rate <<  " Loss: " << avg_loss << ", Throughput: " << samples_per_second << " samples/s" << std::endl;
+
+            // the candidate buffer is still being read until the previous evaluation is done
+            if(pending_evaluation.valid())
+            {
+                timer.start();
+                evaluated = true;
+                evaluated_epoch = pending_epoch;
+                stop_training = finish_evaluation();
+                timer.lap(ann_phase::evaluation);
+            }
+
+            if(stop_training)
+            {
+                log << "Success rate is diverging, exiting early.." << std::endl;
+            }
+            else
+            {
+                timer.start();
+                launch_evaluation(epoch, avg_loss);
+                timer.lap(ann_phase::snapshot);
+            }
 
-        if(underfit_set)
+            // the schedule sees the success rate one epoch late
+            epoch_result = last_success_rate;
+        }
+        else if(underfit_set)
         {
+            timer.start();
             real success_rate = evaluate(*underfit_set);
+            timer.lap(ann_phase::evaluation);
+            epoch_result = success_rate;
+            evaluated = true;
+            evaluated_epoch = epoch;
+            last_success_rate = success_rate;
 
             if(success_rate > best_success_rate)
             {
                 best_success_rate = success_rate;
                 min_loss = avg_loss; // not really the min loss, but the loss of the best success rate!
-                best_model.update(*this);
+                timer.start();
+                best_snapshot->update(*this);
+                timer.lap(ann_phase::snapshot);
                 shittier_epochs = 0;
 
-                std::cout << "Epoch " << epoch << " Learning Rate: " << learning_rate <<  ", Success Rate: " << (success_rate * 100.0) << "% (Best yet)"  << std::endl;
+                log << "Epoch " << epoch << " Learning Rate: " << learning_rate <<  ", Success Rate: " << (success_rate * 100.0) << "% (Best yet), Throughput: " << samples_per_second << " samples/s" << std::endl;
             }
             else
             {
                 
-                std::cout << "Epoch " << epoch << " Learning Rate: " << learning_rate <<  ", Success Rate: " << (success_rate * 100.0) << "%"  << std::endl;
+                log << "Epoch " << epoch << " Learning Rate: " << learning_rate <<  ", Success Rate: " << (success_rate * 100.0) << "%, Throughput: " << samples_per_second << " samples/s" << std::endl;
                 shittier_epochs++;
                 if(shittier_epochs >= 4)
                 {
-                    std::cout << "Success rate is diverging, exiting early.." << std::endl;
-                    break;
+                    log << "Success rate is diverging, exiting early.." << std::endl;
+                    stop_training = true;
                 }
             }
         }
@@ -333,112 +806,533 @@ bool prkl::ann_model::train(ann_set &training_set, integer epochs, ann_set *unde
             if(avg_loss < min_loss)
             {
                 min_loss = avg_loss;
-                best_model.update(*this);
-                std::cout << "Epoch " << epoch << " Learning Rate: " << learning_rate <<  " Loss: " << avg_loss << " (Best yet)" << std::endl;
+                timer.start();
+                best_snapshot->update(*this);
+                timer.lap(ann_phase::snapshot);
+                log << "Epoch " << epoch << " Learning Rate: " << learning_rate <<  " Loss: " << avg_loss << " (Best yet), Throughput: " << samples_per_second << " samples/s" << std::endl;
             }
             else 
             {
-                std::cout << "Epoch " << epoch << " Learning Rate: " << learning_rate <<  " Loss: " << avg_loss << std::endl;
+                log << "Epoch " << epoch << " Learning Rate: " << learning_rate <<  " Loss: " << avg_loss << ", Throughput: " << samples_per_second << " samples/s" << std::endl;
             }
                     
-            if(prkl::settings().early_exit && (avg_loss > min_loss * (1.0f + prkl::settings().early_exit_treshold)))
+            if(settings.early_exit && (avg_loss > min_loss * (1.0f + settings.early_exit_treshold)))
             {
-                std::cout << "Loss rate is diverging, exiting early.." << std::endl;
-                break;
+                log << "Loss rate is diverging, exiting early.." << std::endl;
+                stop_training = true;
             }
         }
-        
-        learning_rate = adaptive_learning_rate(avg_loss);
+
+        if(!stop_training)
+            schedule.end_epoch(avg_loss, epoch_result);
+
+        // the stop is checkpointed as well, otherwise resuming would pick up the last interval and train on past it
+        if(do_checkpoints && (stop_training || (epoch + 1) % checkpoint_interval == 0 || epoch + 1 == epochs))
+        {
+            timer.start();
+            checkpoint_writer.wait();
+            checkpoint.capture(*this, *best_snapshot);
+            checkpoint.next_epoch = epoch + 1;
+            checkpoint.best_success_rate = best_success_rate;
+            checkpoint.min_loss = min_loss;
+            checkpoint.last_success_rate = last_success_rate;
+            checkpoint.shittier_epochs = shittier_epochs;
+            checkpoint.stopped = stop_training;
+            checkpoint.evaluation_pending = pending_evaluation.valid();
+            checkpoint.pending_epoch = pending_epoch;
+            checkpoint.pending_loss = pending_loss;
+            checkpoint_writer.write_async(checkpoint, settings.checkpoint_path);
+            timer.lap(ann_phase::checkpoint);
+        }
+
+        total_timer.add(timer);
+        if(telemetry.is_open())
+            telemetry.record_epoch(epoch, avg_loss, learning_rate, evaluated, evaluated_epoch, last_success_rate, timer, std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch_start).count());
+
+        if(stop_training)
+            break;
+    }
+
+    if(pending_evaluation.valid())
+    {
+        finish_evaluation();
+    }
+
+    std::chrono::duration<double> train_time = std::chrono::steady_clock::now() - train_start;
+    log << "Trained " << samples_trained << " samples in " << train_time.count() << "s (" << (double(samples_trained) / train_time.count()) << " samples/s, " << (settings.deterministic ? "deterministic" : (settings.hogwild ? "hogwild" : "serial")) << ")" << std::endl;
+    if(telemetry.is_open())
+    {
+        log << "Time per phase (summed over threads):";
+        for(integer p = 0; p < (integer)ann_phase::num_phases; p++)
+        {
+            log << " " << phase_to_string((ann_phase)p) << " " << total_timer.seconds[p] << "s";
+        }
+        log << std::endl;
     }
 
     if(underfit_set)
     {
-        std::cout << "Trained model to success rate of " << (best_success_rate*100.0) << "% at loss of " << min_loss << std::endl;
+        log << "Trained model to success rate of " << (best_success_rate*100.0) << "% at loss of " << min_loss << std::endl;
     }
     else 
     {
-        std::cout << "Trained model to loss rate of " << min_loss << std::endl;
+        log << "Trained model to loss rate of " << min_loss << std::endl;
+    }
+    apply_snapshot(*best_snapshot);
+    if(quantization_aware)
+    {
+        activation_ranges = calibrate(training_set);
     }
-    apply_snapshot(best_model);
 
     return true;
 }
 
-prkl::real prkl::ann_model::evaluate(ann_set &evaluation_set)
+void prkl::ann_model::train_step(ann_setpair const& training_pair, ann_workspace &workspace, ann_optimizer_step const& step, real &inout_loss, integer first_layer)
+{
+    compute_gradients(training_pair, workspace, inout_loss, first_layer);
+    apply_gradients(workspace, step);
+    workspace.timer.lap(ann_phase::update);
+}
+
+void prkl::ann_model::compute_gradients(ann_setpair const& training_pair, ann_workspace &workspace, real &inout_loss, integer first_layer) const
+{
+    ann_layer_base *output_layer = layers.back();
+    integer last_layer = layers.size() - 1;
+
+    workspace.timer.start();
+    std::copy(training_pair.input.begin(), training_pair.input.end(), workspace.activations(first_layer - 1));
+
+    for(integer layer_index = first_layer; layer_index <= last_layer; layer_index++)
+    {
+        // rounded in place, so the weight updates see the inputs the forward pass used and the gradients pass straight through
+        if(fake_quantizes_inputs(layer_index))
+            activation_ranges[layer_index - 1].fake_quantize(workspace.activations(layer_index - 1), layers[layer_index - 1]->num_activations());
+
+        layers[layer_index]->forward(workspace.activations(layer_index - 1), workspace.activations(layer_index));
+    }
+
+    if(evaluation_type == ann_evaluation_type::multiclass_classification)
+    {
+        output_layer->apply_softmax(workspace.activations(last_layer));
+    }
+    workspace.timer.lap(ann_phase::forward);
+
+    output_layer->gradients_from_expected_output(evaluation_type, regression_loss_function, workspace.activations(last_layer), training_pair.output, workspace.gradients(last_layer), inout_loss);
+
+    // nothing in front of the first trainable layer needs its gradients
+    integer first_trainable = first_trainable_layer();
+    for(integer layer_index = last_layer - 1; layer_index >= first_trainable; --layer_index)
+    {
+        layers[layer_index]->gradients_backpropagate(workspace.activations(layer_index), workspace.gradients(layer_index + 1), layers[layer_index + 1], workspace.gradients(layer_index));
+    }
+    workspace.timer.lap(ann_phase::backpropagate);
+}
+
+void prkl::ann_model::apply_gradients(ann_workspace const& workspace, ann_optimizer_step const& step, integer part, integer num_parts)
 {
-    prkl::ann_layer_base *input_layer = input();
-    prkl::ann_layer_base *output_layer = output();
-    prkl::integer num_miss = 0;
-    prkl::integer num_pairs = evaluation_set.pairs.size();
+    for(integer layer_index = 1; layer_index < layers.size(); ++layer_index)
+    {
+        ann_layer_base *layer = layers[layer_index];
+        if(layer->frozen)
+            continue;
 
-    for(prkl::integer e = 0; e <  num_pairs; e++)
+        integer num_neurons = layer->num_activations();
+        if(num_parts == 1)
+        {
+            layer->update_weights(workspace.gradients(layer_index), workspace.activations(layer_index - 1), optimizer, step);
+        }
+        else
+        {
+            layer->update_neurons(workspace.gradients(layer_index), workspace.activations(layer_index - 1), optimizer, step, num_neurons * part / num_parts, num_neurons * (part + 1) / num_parts);
+        }
+    }
+}
+
+prkl::real prkl::ann_model::train_epoch_hogwild(ann_set const& training_set, std::vector<ann_workspace> &workspaces, integer first_layer)
+{
+    natural num_pairs = training_set.pairs.size();
+    real total_loss = 0.0f;
+
+    // Every worker runs plain per-sample SGD on its own workspace, and writes its weight deltas straight into the 
+    // shared layer weights. There is no locking: with sparse inputs most updates touch disjoint weights, and the 
+    // occasional lost update is harmless to convergence (Niu et al., "Hogwild!"). The parameters are still read and 
+    // written through relaxed atomics while the workers run, racing plain accesses would be undefined behaviour.
+    for(ann_layer_base *layer : layers)
+        layer->shared_parameters = true;
+
+    #pragma omp parallel num_threads((int)workspaces.size()) reduction(+:total_loss)
     {
-        prkl::ann_setpair &eval_pair = evaluation_set.pairs[e];
+        ann_workspace &workspace = workspaces[omp_get_thread_num()];
 
-        for(prkl::integer i = 0; i < input_layer->num_activations(); i++)
+        #pragma omp for schedule(static)
+        for(natural p = 0; p < num_pairs; p++)
         {
-            input_layer->set_activation(i, eval_pair.input[i]);
+            integer step = num_steps + p;
+            train_step(training_set.pairs[p], workspace, optimizer.step(schedule.learning_rate(step, settings), step), total_loss, first_layer);
         }
+    }
+
+    for(ann_layer_base *layer : layers)
+        layer->shared_parameters = false;
+
+    num_steps += num_pairs;
+
+    return total_loss;
+}
 
-        if(!forward_propagate())
+prkl::real prkl::ann_model::train_epoch_deterministic(ann_set const& training_set, std::vector<ann_workspace> &workspaces, integer first_layer)
+{
+    integer num_pairs = training_set.pairs.size();
+    integer num_workers = workspaces.size();
+    std::vector<real> worker_loss(num_workers, 0.0f);
+    integer team_size = num_workers;
+
+    // Hogwild with the races taken out. Each round, worker w backpropagates pair round + w against the weights as they 
+    // were at the start of the round, so the staleness matches hogwild on the same number of threads. After a barrier 
+    // the round's updates are applied in pair order, every worker owning the same fixed slice of neurons in every layer. 
+    // Which thread does what and in which order values are summed only depends on the thread count.
+    #pragma omp parallel num_threads((int)num_workers)
+    {
+        // the runtime may run a smaller team than requested (thread limits, nesting), rounds and slices follow the
+        // team that actually runs so every pair is still trained once, but the model then matches that thread count
+        #pragma omp single
         {
-            std::cerr << "forward propagation failed: evaluation failed!" << std::endl;
-            return 0.0;
+            team_size = omp_get_num_threads();
+            if(team_size != num_workers)
+            {
+                std::cerr << "deterministic training requested " << num_workers << " threads but runs on " << team_size 
+                          << ", the model will only match runs on " << team_size << " threads" << std::endl;
+            }
         }
 
-        prkl::integer max_index_output = output_layer->max_activation_index();
-        prkl::integer max_index_expected = eval_pair.max_output_index();
+        integer worker = omp_get_thread_num();
+        ann_workspace &workspace = workspaces[worker];
 
-        if(max_index_output != max_index_expected)
+        for(integer round = 0; round < num_pairs; round += team_size)
         {
-            num_miss++;
+            integer round_size = std::min(team_size, num_pairs - round);
+            if(worker < round_size)
+            {
+                compute_gradients(training_set.pairs[round + worker], workspace, worker_loss[worker], first_layer);
+            }
+
+            #pragma omp barrier
+
+            for(integer w = 0; w < round_size; w++)
+            {
+                integer step = num_steps + round + w;
+                apply_gradients(workspaces[w], optimizer.step(schedule.learning_rate(step, settings), step), worker, team_size);
+            }
+            // includes the wait at the first barrier, so the cost of the lockstep shows up as update time
+            workspace.timer.lap(ann_phase::update);
+
+            // gradients of this round are read by every worker, so nobody may overwrite theirs before all are done
+            #pragma omp barrier
         }
     }
 
+    num_steps += num_pairs;
+
+    real total_loss = 0.0f;
+    for(real loss : worker_loss)
+    {
+        total_loss += loss;
+    }
+
+    return total_loss;
+}
+
+prkl::real const* prkl::ann_model::forward_batch(real const* inputs, integer batch, ann_inference_context &context) const
+{
+    assert(batch <= context.max_batch && "batch exceeds the inference context");
+
+    real const* prev_activations = inputs;
+    for(integer layer_index = 1; layer_index < layers.size(); layer_index++)
+    {
+        if(fake_quantizes_inputs(layer_index))
+        {
+            // the inputs belong to the caller, they are rounded in the context buffer instead
+            real *layer_inputs = context.activations(layer_index - 1);
+            integer num_layer_inputs = batch * layers[layer_index - 1]->num_activations();
+            if(prev_activations != layer_inputs)
+                std::memcpy(layer_inputs, prev_activations, num_layer_inputs * sizeof(real));
+
+            activation_ranges[layer_index - 1].fake_quantize(layer_inputs, num_layer_inputs);
+            prev_activations = layer_inputs;
+        }
+
+        real *layer_activations = context.activations(layer_index);
+        layers[layer_index]->forward_batch(prev_activations, layer_activations, batch);
+        prev_activations = layer_activations;
+    }
+
+    if(evaluation_type == ann_evaluation_type::multiclass_classification)
+    {
+        ann_layer_base *output_layer = layers.back();
+        integer num_outputs = output_layer->num_activations();
+        for(integer b = 0; b < batch; b++)
+        {
+            output_layer->apply_softmax(context.activations(layers.size() - 1) + b * num_outputs);
+        }
+    }
+
+    return prev_activations;
+}
+
+bool prkl::ann_model::infer(std::span<real const> inputs, std::span<real> outputs, integer batch, ann_inference_context &context) const
+{
+    if(layers.size() < 2)
+    {
+        std::cerr << "can't run inference on a model that has less than 2 layers" << std::endl;
+        return false;
+    }
+
+    integer num_inputs = layers.front()->num_activations();
+    integer num_outputs = layers.back()->num_activations();
+    if(inputs.size() < batch * num_inputs || outputs.size() < batch * num_outputs)
+    {
+        std::cerr << "can't run inference: " << batch << " samples need " << (batch * num_inputs) << " inputs and " << (batch * num_outputs) 
+                  << " outputs, got " << inputs.size() << " and " << outputs.size() << std::endl;
+        return false;
+    }
+
+    if(!context.fits(*this, batch))
+    {
+        context.resize(*this, std::max(batch, context.max_batch));
+    }
+
+    real const* results = forward_batch(inputs.data(), batch, context);
+    std::copy(results, results + batch * num_outputs, outputs.begin());
+    return true;
+}
+
+prkl::real prkl::ann_model::evaluate(ann_set const& evaluation_set) const
+{
+    if(layers.size() < 2)
+    {
+        std::cerr << "can't evaluate model that has less than 2 layers: evaluation failed!" << std::endl;
+        return 0.0;
+    }
+
+    natural num_pairs = evaluation_set.pairs.size();
+    integer num_miss = count_misses(evaluation_set);
+
     real success_rate = (1.0 - (prkl::real(num_miss) / prkl::real(num_pairs)));
-    std::cout << "Evaluated " << num_pairs << " pairs, with " << num_miss << " misses. Success rate: " << (100.0 * success_rate) << "%" << std::endl;
+    if(settings.verbose)
+        std::cout << "Evaluated " << num_pairs << " pairs, with " << num_miss << " misses. Success rate: " << (100.0 * success_rate) << "%" << std::endl;
     return success_rate;
 }
 
+prkl::integer prkl::ann_model::count_misses(ann_set const& evaluation_set) const
+{
+    integer num_inputs = layers.front()->num_activations();
+    integer num_outputs = layers.back()->num_activations();
+    natural num_pairs = evaluation_set.pairs.size();
+    integer batch_size = std::max(settings.evaluation_batch_size, (integer)1);
+    natural num_batches = (num_pairs + batch_size - 1) / batch_size;
+    integer num_miss = 0;
+    integer num_threads = settings.evaluation_threads > 0 ? settings.evaluation_threads : (integer)omp_get_max_threads();
+
+    #pragma omp parallel num_threads((int)num_threads) reduction(+:num_miss)
+    {
+        ann_inference_context context(*this, batch_size);
+
+        #pragma omp for schedule(dynamic)
+        for(natural batch_index = 0; batch_index < num_batches; batch_index++)
+        {
+            integer first = batch_index * batch_size;
+            integer batch = std::min<integer>(batch_size, num_pairs - first);
+
+            real *inputs = context.activations(0);
+            for(integer b = 0; b < batch; b++)
+            {
+                std::memcpy(inputs + b * num_inputs, evaluation_set.pairs[first + b].input.data(), num_inputs * sizeof(real));
+            }
+
+            real const* outputs = forward_batch(inputs, batch, context);
+
+            for(integer b = 0; b < batch; b++)
+            {
+                real const* sample_outputs = outputs + b * num_outputs;
+                integer max_index_output = std::max_element(sample_outputs, sample_outputs + num_outputs) - sample_outputs;
+                integer max_index_expected = evaluation_set.pairs[first + b].max_output_index();
+
+                if(max_index_output != max_index_expected)
+                {
+                    num_miss++;
+                }
+            }
+        }
+    }
+
+    return num_miss;
+}
+
 
-prkl::ann_snapshot::ann_snapshot(ann_model &model)
+prkl::ann_snapshot::ann_snapshot(ann_model const& model)
 {
+    resize(model);
+    update(model);
+}
+
+void prkl::ann_snapshot::resize(ann_model const& model)
+{
+    integer num_parameters = 0;
     for(ann_layer_base *l : model.layers)
     {
-        layers.push_back(l->clone());
+        num_parameters += l->num_parameters();
     }
+    parameters.resize(num_parameters);
 }
 
+void prkl::ann_snapshot::update(ann_model const& model)
+{
+    real *cursor = parameters.data();
+    for(ann_layer_base *l : model.layers)
+    {
+        l->read_parameters(cursor);
+        cursor += l->num_parameters();
+    }
+}
 
-void prkl::ann_snapshot::update(ann_model &model)
+void prkl::ann_model::apply_snapshot(ann_snapshot const& snapshot)
 {
+    real const* cursor = snapshot.parameters.data();
     for(ann_layer_base *l : layers)
     {
-        delete l;
+        assert(cursor + l->num_parameters() <= snapshot.parameters.data() + snapshot.parameters.size() && "snapshot was taken from a different model");
+        l->write_parameters(cursor);
+        cursor += l->num_parameters();
     }
-    layers.clear();
-    for(ann_layer_base *l : model.layers)
+}
+
+prkl::integer prkl::ann_model::first_trainable_layer() const
+{
+    integer layer_index = 1;
+    while(layer_index < layers.size() && layers[layer_index]->frozen)
     {
-        layers.push_back(l->clone());
+        layer_index++;
     }
+
+    return layer_index;
 }
 
-prkl::ann_snapshot::~ann_snapshot()
+prkl::ann_set prkl::ann_model::distillation_set(ann_set const& set, real temperature, real soft_weight) const
 {
-    for(ann_layer_base* l : layers)
+    integer num_inputs = layers.front()->num_activations();
+    integer num_outputs = layers.back()->num_activations();
+    natural num_pairs = set.pairs.size();
+    integer batch_size = std::max(settings.evaluation_batch_size, (integer)1);
+    natural num_batches = (num_pairs + batch_size - 1) / batch_size;
+    integer num_threads = settings.evaluation_threads > 0 ? settings.evaluation_threads : (integer)omp_get_max_threads();
+    real inverse_temperature = 1.0f / std::max(temperature, std::numeric_limits<real>::min());
+    bool softmax_outputs = evaluation_type == ann_evaluation_type::multiclass_classification;
+
+    ann_set returner(set.num_inputs, set.num_outputs);
+    returner.pairs.resize(num_pairs);
+
+    #pragma omp parallel num_threads((int)num_threads)
     {
-        delete l;
+        ann_inference_context context(*this, batch_size);
+        std::vector<real> soft_targets(num_outputs);
+
+        #pragma omp for schedule(dynamic)
+        for(natural batch_index = 0; batch_index < num_batches; batch_index++)
+        {
+            integer first = batch_index * batch_size;
+            integer batch = std::min<integer>(batch_size, num_pairs - first);
+
+            real *inputs = context.activations(0);
+            for(integer b = 0; b < batch; b++)
+            {
+                std::memcpy(inputs + b * num_inputs, set.pairs[first + b].input.data(), num_inputs * sizeof(real));
+            }
+
+            real const* outputs = forward_batch(inputs, batch, context);
+
+            for(integer b = 0; b < batch; b++)
+            {
+                real const* sample_outputs = outputs + b * num_outputs;
+                std::copy(sample_outputs, sample_outputs + num_outputs, soft_targets.begin());
+
+                // softmax(z / T) from the probabilities p = softmax(z): log p differs from z by a constant, so it is p^(1/T) normalized,
+                // taken relative to the largest probability to stay in range
+                if(softmax_outputs)
+                {
+                    real max_log = std::log(*std::max_element(soft_targets.begin(), soft_targets.end()));
+                    real sum = 0.0f;
+                    for(real &target : soft_targets)
+                    {
+                        target = std::exp((std::log(target) - max_log) * inverse_temperature);
+                        sum += target;
+                    }
+                    for(real &target : soft_targets)
+                    {
+                        target /= sum;
+                    }
+                }
+
+                ann_setpair const& pair = set.pairs[first + b];
+                ann_setpair &distilled = returner.pairs[first + b];
+                distilled.input = pair.input;
+                distilled.output.resize(num_outputs);
+                for(integer o = 0; o < num_outputs; o++)
+                {
+                    distilled.output[o] = soft_weight * soft_targets[o] + (1.0f - soft_weight) * pair.output[o];
+                }
+            }
+        }
     }
+
+    return returner;
 }
 
-void prkl::ann_model::apply_snapshot(ann_snapshot const& snapshot)
+prkl::ann_set prkl::ann_model::forward_frozen_prefix(ann_set const& set) const
 {
-    for(ann_layer_base *l : layers)
-        delete l;
-    layers.clear();
+    integer last_frozen = first_trainable_layer() - 1;
+    integer num_inputs = layers.front()->num_activations();
+    integer num_outputs = layers[last_frozen]->num_activations();
+    natural num_pairs = set.pairs.size();
+    integer batch_size = std::max(settings.evaluation_batch_size, (integer)1);
+    natural num_batches = (num_pairs + batch_size - 1) / batch_size;
+    integer num_threads = settings.evaluation_threads > 0 ? settings.evaluation_threads : (integer)omp_get_max_threads();
+
+    ann_set returner(num_outputs, set.num_outputs);
+    returner.pairs.resize(num_pairs);
 
-    for(ann_layer_base *l : snapshot.layers)
+    #pragma omp parallel num_threads((int)num_threads)
     {
-        layers.push_back(l->clone());
+        ann_inference_context context(*this, batch_size);
+
+        #pragma omp for schedule(dynamic)
+        for(natural batch_index = 0; batch_index < num_batches; batch_index++)
+        {
+            integer first = batch_index * batch_size;
+            integer batch = std::min<integer>(batch_size, num_pairs - first);
+
+            real *inputs = context.activations(0);
+            for(integer b = 0; b < batch; b++)
+            {
+                std::memcpy(inputs + b * num_inputs, set.pairs[first + b].input.data(), num_inputs * sizeof(real));
+            }
+
+            for(integer layer_index = 1; layer_index <= last_frozen; layer_index++)
+            {
+                if(fake_quantizes_inputs(layer_index))
+                    activation_ranges[layer_index - 1].fake_quantize(context.activations(layer_index - 1), batch * layers[layer_index - 1]->num_activations());
+
+                layers[layer_index]->forward_batch(context.activations(layer_index - 1), context.activations(layer_index), batch);
+            }
+
+            real const* outputs = context.activations(last_frozen);
+            for(integer b = 0; b < batch; b++)
+            {
+                ann_setpair &pair = returner.pairs[first + b];
+                pair.input.assign(outputs + b * num_outputs, outputs + (b + 1) * num_outputs);
+                pair.output = set.pairs[first + b].output;
+            }
+        }
     }
-}
\ No newline at end of file
+
+    return returner;
+}
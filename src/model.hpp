@@ -2,21 +2,33 @@
 #pragma once 
 
 #include "layer.hpp"
+#include "sparse_layer.hpp"
+#include "quantized_layer.hpp"
 #include "set.hpp"
+#include "workspace.hpp"
+#include "schedule.hpp"
+#include "inference.hpp"
+
+#include <span>
 
 namespace prkl 
 {
 
     struct ann_model;
 
+    /** Copy of the trainable parameters of a model, in one preallocated buffer. Activations are never copied */
     struct ann_snapshot 
     {
-        ann_snapshot(ann_model & model);
-        ~ann_snapshot();
+        ann_snapshot()=default;
+        ann_snapshot(ann_model const& model);
 
-        void update(ann_model &model);
+        /** Sizes the buffer for the model, this is the only place a snapshot allocates */
+        void resize(ann_model const& model);
 
-        std::vector<ann_layer_base*> layers;
+        /** Copies the model parameters into the snapshot in place */
+        void update(ann_model const& model);
+
+        std::vector<real> parameters;
     };
 
     /** A network with dense (fully connected) layers */
@@ -24,29 +36,119 @@ namespace prkl
     {
         ann_model(char const* path);
         ann_model(nlohmann::json &cfg);
-        ann_model()=default;
+        ann_model();
+        ann_model(ann_model const&)=delete;
+        ann_model(ann_model &&)=default;
+        ann_model &operator=(ann_model const&)=delete;
         ~ann_model();
 
-        ann_model clone();
+        ann_model clone() const;
+
+        /** Applies the model wide keys of a config: evaluation type, optimizer, precision and schedule */
+        void configure(nlohmann::json &cfg);
+        /** 
+         * Applies a config on top of a loaded model, for warm starts: the model wide keys, and per layer activation_func, 
+         * leaky_alpha and frozen. Weights are kept, so the layers in the config must match the model's topology 
+         */
+        bool override_config(nlohmann::json &cfg);
 
         ann_dense_layer* add_dense_layer(integer num_neurons);
 
+        /** Replaces every dense layer with at least min_sparsity zero weights by a sparse layer that only stores the nonzero ones, returns how many were replaced */
+        integer sparsify(real min_sparsity);
+        /** 
+         * Post-training int8 quantization. Runs the calibration set through the model to find the input range of every dense layer, 
+         * then replaces those layers by quantized ones. The output layer stays fp32 unless include_output. Returns how many were replaced 
+         */
+        integer quantize(ann_set const& calibration_set, bool include_output);
+        /** Quantizes with known input ranges, one per layer as returned by calibrate, such as the ranges tracked by quantization-aware training */
+        integer quantize(std::vector<ann_quantization_range> const& ranges, bool include_output);
+        /** 
+         * Runs the set through the model and returns the range of the activations of every layer, which are the inputs of the next one. 
+         * With int8 precision the inputs of every layer are fake quantized on the way, so the ranges are the ones the quantized model sees 
+         */
+        std::vector<ann_quantization_range> calibrate(ann_set const& calibration_set) const;
+
         bool write_file(char const* path);
 
         bool forward_propagate();
 
+        /** 
+         * Forward propagates batch samples (sample-major, num_inputs each) through the context buffers, without touching the layer activations.
+         * Returns the output activations (sample-major, num_outputs each), owned by the context 
+         */
+        real const* forward_batch(real const* inputs, integer batch, ann_inference_context &context) const;
+        /** 
+         * Thread-safe inference: the model is only read and every buffer comes from the caller's context, so threads share one model with 
+         * a context each. Reads batch samples of num_inputs from inputs and writes batch samples of num_outputs to outputs, both sample-major. 
+         * The context is resized when it doesn't fit the batch or the model. Returns false when the spans are too small 
+         */
+        bool infer(std::span<real const> inputs, std::span<real> outputs, integer batch, ann_inference_context &context) const;
+
         ann_layer_base *hidden(integer index);
         ann_layer_base *input();
         ann_layer_base *output();
 
-        bool train(ann_set &training_set, integer epochs, ann_set *underfit_set = nullptr);
-        real evaluate(ann_set &evaluation_set);
-
+        /** 
+         * Trains with this model's settings, the sets are only read so several models can train on them concurrently. 
+         * With a teacher in the settings the targets are blended with its softened outputs, computed once before the first epoch 
+         */
+        bool train(ann_set const& labeled_set, integer epochs, ann_set const* underfit_set = nullptr);
+        /** Evaluates in batches across all cores, every thread with its own inference context against the shared weights */
+        real evaluate(ann_set const& evaluation_set) const;
+        /** The quiet core of evaluate, returns the number of pairs whose strongest output is not the expected one */
+        integer count_misses(ann_set const& evaluation_set) const;
+
+        /** 
+         * Forward, backpropagate and update for a single pair, entirely within the workspace buffers. Adds the pair loss to inout_loss.
+         * The pair input holds the activations of layer first_layer - 1, which is the input layer unless a frozen prefix is cached 
+         */
+        void train_step(ann_setpair const& training_pair, ann_workspace &workspace, ann_optimizer_step const& step, real &inout_loss, integer first_layer = 1);
+        /** The forward and backpropagate half of train_step, leaves the gradients in the workspace and the weights untouched */
+        void compute_gradients(ann_setpair const& training_pair, ann_workspace &workspace, real &inout_loss, integer first_layer = 1) const;
+        /** The update half of train_step, restricted to part of num_parts equal slices of the neurons of every layer */
+        void apply_gradients(ann_workspace const& workspace, ann_optimizer_step const& step, integer part = 0, integer num_parts = 1);
+
+        /** Runs one hogwild epoch with one workspace per worker thread, returns the summed loss */
+        real train_epoch_hogwild(ann_set const& training_set, std::vector<ann_workspace> &workspaces, integer first_layer = 1);
+        /** Runs one epoch in lockstep rounds with one workspace per worker thread, bit-identical for a given seed and thread count, returns the summed loss */
+        real train_epoch_deterministic(ann_set const& training_set, std::vector<ann_workspace> &workspaces, integer first_layer = 1);
+
+        /** Index of the first layer that is not frozen, backpropagation stops there. layers.size() when everything is frozen */
+        integer first_trainable_layer() const;
+        /** Runs every pair of the set through the frozen layers in front of the first trainable one, the returned set holds their output activations */
+        ann_set forward_frozen_prefix(ann_set const& set) const;
+        /** 
+         * Runs the set through this model as a teacher and returns a copy whose outputs blend soft_weight of its temperature-softened
+         * outputs with the rest of the set's own targets. Regression outputs are blended as they are, the temperature only applies to softmax 
+         */
+        ann_set distillation_set(ann_set const& set, real temperature, real soft_weight) const;
+
+        /** True when the inputs of the layer are fake quantized, which needs int8 precision, calibrated ranges and a dense layer */
+        bool fake_quantizes_inputs(integer layer_index) const;
+
+        /** Copies the snapshot parameters back into the layers in place, the snapshot must have been taken from this model */
         void apply_snapshot(ann_snapshot const& snapshot);
 
         ann_evaluation_type evaluation_type{ann_evaluation_type::regression};
         ann_loss_function regression_loss_function{ann_loss_function::mean_squared_error};
 
+        /** Hyperparameters of this model, copied from the process defaults in prkl::settings() on construction */
+        ann_settings settings{prkl::settings()};
+
+        ann_optimizer optimizer;
+        ann_schedule schedule{settings};
+
+        /** 
+         * Weight storage precision used while training, bf16/fp16 enable mixed precision with fp32 master weights. That trains
+         * against reduced precision weights but is slower than fp32, the updates round every row of the masters into the copy.
+         * int8 trains quantization-aware: dense layers see int8 rounded weights and inputs, gradients pass the rounding straight through 
+         */
+        ann_precision precision{ann_precision::fp32};
+        /** int8 precision only: activation ranges of every layer, recalibrated on the training set at the start of every epoch */
+        std::vector<ann_quantization_range> activation_ranges;
+        integer num_steps{0}; // optimizer steps taken so far, drives the adam bias correction
+
         std::vector<ann_layer_base*> layers;
     };
 
@@ -0,0 +1,293 @@
+#include "optimizer.hpp"
+
+prkl::ann_optimizer::ann_optimizer(nlohmann::json &cfg)
+{
+    // "optimizer": "adam" or "optimizer": { "type": "adam", "beta1": 0.9, ... }
+    if(cfg.is_string())
+    {
+        std::string type_str = cfg.template get<std::string>();
+        if(!optimizer_type_from_string(type_str, type))
+            std::cerr << "unrecognized optimizer: " << type_str << std::endl;
+        std::cout << "model config: optimizer: " << optimizer_type_to_string(type) << std::endl;
+        return;
+    }
+
+    if(cfg.contains("type"))
+    {
+        std::string type_str = cfg.at("type").template get<std::string>();
+        if(!optimizer_type_from_string(type_str, type))
+            std::cerr << "unrecognized optimizer: " << type_str << std::endl;
+        std::cout << "model config: optimizer: " << optimizer_type_to_string(type) << std::endl;
+    }
+
+    if(cfg.contains("momentum"))
+        momentum = cfg.at("momentum").template get<prkl::real>();
+    if(cfg.contains("rho"))
+        rho = cfg.at("rho").template get<prkl::real>();
+    if(cfg.contains("beta1"))
+        beta1 = cfg.at("beta1").template get<prkl::real>();
+    if(cfg.contains("beta2"))
+        beta2 = cfg.at("beta2").template get<prkl::real>();
+    if(cfg.contains("epsilon"))
+        epsilon = cfg.at("epsilon").template get<prkl::real>();
+    if(cfg.contains("weight_decay"))
+        weight_decay = cfg.at("weight_decay").template get<prkl::real>();
+}
+
+prkl::integer prkl::ann_optimizer::num_moments() const
+{
+    switch(type)
+    {
+        default:
+        case ann_optimizer_type::sgd:
+            return 0;
+        case ann_optimizer_type::momentum:
+        case ann_optimizer_type::nesterov:
+        case ann_optimizer_type::rmsprop:
+            return 1;
+        case ann_optimizer_type::adam:
+        case ann_optimizer_type::adamw:
+            return 2;
+    }
+}
+
+prkl::ann_optimizer_step prkl::ann_optimizer::step(real learning_rate, integer step_index) const
+{
+    ann_optimizer_step returner;
+    returner.learning_rate = learning_rate;
+    returner.index = step_index;
+
+    if(type == ann_optimizer_type::adam || type == ann_optimizer_type::adamw)
+    {
+        real t = real(step_index + 1);
+        returner.correction1 = (real)1.0 / ((real)1.0 - std::pow(beta1, t));
+        returner.correction2 = (real)1.0 / ((real)1.0 - std::pow(beta2, t));
+    }
+
+    return returner;
+}
+
+template<prkl::ann_precision precision>
+static uint16_t round_bits(prkl::real value, uint32_t noise)
+{
+    if constexpr(precision == prkl::ann_precision::bf16)
+        return prkl::to_bfloat16(value, noise).bits;
+    else
+        return prkl::to_float16(value, noise).bits;
+}
+
+/**
+ * Runs rule(input, param, moment1, moment2) over count parameters and their first num_moments moments, and rounds the new
+ * parameters into the rounded copy unless rounding is fp32. Shared parameters and moments are copied in and out of local chunks
+ * with ann_shared_access, so the rule vectorizes over every chunk either way
+ */
+template<prkl::ann_precision rounding, prkl::integer num_moments, typename rule_type>
+static void apply_rule(prkl::real const* inputs, prkl::real *params, prkl::real *moments1, prkl::real *moments2, prkl::integer count, bool shared, prkl::ann_rounded_copy const& rounded, rule_type rule)
+{
+    using access = prkl::ann_shared_access;
+    constexpr bool round = rounding != prkl::ann_precision::fp32;
+    uint16_t *rounded_bits = rounded.bits;
+    uint32_t const noise_seed = rounded.noise_seed;
+
+    if(!shared)
+    {
+        uint32_t noise = noise_seed;
+        #pragma omp simd linear(noise:prkl::rounding_noise_step)
+        for(prkl::integer j = 0; j < count; j++)
+        {
+            prkl::real p = params[j];
+            prkl::real m1 = num_moments >= 1 ? moments1[j] : (prkl::real)0.0;
+            prkl::real m2 = num_moments >= 2 ? moments2[j] : (prkl::real)0.0;
+            rule(inputs[j], p, m1, m2);
+            params[j] = p;
+            if constexpr(num_moments >= 1)
+                moments1[j] = m1;
+            if constexpr(num_moments >= 2)
+                moments2[j] = m2;
+            if constexpr(round)
+                rounded_bits[j] = round_bits<rounding>(p, noise);
+            noise += prkl::rounding_noise_step;
+        }
+        return;
+    }
+
+    prkl::integer j = 0;
+    for(; j + access::chunk_size <= count; j += access::chunk_size)
+    {
+        prkl::real p[access::chunk_size];
+        prkl::real m1[access::chunk_size] = {};
+        prkl::real m2[access::chunk_size] = {};
+        uint16_t bits[access::chunk_size];
+        access::load_chunk(params + j, p);
+        if constexpr(num_moments >= 1)
+            access::load_chunk(moments1 + j, m1);
+        if constexpr(num_moments >= 2)
+            access::load_chunk(moments2 + j, m2);
+
+        uint32_t noise = prkl::rounding_noise(noise_seed, uint32_t(j));
+        #pragma omp simd linear(noise:prkl::rounding_noise_step)
+        for(prkl::integer k = 0; k < access::chunk_size; k++)
+        {
+            rule(inputs[j + k], p[k], m1[k], m2[k]);
+            if constexpr(round)
+                bits[k] = round_bits<rounding>(p[k], noise);
+            noise += prkl::rounding_noise_step;
+        }
+
+        access::store_chunk(params + j, p);
+        if constexpr(num_moments >= 1)
+            access::store_chunk(moments1 + j, m1);
+        if constexpr(num_moments >= 2)
+            access::store_chunk(moments2 + j, m2);
+        if constexpr(round)
+            access::store_chunk(rounded_bits + j, bits);
+    }
+
+    for(; j < count; j++)
+    {
+        prkl::real p = access::load(params[j]);
+        prkl::real m1 = num_moments >= 1 ? access::load(moments1[j]) : (prkl::real)0.0;
+        prkl::real m2 = num_moments >= 2 ? access::load(moments2[j]) : (prkl::real)0.0;
+        rule(inputs[j], p, m1, m2);
+        access::store(params[j], p);
+        if constexpr(num_moments >= 1)
+            access::store(moments1[j], m1);
+        if constexpr(num_moments >= 2)
+            access::store(moments2[j], m2);
+        if constexpr(round)
+            access::store(rounded_bits[j], round_bits<rounding>(p, prkl::rounding_noise(noise_seed, uint32_t(j))));
+    }
+}
+
+template<prkl::integer num_moments, typename rule_type>
+static void update_loop(prkl::real const* inputs, prkl::real *params, prkl::real *moments1, prkl::real *moments2, prkl::integer count, bool shared, prkl::ann_rounded_copy const& rounded, rule_type rule)
+{
+    switch(rounded.precision)
+    {
+        default:
+            apply_rule<prkl::ann_precision::fp32, num_moments>(inputs, params, moments1, moments2, count, shared, rounded, rule);
+            break;
+        case prkl::ann_precision::bf16:
+            apply_rule<prkl::ann_precision::bf16, num_moments>(inputs, params, moments1, moments2, count, shared, rounded, rule);
+            break;
+        case prkl::ann_precision::fp16:
+            apply_rule<prkl::ann_precision::fp16, num_moments>(inputs, params, moments1, moments2, count, shared, rounded, rule);
+            break;
+    }
+}
+
+// Note: the gradients in this framework point downhill (expected - actual), so every rule adds its step instead of subtracting it.
+void prkl::ann_optimizer::update(ann_optimizer_step const& step, real gradient, real const* inputs, real *params, real *moments1, real *moments2, integer count, bool decay, bool shared, ann_rounded_copy const& rounded) const
+{
+    real const rate = step.learning_rate;
+
+    switch(type)
+    {
+        default:
+        case ann_optimizer_type::sgd:
+        {
+            real const scaled = rate * gradient;
+            update_loop<0>(inputs, params, moments1, moments2, count, shared, rounded, [=](real input, real &param, real&, real&)
+            {
+                param += scaled * input;
+            });
+        }
+        break;
+        case ann_optimizer_type::momentum:
+        {
+            real const mu = momentum;
+            update_loop<1>(inputs, params, moments1, moments2, count, shared, rounded, [=](real input, real &param, real &moment1, real&)
+            {
+                real m = mu * moment1 + gradient * input;
+                moment1 = m;
+                param += rate * m;
+            });
+        }
+        break;
+        case ann_optimizer_type::nesterov:
+        {
+            real const mu = momentum;
+            update_loop<1>(inputs, params, moments1, moments2, count, shared, rounded, [=](real input, real &param, real &moment1, real&)
+            {
+                real d = gradient * input;
+                real m = mu * moment1 + d;
+                moment1 = m;
+                param += rate * (d + mu * m);
+            });
+        }
+        break;
+        case ann_optimizer_type::rmsprop:
+        {
+            real const r = rho;
+            real const eps = epsilon;
+            update_loop<1>(inputs, params, moments1, moments2, count, shared, rounded, [=](real input, real &param, real &moment1, real&)
+            {
+                real d = gradient * input;
+                real v = r * moment1 + ((real)1.0 - r) * d * d;
+                moment1 = v;
+                param += rate * d / (std::sqrt(v) + eps);
+            });
+        }
+        break;
+        case ann_optimizer_type::adam:
+        case ann_optimizer_type::adamw:
+        {
+            real const b1 = beta1;
+            real const b2 = beta2;
+            real const eps = epsilon;
+            real const c1 = step.correction1;
+            real const c2 = step.correction2;
+            real const keep = (decay && type == ann_optimizer_type::adamw) ? (real)1.0 - rate * weight_decay : (real)1.0;
+            update_loop<2>(inputs, params, moments1, moments2, count, shared, rounded, [=](real input, real &param, real &moment1, real &moment2)
+            {
+                real d = gradient * input;
+                real m = b1 * moment1 + ((real)1.0 - b1) * d;
+                real v = b2 * moment2 + ((real)1.0 - b2) * d * d;
+                moment1 = m;
+                moment2 = v;
+                param = param * keep + rate * (m * c1) / (std::sqrt(v * c2) + eps);
+            });
+        }
+        break;
+    }
+}
+
+bool prkl::optimizer_type_from_string(std::string const& str, ann_optimizer_type &out_type)
+{
+    if(str == "sgd")
+        out_type = ann_optimizer_type::sgd;
+    else if(str == "momentum")
+        out_type = ann_optimizer_type::momentum;
+    else if(str == "nesterov")
+        out_type = ann_optimizer_type::nesterov;
+    else if(str == "rmsprop")
+        out_type = ann_optimizer_type::rmsprop;
+    else if(str == "adam")
+        out_type = ann_optimizer_type::adam;
+    else if(str == "adamw")
+        out_type = ann_optimizer_type::adamw;
+    else
+        return false;
+
+    return true;
+}
+
+char const* prkl::optimizer_type_to_string(ann_optimizer_type type)
+{
+    switch(type)
+    {
+        default:
+        case ann_optimizer_type::sgd:
+            return "sgd";
+        case ann_optimizer_type::momentum:
+            return "momentum";
+        case ann_optimizer_type::nesterov:
+            return "nesterov";
+        case ann_optimizer_type::rmsprop:
+            return "rmsprop";
+        case ann_optimizer_type::adam:
+            return "adam";
+        case ann_optimizer_type::adamw:
+            return "adamw";
+    }
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "common.hpp"
+#include "half.hpp"
+
+#include <atomic>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace prkl 
+{
+
+    enum class ann_optimizer_type : integer
+    {
+        sgd = 0,
+        momentum,
+        nesterov,
+        rmsprop,
+        adam,
+        adamw
+    };
+
+    /** Per-step constants shared by every parameter update, computed once per training step */
+    struct ann_optimizer_step
+    {
+        real learning_rate{};
+        integer index{}; // global step index, also seeds stochastic rounding
+        real correction1{(real)1.0}; // adam bias correction, 1 / (1 - beta1^t)
+        real correction2{(real)1.0}; // adam bias correction, 1 / (1 - beta2^t)
+    };
+
+    /** 
+     * bf16/fp16 copy of the parameters that an update refreshes in the same pass, stochastically rounded from the new fp32 values.
+     * The noise of parameter j is rounding_noise(noise_seed, j)
+     */
+    struct ann_rounded_copy
+    {
+        uint16_t *bits{nullptr};
+        ann_precision precision{ann_precision::fp32}; // fp32: no copy
+        uint32_t noise_seed{};
+    };
+
+    /** Parameter access of the kernels when only one thread touches the parameters, plain loads and stores that vectorize */
+    struct ann_plain_access
+    {
+        template<typename value_type>
+        static value_type load(value_type const& value) { return value; }
+
+        template<typename value_type>
+        static void store(value_type &target, value_type value) { target = value; }
+    };
+
+    /**
+     * Parameter access of the kernels while hogwild workers update the same parameters concurrently. Relaxed atomics: an update
+     * may still be lost or read half way through a neuron, which hogwild tolerates, but no access is a data race. On x86 they are
+     * the same moves as plain accesses, they only keep the loops from vectorizing, so the kernels move the parameters through
+     * local chunks of chunk_size values and only touch the tail of a row one value at a time
+     */
+    struct ann_shared_access
+    {
+        static constexpr integer chunk_size = 16;
+
+        template<typename value_type>
+        static value_type load(value_type const& value) { return std::atomic_ref<value_type>(const_cast<value_type&>(value)).load(std::memory_order_relaxed); }
+
+        template<typename value_type>
+        static void store(value_type &target, value_type value) { std::atomic_ref<value_type>(target).store(value, std::memory_order_relaxed); }
+
+        template<typename value_type>
+        static void load_chunk(value_type const* shared, value_type *out_values) { copy_chunk(shared, out_values); }
+
+        template<typename value_type>
+        static void store_chunk(value_type *shared, value_type const* values) { copy_chunk(values, shared); }
+
+        /** 
+         * Copies chunk_size values with the widest vector moves the target has. Every value is naturally aligned, so a vector move
+         * never tears one, which is all the relaxed loads and stores promise. A chunk of floats is a single 64 byte move with 
+         * avx512, the loop reading it back then forwards from one store instead of stalling on two halves
+         */
+        template<typename value_type>
+        static void copy_chunk(value_type const* source, value_type *target)
+        {
+            constexpr integer num_bytes = chunk_size * sizeof(value_type);
+            char const* from = reinterpret_cast<char const*>(source);
+            char *to = reinterpret_cast<char*>(target);
+#if defined(__AVX512F__)
+            if constexpr(num_bytes % 64 == 0)
+            {
+                for(integer b = 0; b < num_bytes; b += 64)
+                    _mm512_storeu_si512(to + b, _mm512_loadu_si512(from + b));
+                return;
+            }
+#endif
+#if defined(__AVX__)
+            if constexpr(num_bytes % 32 == 0)
+            {
+                for(integer b = 0; b < num_bytes; b += 32)
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + b), _mm256_loadu_si256(reinterpret_cast<__m256i const*>(from + b)));
+                return;
+            }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+            if constexpr(num_bytes % 16 == 0)
+            {
+                for(integer b = 0; b < num_bytes; b += 16)
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(to + b), _mm_loadu_si128(reinterpret_cast<__m128i const*>(from + b)));
+                return;
+            }
+#endif
+            for(integer k = 0; k < chunk_size; k++)
+                store(target[k], load(source[k]));
+        }
+
+        /** Relaxed copy of count values of any length, whole chunks first */
+        template<typename value_type>
+        static void copy(value_type const* source, value_type *target, integer count)
+        {
+            integer k = 0;
+            for(; k + chunk_size <= count; k += chunk_size)
+                copy_chunk(source + k, target + k);
+            for(; k < count; k++)
+                store(target[k], load(source[k]));
+        }
+    };
+
+    /** Update rule used by update_weights. The per-parameter state lives in the layers, next to the weights */
+    struct ann_optimizer
+    {
+        ann_optimizer()=default;
+        ann_optimizer(nlohmann::json &cfg);
+
+        /** Number of per-parameter state arrays this optimizer needs (0, 1 or 2) */
+        integer num_moments() const;
+
+        ann_optimizer_step step(real learning_rate, integer step_index) const;
+
+        /** 
+         * Fused update of count parameters, where the descent direction of parameter j is gradient * inputs[j].
+         * moments1/moments2 must hold count values each if num_moments() says so. decay enables decoupled weight decay (adamw).
+         * shared loads and stores the parameters and moments through ann_shared_access, for hogwild workers. rounded, if it has a
+         * precision other than fp32, receives the reduced precision copy of the updated parameters.
+         */
+        void update(ann_optimizer_step const& step, real gradient, real const* inputs, real *params, real *moments1, real *moments2, integer count, bool decay, bool shared, ann_rounded_copy const& rounded = {}) const;
+
+        ann_optimizer_type type{ann_optimizer_type::sgd};
+        real momentum{(real)0.9};
+        real rho{(real)0.9};
+        real beta1{(real)0.9};
+        real beta2{(real)0.999};
+        real epsilon{(real)1e-8};
+        real weight_decay{(real)0.01};
+    };
+
+    bool optimizer_type_from_string(std::string const& str, ann_optimizer_type &out_type);
+    char const* optimizer_type_to_string(ann_optimizer_type type);
+}
@@ -0,0 +1,72 @@
+
+#include "publication.hpp"
+#include "model.hpp"
+
+prkl::ann_model_publisher::read_guard::read_guard(std::atomic<uint64_t> &in_reader_epoch, ann_model const* in_model)
+    : reader_epoch(in_reader_epoch)
+    , held_model(in_model)
+{
+}
+
+prkl::ann_model_publisher::read_guard::~read_guard()
+{
+    reader_epoch.store(0, std::memory_order_release);
+}
+
+prkl::ann_model_publisher::ann_model_publisher(integer max_readers, std::unique_ptr<ann_model> model)
+    : current(model.release())
+    , readers(new reader_state[max_readers])
+    , num_readers(max_readers)
+{
+}
+
+prkl::ann_model_publisher::~ann_model_publisher()
+{
+    delete current.load();
+    for(retired_model const& old : retired)
+        delete old.model;
+}
+
+prkl::ann_model_publisher::read_guard prkl::ann_model_publisher::read(integer reader_index) const
+{
+    assert(reader_index < num_readers && "reader index out of range");
+    std::atomic<uint64_t> &reader_epoch = readers[reader_index].epoch;
+
+    // the announcement has to be visible before the pointer is loaded, publish relies on that order (seq_cst store, then load)
+    reader_epoch.store(epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    return read_guard(reader_epoch, current.load(std::memory_order_seq_cst));
+}
+
+void prkl::ann_model_publisher::publish(std::unique_ptr<ann_model> model)
+{
+    std::lock_guard<std::mutex> lock(publish_mutex);
+
+    // a reader that announced an older epoch may have loaded the old pointer, one that announced the new epoch or later can't have
+    ann_model *old = current.exchange(model.release(), std::memory_order_seq_cst);
+    uint64_t new_epoch = epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    retired.push_back({ old, new_epoch });
+}
+
+prkl::integer prkl::ann_model_publisher::reclaim()
+{
+    std::lock_guard<std::mutex> lock(publish_mutex);
+    if(retired.empty())
+        return 0;
+
+    uint64_t oldest_reader = std::numeric_limits<uint64_t>::max();
+    for(integer reader_index = 0; reader_index < num_readers; reader_index++)
+    {
+        uint64_t reader_epoch = readers[reader_index].epoch.load(std::memory_order_seq_cst);
+        if(reader_epoch != 0)
+            oldest_reader = std::min(oldest_reader, reader_epoch);
+    }
+
+    std::erase_if(retired, [oldest_reader](retired_model const& old)
+    {
+        if(oldest_reader < old.epoch)
+            return false;
+        delete old.model;
+        return true;
+    });
+    return retired.size();
+}
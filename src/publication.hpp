@@ -0,0 +1,71 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace prkl
+{
+
+    struct ann_model;
+
+    /**
+     * Publishes a model to concurrent readers and swaps in new ones while they read, with epoch-based reclamation. A reader
+     * announces the epoch it starts in and then loads the current model, publishing swaps the pointer and starts a new epoch,
+     * and a replaced model is deleted once every reader has either finished or started in a later epoch, so inferences in
+     * flight finish on the weights they started with. Reading takes no lock: one store to the reader's own cache line on the
+     * way in and one on the way out. Readers have fixed indices, each index reads on one thread at a time without nesting
+     */
+    struct ann_model_publisher
+    {
+        /** The model a reader holds, valid as long as the guard lives */
+        struct read_guard
+        {
+            read_guard(std::atomic<uint64_t> &in_reader_epoch, ann_model const* in_model);
+            read_guard(read_guard const&)=delete;
+            read_guard& operator=(read_guard const&)=delete;
+            ~read_guard();
+
+            ann_model const& model() const { return *held_model; }
+
+            std::atomic<uint64_t> &reader_epoch;
+            ann_model const* held_model;
+        };
+
+        ann_model_publisher(integer max_readers, std::unique_ptr<ann_model> model);
+        ann_model_publisher(ann_model_publisher const&)=delete;
+        ann_model_publisher& operator=(ann_model_publisher const&)=delete;
+        /** Deletes the current and every retired model, no reader may still be reading */
+        ~ann_model_publisher();
+
+        read_guard read(integer reader_index) const;
+
+        /** Makes model the current one for every read that starts from now on and retires the previous one, reclaim deletes it later */
+        void publish(std::unique_ptr<ann_model> model);
+
+        /** Deletes the retired models no reader can hold anymore, returns how many are still waiting for a reader */
+        integer reclaim();
+
+        struct alignas(64) reader_state
+        {
+            std::atomic<uint64_t> epoch{0}; // the epoch the reader started in, 0 while it isn't reading
+        };
+
+        struct retired_model
+        {
+            ann_model *model;
+            uint64_t epoch; // the first epoch whose readers can't see it
+        };
+
+        std::atomic<ann_model*> current{nullptr};
+        std::atomic<uint64_t> epoch{1};
+        std::unique_ptr<reader_state[]> readers;
+        integer num_readers{0};
+
+        std::mutex publish_mutex; // publishers and reclaim only, readers never take it
+        std::vector<retired_model> retired;
+    };
+
+}
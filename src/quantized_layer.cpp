@@ -0,0 +1,512 @@
+
+#include "quantized_layer.hpp"
+
+#include <iostream>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    constexpr prkl::integer kernel_width = 32;
+    constexpr int32_t max_input_code = 127;
+    constexpr int32_t max_weight_code = 127;
+
+#if defined(__AVX2__)
+    /** Multiply-adds 32 unsigned 7 bit inputs with 32 signed weights into the 8 int32 lanes of the accumulator */
+    inline __m256i multiply_add(__m256i accumulator, __m256i x, __m256i w)
+    {
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+        return _mm256_dpbusd_epi32(accumulator, x, w);
+#elif defined(__AVXVNNI__)
+        return _mm256_dpbusd_avx_epi32(accumulator, x, w);
+#else
+        // pairs of u8 * s8 products summed to s16, at most 2 * 127 * 127 so it never saturates
+        __m256i pairs = _mm256_maddubs_epi16(x, w);
+        return _mm256_add_epi32(accumulator, _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+#endif
+    }
+
+    inline int32_t horizontal_sum(__m256i accumulator)
+    {
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(accumulator), _mm256_extracti128_si256(accumulator, 1));
+        sum = _mm_hadd_epi32(sum, sum);
+        sum = _mm_hadd_epi32(sum, sum);
+        return _mm_cvtsi128_si32(sum);
+    }
+
+    inline __m256i load(void const* p)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+    }
+#endif
+
+    /** 
+     * Dot products of one weight row with num_samples (at most 4) rows of input codes, stride bytes apart. The weights are loaded 
+     * once for all samples. Counts are multiples of kernel_width, all products are exact so every path gives the same integers
+     */
+    void dot_u8s8(uint8_t const* inputs, prkl::integer stride, prkl::integer num_samples, int8_t const* weights, prkl::integer count, int32_t *out_sums)
+    {
+#if defined(__AVX2__)
+        if(num_samples == 4)
+        {
+            __m256i a0 = _mm256_setzero_si256(), a1 = a0, a2 = a0, a3 = a0;
+            for(prkl::integer i = 0; i < count; i += kernel_width)
+            {
+                __m256i w = load(weights + i);
+                a0 = multiply_add(a0, load(inputs + i), w);
+                a1 = multiply_add(a1, load(inputs + stride + i), w);
+                a2 = multiply_add(a2, load(inputs + 2 * stride + i), w);
+                a3 = multiply_add(a3, load(inputs + 3 * stride + i), w);
+            }
+            out_sums[0] = horizontal_sum(a0);
+            out_sums[1] = horizontal_sum(a1);
+            out_sums[2] = horizontal_sum(a2);
+            out_sums[3] = horizontal_sum(a3);
+            return;
+        }
+
+        for(prkl::integer b = 0; b < num_samples; b++)
+        {
+            __m256i accumulator = _mm256_setzero_si256();
+            for(prkl::integer i = 0; i < count; i += kernel_width)
+            {
+                accumulator = multiply_add(accumulator, load(inputs + b * stride + i), load(weights + i));
+            }
+            out_sums[b] = horizontal_sum(accumulator);
+        }
+#else
+        for(prkl::integer b = 0; b < num_samples; b++)
+        {
+            uint8_t const* sample_inputs = inputs + b * stride;
+            int32_t sum = 0;
+            #pragma omp simd reduction(+:sum)
+            for(prkl::integer i = 0; i < count; i++)
+            {
+                sum += int32_t(sample_inputs[i]) * int32_t(weights[i]);
+            }
+            out_sums[b] = sum;
+        }
+#endif
+    }
+}
+
+void prkl::ann_quantization_range::observe(real const* values, integer count)
+{
+    for(integer i = 0; i < count; i++)
+    {
+        min = std::min(min, values[i]);
+        max = std::max(max, values[i]);
+    }
+}
+
+void prkl::ann_quantization_range::merge(ann_quantization_range const& other)
+{
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+}
+
+prkl::real prkl::ann_quantization_range::scale() const
+{
+    return std::max(max - min, std::numeric_limits<real>::min()) / real(max_input_code);
+}
+
+int32_t prkl::ann_quantization_range::zero_point() const
+{
+    // asymmetric inputs, zero maps to an integer code so padding and exact zeros stay exact
+    return std::clamp(int32_t(std::lround(-min / scale())), 0, max_input_code);
+}
+
+void prkl::ann_quantization_range::fake_quantize(real *values, integer count) const
+{
+    real input_scale = scale();
+    real inverse_scale = 1.0f / input_scale;
+    real zero_point = real(this->zero_point());
+    #pragma omp simd
+    for(integer i = 0; i < count; i++)
+    {
+        real code = std::clamp(values[i] * inverse_scale + zero_point, 0.0f, real(max_input_code));
+        values[i] = (real(int32_t(code + 0.5f)) - zero_point) * input_scale;
+    }
+}
+
+prkl::real prkl::weight_scale(real const* weights, integer count)
+{
+    real max_magnitude = 0.0f;
+    #pragma omp simd reduction(max:max_magnitude)
+    for(integer i = 0; i < count; i++)
+    {
+        max_magnitude = std::max(max_magnitude, std::abs(weights[i]));
+    }
+    return max_magnitude > 0.0f ? max_magnitude / real(max_weight_code) : 1.0f;
+}
+
+prkl::ann_quantized_layer::ann_quantized_layer(ann_dense_layer const& dense, ann_quantization_range const& range)
+{
+    activation_func = dense.activation_func;
+    leaky_alpha = dense.leaky_alpha;
+    grad_limit = dense.grad_limit;
+    frozen = true;
+
+    num_neurons = dense.num_neurons;
+    num_inputs = dense.num_inputs;
+    num_padded_inputs = (num_inputs + kernel_width - 1) / kernel_width * kernel_width;
+    activations.assign(dense.activations, dense.activations + num_neurons);
+    if(num_inputs == 0)
+        return;
+
+    input_scale = range.scale();
+    input_zero_point = range.zero_point();
+
+    biases.assign(dense.biases, dense.biases + num_neurons);
+    weight_scales.resize(num_neurons);
+    weight_sums.resize(num_neurons);
+    weights.assign(num_neurons * num_padded_inputs, 0);
+
+    for(integer n = 0; n < num_neurons; n++)
+    {
+        // symmetric per neuron scales, a single large weight only costs its own row precision
+        real const* neuron_weights = dense.get_weights_array(n);
+        weight_scales[n] = weight_scale(neuron_weights, num_inputs);
+        real inverse_scale = 1.0f / weight_scales[n];
+        int8_t *codes = weights.data() + n * num_padded_inputs;
+        int32_t sum = 0;
+        for(integer i = 0; i < num_inputs; i++)
+        {
+            codes[i] = quantize_weight(neuron_weights[i], inverse_scale);
+            sum += codes[i];
+        }
+        weight_sums[n] = sum;
+    }
+}
+
+prkl::ann_quantized_layer::ann_quantized_layer(std::ifstream &file, ann_model_version)
+{
+    frozen = true;
+    activation_func = (ann_activation)read_uint64_be(file);
+    leaky_alpha = read_float_be(file);
+
+    // The kernels trust the zero point to be a 7 bit code and the row sums to fit an int32, so a corrupt or truncated file fails
+    // the load here. The stream is marked failed, which makes the model discard the layer, and the layer is left empty.
+    auto fail = [&](char const* reason)
+    {
+        std::cerr << "invalid quantized layer, " << reason << std::endl;
+        file.setstate(std::ios::failbit);
+        num_neurons = 0;
+        num_inputs = 0;
+        num_padded_inputs = 0;
+        activations.clear();
+        biases.clear();
+        weight_scales.clear();
+        weight_sums.clear();
+        weights.clear();
+    };
+
+    num_neurons = read_uint64_be(file);
+    num_inputs = read_uint64_be(file);
+    if(!file || num_inputs > max_inputs || num_neurons > UINT32_MAX || num_neurons * (2 * sizeof(real) + num_inputs) > remaining_bytes(file))
+    {
+        fail("its size exceeds the file or the int32 accumulator");
+        return;
+    }
+
+    num_padded_inputs = (num_inputs + kernel_width - 1) / kernel_width * kernel_width;
+    activations.assign(num_neurons, 0.0f);
+    if(num_inputs == 0)
+        return;
+
+    input_scale = read_float_be(file);
+    uint64_t zero_point = read_uint64_be(file);
+    if(!file || !(input_scale > 0.0f && std::isfinite(input_scale)) || zero_point > uint64_t(max_input_code))
+    {
+        fail("its input scale or zero point is out of range");
+        return;
+    }
+    input_zero_point = int32_t(zero_point);
+
+    biases.resize(num_neurons);
+    weight_scales.resize(num_neurons);
+    weight_sums.resize(num_neurons);
+    weights.assign(num_neurons * num_padded_inputs, 0);
+
+    for(integer n = 0; n < num_neurons; n++)
+    {
+        biases[n] = read_float_be(file);
+        weight_scales[n] = read_float_be(file);
+        if(!(weight_scales[n] > 0.0f && std::isfinite(weight_scales[n])))
+        {
+            fail("a weight scale is out of range");
+            return;
+        }
+    }
+
+    for(integer n = 0; n < num_neurons; n++)
+    {
+        int8_t *codes = weights.data() + n * num_padded_inputs;
+        file.read(reinterpret_cast<char*>(codes), num_inputs);
+
+        int32_t sum = 0;
+        for(integer i = 0; i < num_inputs; i++)
+        {
+            if(codes[i] < -max_weight_code)
+            {
+                fail("a weight code is out of range");
+                return;
+            }
+            sum += codes[i];
+        }
+        weight_sums[n] = sum;
+    }
+
+    if(!file)
+    {
+        fail("the file is truncated");
+        return;
+    }
+}
+
+void prkl::ann_quantized_layer::write(std::ofstream &file)
+{
+    write_uint64_be(file, (uint64_t)ann_layer_type::quantized);
+
+    write_uint64_be(file, (uint64_t)activation_func);
+    write_float_be(file, leaky_alpha);
+
+    write_uint64_be(file, num_neurons);
+    write_uint64_be(file, num_inputs);
+    if(num_inputs == 0)
+        return;
+
+    write_float_be(file, input_scale);
+    write_uint64_be(file, input_zero_point);
+
+    for(integer n = 0; n < num_neurons; n++)
+    {
+        write_float_be(file, biases[n]);
+        write_float_be(file, weight_scales[n]);
+    }
+
+    // single bytes have no byte order, the rows are written without their padding
+    for(integer n = 0; n < num_neurons; n++)
+    {
+        file.write(reinterpret_cast<char const*>(weights.data() + n * num_padded_inputs), num_inputs);
+    }
+}
+
+void prkl::ann_quantized_layer::quantize_inputs(real const* inputs, uint8_t *out_codes) const
+{
+    // clamped before rounding, so truncating code + 0.5 rounds the non-negative codes to nearest and the loop vectorizes
+    real inverse_scale = 1.0f / input_scale;
+    real zero_point = real(input_zero_point);
+    #pragma omp simd
+    for(integer i = 0; i < num_inputs; i++)
+    {
+        real code = std::clamp(inputs[i] * inverse_scale + zero_point, 0.0f, real(max_input_code));
+        out_codes[i] = uint8_t(int32_t(code + 0.5f));
+    }
+    std::fill(out_codes + num_inputs, out_codes + num_padded_inputs, uint8_t(input_zero_point));
+}
+
+prkl::integer prkl::ann_quantized_layer::min_activation_index() const
+{
+    return std::min_element(activations.begin(), activations.end()) - activations.begin();
+}
+
+prkl::integer prkl::ann_quantized_layer::max_activation_index() const
+{
+    return std::max_element(activations.begin(), activations.end()) - activations.begin();
+}
+
+prkl::ann_layer_base *prkl::ann_quantized_layer::clone() const
+{
+    return new ann_quantized_layer(*this);
+}
+
+prkl::integer prkl::ann_quantized_layer::num_parameters() const
+{
+    return 0;
+}
+
+void prkl::ann_quantized_layer::read_parameters(real *) const
+{
+}
+
+void prkl::ann_quantized_layer::write_parameters(real const*)
+{
+}
+
+prkl::integer prkl::ann_quantized_layer::num_activations() const
+{
+    return num_neurons;
+}
+
+prkl::real prkl::ann_quantized_layer::get_activation(integer activation_index) const
+{
+    assert(activation_index < num_neurons && "activation index out of range");
+    return activations[activation_index];
+}
+
+void prkl::ann_quantized_layer::set_activation(integer activation_index, real new_activation)
+{
+    assert(activation_index < num_neurons && "activation index out of range");
+    activations[activation_index] = new_activation;
+}
+
+void prkl::ann_quantized_layer::forward(ann_layer_base const* prev_layer)
+{
+    forward(prev_layer->get_activations_array(), activations.data());
+}
+
+void prkl::ann_quantized_layer::forward(real const* prev_activations, real *out_activations) const
+{
+    forward_batch(prev_activations, out_activations, 1);
+}
+
+void prkl::ann_quantized_layer::forward_batch(real const* prev_activations, real *out_activations, integer batch) const
+{
+    if(num_inputs == 0)
+        return;
+
+    // grows once per thread to the widest layer and batch, and is reused after that
+    thread_local std::vector<uint8_t> codes;
+    if(codes.size() < batch * num_padded_inputs)
+        codes.resize(batch * num_padded_inputs);
+
+    for(integer b = 0; b < batch; b++)
+    {
+        quantize_inputs(prev_activations + b * num_inputs, codes.data() + b * num_padded_inputs);
+    }
+
+    // four samples at a time share every load of a weight row
+    constexpr integer tile = 4;
+    for(integer first = 0; first < batch; first += tile)
+    {
+        integer num_samples = std::min(tile, batch - first);
+        uint8_t const* tile_codes = codes.data() + first * num_padded_inputs;
+        for(integer n = 0; n < num_neurons; n++)
+        {
+            int32_t sums[tile];
+            dot_u8s8(tile_codes, num_padded_inputs, num_samples, weights.data() + n * num_padded_inputs, num_padded_inputs, sums);
+
+            // sum((x - zero_point) * w) = sum(x * w) - zero_point * sum(w)
+            real scale = input_scale * weight_scales[n];
+            int32_t offset = input_zero_point * weight_sums[n];
+            for(integer b = 0; b < num_samples; b++)
+            {
+                real sum = real(sums[b] - offset) * scale + biases[n];
+                out_activations[(first + b) * num_neurons + n] = activation(this, sum);
+            }
+        }
+    }
+}
+
+void prkl::ann_quantized_layer::apply_softmax()
+{
+    apply_softmax(activations.data());
+}
+
+void prkl::ann_quantized_layer::apply_softmax(real *inout_activations) const
+{
+    softmax(inout_activations, num_neurons);
+}
+
+void prkl::ann_quantized_layer::gradients_from_expected_output(ann_evaluation_type evaluation_type, ann_loss_function loss_function, std::vector<real> const& expected_output, ann_gradients &out_gradients, real &out_loss) const
+{
+    if(num_inputs == 0)
+        return;
+
+    out_gradients.resize(num_neurons);
+    gradients_from_expected_output(evaluation_type, loss_function, activations.data(), expected_output, out_gradients.data(), out_loss);
+}
+
+void prkl::ann_quantized_layer::gradients_from_expected_output(ann_evaluation_type evaluation_type, ann_loss_function loss_function, real const* in_activations, std::vector<real> const& expected_output, real *out_gradients, real &out_loss) const
+{
+    if(num_inputs == 0)
+        return;
+
+    output_gradients(this, evaluation_type, loss_function, in_activations, expected_output, out_gradients, out_loss);
+}
+
+void prkl::ann_quantized_layer::gradients_backpropagate(ann_gradients const& next_gradients, ann_layer_base *next_layer, ann_gradients &out_gradients) const
+{
+    if(num_inputs == 0)
+        return;
+
+    out_gradients.resize(num_neurons);
+    gradients_backpropagate(activations.data(), next_gradients.data(), next_layer, out_gradients.data());
+}
+
+void prkl::ann_quantized_layer::gradients_backpropagate(real const* in_activations, real const* next_gradients, ann_layer_base const* next_layer, real *out_gradients) const
+{
+    if(num_inputs == 0)
+        return;
+
+    hidden_gradients(this, in_activations, next_gradients, next_layer, out_gradients);
+}
+
+void prkl::ann_quantized_layer::gradients_to_inputs(real const* gradients, real *out_input_gradients) const
+{
+    if(num_inputs == 0)
+        return;
+
+    // through the dequantized weights, so layers in front of a quantized one can still be trained
+    std::fill(out_input_gradients, out_input_gradients + num_inputs, (real)0.0);
+    for(integer n = 0; n < num_neurons; n++)
+    {
+        real gradient = gradients[n] * weight_scales[n];
+        int8_t const* codes = weights.data() + n * num_padded_inputs;
+        for(integer i = 0; i < num_inputs; i++)
+        {
+            out_input_gradients[i] += gradient * real(codes[i]);
+        }
+    }
+}
+
+// a quantized layer is always frozen, training skips it and never updates its weights
+
+void prkl::ann_quantized_layer::update_weights(ann_gradients const&, ann_layer_base const*, real)
+{
+    assert(false && "can't update the weights of a quantized layer");
+}
+
+void prkl::ann_quantized_layer::update_weights(real const*, real const*, ann_optimizer const&, ann_optimizer_step const&)
+{
+    assert(false && "can't update the weights of a quantized layer");
+}
+
+void prkl::ann_quantized_layer::update_neurons(real const*, real const*, ann_optimizer const&, ann_optimizer_step const&, integer, integer)
+{
+    assert(false && "can't update the weights of a quantized layer");
+}
+
+void prkl::ann_quantized_layer::prepare_optimizer(ann_optimizer const&)
+{
+}
+
+void prkl::ann_quantized_layer::set_precision(ann_precision)
+{
+}
+
+prkl::integer prkl::ann_quantized_layer::num_training_state() const
+{
+    return 0;
+}
+
+void prkl::ann_quantized_layer::read_training_state(real *) const
+{
+}
+
+void prkl::ann_quantized_layer::write_training_state(real const*)
+{
+}
+
+prkl::real* prkl::ann_quantized_layer::get_weights_array(integer) const
+{
+    return nullptr;
+}
+
+prkl::real* prkl::ann_quantized_layer::get_activations_array() const
+{
+    return const_cast<real*>(activations.data());
+}
@@ -0,0 +1,109 @@
+
+#pragma once
+
+#include "layer.hpp"
+
+namespace prkl
+{
+
+    /** Range of the inputs of a layer, observed over a calibration set */
+    struct ann_quantization_range
+    {
+        void observe(real const* values, integer count);
+        void merge(ann_quantization_range const& other);
+
+        /** Step between two of the 7 bit input codes */
+        real scale() const;
+        /** The code that represents 0.0 */
+        int32_t zero_point() const;
+        /** Rounds values to the nearest code and back, exactly as a quantized layer sees its inputs. For quantization-aware training */
+        void fake_quantize(real *values, integer count) const;
+
+        real min{0.0f}; // both ends start at zero, so zero is always exactly representable
+        real max{0.0f};
+    };
+
+    /** Symmetric scale of a row of weights, so its largest magnitude maps to 127 */
+    real weight_scale(real const* weights, integer count);
+
+    /** 
+     * Rounds half away from zero with a truncating conversion, which vectorizes where nearbyint is a library call. The clamp is on
+     * the integer, a float clamp in front of the conversion keeps the loop from vectorizing. inverse_scale comes from weight_scale of
+     * the same row, so the product never leaves the int32 range 
+     */
+    inline int8_t quantize_weight(real weight, real inverse_scale)
+    {
+        real code = weight * inverse_scale;
+        return int8_t(std::min(std::max(int32_t(code + std::copysign(0.5f, code)), -127), 127));
+    }
+
+    /**
+     * Fully connected layer for int8 inference. Weights are symmetric int8 with one scale per neuron, inputs are quantized on the
+     * fly to unsigned 7 bit codes with a scale and zero point calibrated per layer, and the products accumulate in int32. The 7 bit
+     * inputs keep the pairwise sums of maddubs from ever saturating, so every kernel computes exactly the same integers.
+     * Outputs are dequantized, so quantized and fp32 layers mix freely. There is nothing to train: the layer is always frozen
+     */
+    struct ann_quantized_layer : public ann_layer_base
+    {
+        /** Quantizes the weights of a dense layer, range is what the layer's inputs were calibrated to */
+        ann_quantized_layer(ann_dense_layer const& dense, ann_quantization_range const& range);
+        ann_quantized_layer(std::ifstream &file, ann_model_version version);
+        virtual ~ann_quantized_layer()=default;
+        virtual void write(std::ofstream &file) override;
+
+        virtual integer min_activation_index() const override;
+        virtual integer max_activation_index() const override;
+
+        virtual ann_layer_base *clone() const override;
+        virtual integer num_parameters() const override;
+        virtual void read_parameters(real *out_parameters) const override;
+        virtual void write_parameters(real const* parameters) override;
+        virtual integer num_activations() const override;
+        virtual real get_activation(integer activation_index) const override;
+        virtual void set_activation(integer activation_index, real new_activation) override;
+
+        virtual void forward(ann_layer_base const*prev_layer) override;
+        virtual void apply_softmax() override;
+        virtual void gradients_from_expected_output(ann_evaluation_type evaluation_type, ann_loss_function loss_function, std::vector<real> const& expected_output, ann_gradients &out_gradients, real &out_loss) const override;
+        virtual void gradients_backpropagate(ann_gradients const& next_gradients, ann_layer_base *next_layer,  ann_gradients &out_gradients) const override;
+        virtual void update_weights(ann_gradients const &layer_gradients, ann_layer_base const* prev_layer, real learning_rate) override;
+
+        virtual void forward(real const* prev_activations, real *out_activations) const override;
+        virtual void forward_batch(real const* prev_activations, real *out_activations, integer batch) const override;
+        virtual void apply_softmax(real *inout_activations) const override;
+        virtual void gradients_from_expected_output(ann_evaluation_type evaluation_type, ann_loss_function loss_function, real const* in_activations, std::vector<real> const& expected_output, real *out_gradients, real &out_loss) const override;
+        virtual void gradients_backpropagate(real const* in_activations, real const* next_gradients, ann_layer_base const* next_layer, real *out_gradients) const override;
+        virtual void update_weights(real const* layer_gradients, real const* prev_activations, ann_optimizer const& optimizer, ann_optimizer_step const& step) override;
+        virtual void update_neurons(real const* layer_gradients, real const* prev_activations, ann_optimizer const& optimizer, ann_optimizer_step const& step, integer first_neuron, integer end_neuron) override;
+        virtual void prepare_optimizer(ann_optimizer const& optimizer) override;
+        virtual void gradients_to_inputs(real const* gradients, real *out_input_gradients) const override;
+        virtual void set_precision(ann_precision precision) override;
+        virtual integer num_training_state() const override;
+        virtual void read_training_state(real *out_state) const override;
+        virtual void write_training_state(real const* state) override;
+
+        /** There are no fp32 weights to hand out, always nullptr */
+        virtual real* get_weights_array(integer neuron_index) const override;
+        virtual real* get_activations_array() const override;
+
+        /** Most inputs a neuron can have before the int32 accumulator and its zero point correction could overflow, wider layers stay fp32 */
+        static constexpr integer max_inputs = INT32_MAX / (2 * 127 * 127);
+
+        /** Quantizes one sample of inputs into num_padded_inputs codes, the padding gets the zero point */
+        void quantize_inputs(real const* inputs, uint8_t *out_codes) const;
+
+        integer num_neurons{0};
+        integer num_inputs{0};
+        integer num_padded_inputs{0}; // num_inputs rounded up to the 32 byte kernel width, the padding weights are zero
+
+        real input_scale{1.0f};
+        int32_t input_zero_point{0};
+
+        std::vector<real> activations; // num_neurons
+        std::vector<real> biases; // num_neurons, kept in fp32 and added after dequantization
+        std::vector<real> weight_scales; // num_neurons
+        std::vector<int32_t> weight_sums; // num_neurons, sum of each row, removes the input zero point from the accumulator
+        std::vector<int8_t> weights; // num_neurons * num_padded_inputs, row-major
+    };
+
+}
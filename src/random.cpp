@@ -0,0 +1,10 @@
+#include "random.hpp"
+
+uint64_t prkl::nondeterministic_seed()
+{
+    std::random_device device;
+    uint64_t seed = (uint64_t(device()) << 32) | uint64_t(device());
+
+    // 0 means "no seed" in the settings
+    return seed != 0 ? seed : 1;
+}
@@ -0,0 +1,68 @@
+
+#pragma once
+
+#include "common.hpp"
+
+namespace prkl
+{
+
+    /** Independent consumers of randomness, each gets its own streams so adding one never shifts what another one draws */
+    enum class ann_random_purpose : integer
+    {
+        weights = 1,
+        shuffle,
+        dropout,
+        augmentation
+    };
+
+    /** SplitMix64 finalizer (Steele, Lea, Flood), a bijective 64 bit mix */
+    inline uint64_t splitmix64(uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    /**
+     * Counter-based random stream. Value n of a stream is a pure function of (seed, stream, n), so streams share no state,
+     * any thread can draw any position, and results never depend on the thread count.
+     * Satisfies UniformRandomBitGenerator, so it also works with the std distributions and std::shuffle.
+     */
+    struct ann_random_stream
+    {
+        using result_type = uint64_t;
+
+        ann_random_stream(uint64_t seed, ann_random_purpose purpose, uint64_t stream, uint64_t in_counter = 0)
+            : key(splitmix64(seed ^ splitmix64(((uint64_t)purpose << 56) ^ stream)))
+            , counter(in_counter)
+        {
+        }
+
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return ~0ull; }
+
+        result_type operator()() { return at(counter++); }
+
+        /** Value at a position of the stream, without advancing it */
+        result_type at(uint64_t index) const
+        {
+            return splitmix64(key + index * 0x9e3779b97f4a7c15ull);
+        }
+
+        /** Uniform in [lo, hi), from the top 24 bits so every value is exactly representable */
+        real uniform_at(uint64_t index, real lo, real hi) const
+        {
+            real unit = real(at(index) >> 40) * ((real)1.0 / (real)16777216.0);
+            return lo + (hi - lo) * unit;
+        }
+
+        real uniform(real lo, real hi) { return uniform_at(counter++, lo, hi); }
+
+        uint64_t key;
+        uint64_t counter;
+    };
+
+    /** A fresh seed from std::random_device, for runs that don't ask for a reproducible one */
+    uint64_t nondeterministic_seed();
+
+}
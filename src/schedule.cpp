@@ -0,0 +1,288 @@
+#include "schedule.hpp"
+
+#include <sstream>
+#include <charconv>
+
+prkl::ann_schedule_policy::ann_schedule_policy(nlohmann::json &cfg)
+{
+    if(cfg.contains("type"))
+    {
+        std::string type_str = cfg.at("type").template get<std::string>();
+        if(!schedule_type_from_string(type_str, type))
+            std::cerr << "unrecognized schedule policy: " << type_str << std::endl;
+        std::cout << "model config: schedule policy: " << schedule_type_to_string(type) << std::endl;
+    }
+
+    if(cfg.contains("epochs"))
+        epochs = cfg.at("epochs").template get<prkl::real>();
+    if(cfg.contains("period"))
+        period = cfg.at("period").template get<prkl::real>();
+    if(cfg.contains("period_mult"))
+        period_mult = cfg.at("period_mult").template get<prkl::real>();
+    if(cfg.contains("factor"))
+        factor = cfg.at("factor").template get<prkl::real>();
+    if(cfg.contains("min_factor"))
+        min_factor = cfg.at("min_factor").template get<prkl::real>();
+    if(cfg.contains("pct_start"))
+        pct_start = cfg.at("pct_start").template get<prkl::real>();
+    if(cfg.contains("div_factor"))
+        div_factor = cfg.at("div_factor").template get<prkl::real>();
+    if(cfg.contains("final_div_factor"))
+        final_div_factor = cfg.at("final_div_factor").template get<prkl::real>();
+    if(cfg.contains("patience"))
+        patience = cfg.at("patience").template get<prkl::integer>();
+
+    if(!validate())
+    {
+        ann_schedule_type policy_type = type;
+        *this = ann_schedule_policy();
+        type = policy_type;
+        std::cerr << "using the default parameters for schedule policy " << schedule_type_to_string(type) << std::endl;
+    }
+}
+
+bool prkl::ann_schedule_policy::validate() const
+{
+    // written as negated ranges so NaN fails them too
+    auto positive = [](real value) { return value > (real)0.0 && std::isfinite(value); };
+
+    bool valid = true;
+    if((type == ann_schedule_type::step || type == ann_schedule_type::cosine) && !positive(period))
+    {
+        std::cerr << "schedule policy " << schedule_type_to_string(type) << " needs a positive period, got " << period << std::endl;
+        valid = false;
+    }
+
+    if(type == ann_schedule_type::one_cycle)
+    {
+        if(!positive(div_factor) || !positive(final_div_factor))
+        {
+            std::cerr << "schedule policy one_cycle needs a positive div_factor and final_div_factor, got " << div_factor << " and " << final_div_factor << std::endl;
+            valid = false;
+        }
+        if(!(pct_start >= (real)0.0 && pct_start <= (real)1.0))
+        {
+            std::cerr << "schedule policy one_cycle needs a pct_start between 0 and 1, got " << pct_start << std::endl;
+            valid = false;
+        }
+    }
+
+    if(type == ann_schedule_type::plateau && patience < 1)
+    {
+        std::cerr << "schedule policy plateau needs a patience of at least 1 epoch, got " << patience << std::endl;
+        valid = false;
+    }
+
+    if(type == ann_schedule_type::cosine && period_mult < (real)1.0)
+        std::cerr << "warning: cosine period_mult " << period_mult << " is below 1, the schedule never restarts" << std::endl;
+
+    return valid;
+}
+
+prkl::real prkl::ann_schedule_policy::factor_at(real epoch, integer total, ann_settings const& settings) const
+{
+    switch(type)
+    {
+        default:
+        case ann_schedule_type::adaptive:
+            if(std::isinf(last_loss))
+                return (real)1.0;
+            return adaptive_learning_rate(settings, last_loss) / settings.base_rate;
+
+        case ann_schedule_type::warmup:
+            if(epochs <= (real)0.0 || epoch >= epochs)
+                return (real)1.0;
+            return min_factor + ((real)1.0 - min_factor) * epoch / epochs;
+
+        case ann_schedule_type::step:
+            return std::pow(factor, std::floor(epoch / period));
+
+        case ann_schedule_type::cosine:
+        {
+            // find the cycle this epoch falls in, each restart scales the period by period_mult
+            real cycle_start = (real)0.0;
+            real cycle_length = period;
+            if(period_mult == (real)1.0)
+                cycle_start = std::floor(epoch / period) * period;
+            while(epoch >= cycle_start + cycle_length && period_mult > (real)1.0)
+            {
+                cycle_start += cycle_length;
+                cycle_length *= period_mult;
+            }
+            real t = std::clamp((epoch - cycle_start) / cycle_length, (real)0.0, (real)1.0);
+            return min_factor + ((real)1.0 - min_factor) * (real)0.5 * ((real)1.0 + std::cos(t * std::numbers::pi_v<real>));
+        }
+
+        case ann_schedule_type::one_cycle:
+        {
+            real peak_epoch = pct_start * real(total);
+            real initial = (real)1.0 / div_factor;
+            real final = initial / final_div_factor;
+            if(epoch < peak_epoch)
+            {
+                real t = epoch / peak_epoch;
+                return initial + ((real)1.0 - initial) * (real)0.5 * ((real)1.0 - std::cos(t * std::numbers::pi_v<real>));
+            }
+            real t = std::clamp((epoch - peak_epoch) / std::max(real(total) - peak_epoch, (real)1e-6f), (real)0.0, (real)1.0);
+            return final + ((real)1.0 - final) * (real)0.5 * ((real)1.0 + std::cos(t * std::numbers::pi_v<real>));
+        }
+
+        case ann_schedule_type::plateau:
+            return current_factor;
+    }
+}
+
+prkl::ann_schedule::ann_schedule(ann_settings const& settings)
+{
+    if(settings.alr)
+    {
+        policies.push_back(ann_schedule_policy());
+    }
+}
+
+prkl::ann_schedule::ann_schedule(nlohmann::json &cfg)
+{
+    // "schedule": [ { "type": "warmup", "epochs": 1 }, { "type": "cosine", "period": 10 } ]
+    for(nlohmann::json &policy : cfg)
+    {
+        policies.push_back(ann_schedule_policy(policy));
+    }
+}
+
+bool prkl::ann_schedule::parse(std::string const& spec)
+{
+    std::vector<ann_schedule_policy> new_policies;
+
+    std::stringstream stream(spec);
+    std::string entry;
+    while(std::getline(stream, entry, ','))
+    {
+        ann_schedule_policy policy;
+        std::string::size_type colon = entry.find(':');
+        std::string name = entry.substr(0, colon);
+        if(!schedule_type_from_string(name, policy.type))
+        {
+            std::cerr << "unrecognized schedule policy: " << name << std::endl;
+            return false;
+        }
+
+        if(colon != std::string::npos)
+        {
+            real value = (real)0.0;
+            char const* first = entry.data() + colon + 1;
+            char const* last = entry.data() + entry.size();
+            std::from_chars_result result = std::from_chars(first, last, value);
+            if(result.ec != std::errc() || result.ptr != last || (policy.type == ann_schedule_type::plateau && value < (real)0.0))
+            {
+                std::cerr << "invalid value for schedule policy " << name << ": " << entry.substr(colon + 1) << std::endl;
+                return false;
+            }
+
+            switch(policy.type)
+            {
+                case ann_schedule_type::warmup:
+                    policy.epochs = value;
+                    break;
+                case ann_schedule_type::step:
+                case ann_schedule_type::cosine:
+                    policy.period = value;
+                    break;
+                case ann_schedule_type::one_cycle:
+                    policy.pct_start = value;
+                    break;
+                case ann_schedule_type::plateau:
+                    policy.patience = (integer)value;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if(!policy.validate())
+            return false;
+
+        new_policies.push_back(policy);
+    }
+
+    policies = new_policies;
+    return true;
+}
+
+void prkl::ann_schedule::begin(integer in_steps_per_epoch, integer in_total_epochs)
+{
+    steps_per_epoch = std::max(in_steps_per_epoch, (integer)1);
+    total_epochs = std::max(in_total_epochs, (integer)1);
+}
+
+prkl::real prkl::ann_schedule::learning_rate(integer step, ann_settings const& settings) const
+{
+    real epoch = real(step) / real(steps_per_epoch);
+    real rate = settings.base_rate;
+    for(ann_schedule_policy const& policy : policies)
+    {
+        rate *= policy.factor_at(epoch, total_epochs, settings);
+    }
+    return rate;
+}
+
+void prkl::ann_schedule::end_epoch(real avg_loss, real result)
+{
+    for(ann_schedule_policy &policy : policies)
+    {
+        policy.last_loss = avg_loss;
+
+        if(policy.type == ann_schedule_type::plateau)
+        {
+            if(result > policy.best_result)
+            {
+                policy.best_result = result;
+                policy.bad_epochs = 0;
+            }
+            else if(++policy.bad_epochs >= policy.patience)
+            {
+                policy.current_factor = std::max(policy.current_factor * policy.factor, policy.min_factor);
+                policy.bad_epochs = 0;
+            }
+        }
+    }
+}
+
+bool prkl::schedule_type_from_string(std::string const& str, ann_schedule_type &out_type)
+{
+    if(str == "adaptive")
+        out_type = ann_schedule_type::adaptive;
+    else if(str == "warmup")
+        out_type = ann_schedule_type::warmup;
+    else if(str == "step")
+        out_type = ann_schedule_type::step;
+    else if(str == "cosine")
+        out_type = ann_schedule_type::cosine;
+    else if(str == "one_cycle")
+        out_type = ann_schedule_type::one_cycle;
+    else if(str == "plateau")
+        out_type = ann_schedule_type::plateau;
+    else
+        return false;
+
+    return true;
+}
+
+char const* prkl::schedule_type_to_string(ann_schedule_type type)
+{
+    switch(type)
+    {
+        default:
+        case ann_schedule_type::adaptive:
+            return "adaptive";
+        case ann_schedule_type::warmup:
+            return "warmup";
+        case ann_schedule_type::step:
+            return "step";
+        case ann_schedule_type::cosine:
+            return "cosine";
+        case ann_schedule_type::one_cycle:
+            return "one_cycle";
+        case ann_schedule_type::plateau:
+            return "plateau";
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "common.hpp"
+
+namespace prkl 
+{
+
+    enum class ann_schedule_type : integer
+    {
+        /** The loss-driven adaptive learning rate (ALR), see adaptive_learning_rate() */
+        adaptive = 0,
+        /** Linear ramp from `min_factor` to 1 over the first `epochs` epochs */
+        warmup,
+        /** Multiplies by `factor` every `period` epochs */
+        step,
+        /** Cosine annealing from 1 to `min_factor` over `period` epochs, restarting with the period scaled by `period_mult` */
+        cosine,
+        /** Ramps up from 1/div_factor to 1 over pct_start of the run, then anneals down to 1/(div_factor*final_div_factor) */
+        one_cycle,
+        /** Multiplies by `factor` whenever the evaluation result has not improved for `patience` epochs */
+        plateau
+    };
+
+    /** One policy of a schedule. Each policy yields a factor, and the factors of all policies are multiplied together */
+    struct ann_schedule_policy
+    {
+        ann_schedule_policy()=default;
+        ann_schedule_policy(nlohmann::json &cfg);
+
+        real factor_at(real epoch, integer total_epochs, ann_settings const& settings) const;
+
+        /** Checks the parameters factor_at divides by and the plateau patience, prints why the policy is invalid. Also warns about cosine restarts that never happen */
+        bool validate() const;
+
+        ann_schedule_type type{ann_schedule_type::adaptive};
+
+        real epochs{(real)1.0};
+        real period{(real)10.0};
+        real period_mult{(real)1.0};
+        real factor{(real)0.5};
+        real min_factor{(real)0.0};
+        real pct_start{(real)0.3};
+        real div_factor{(real)25.0};
+        real final_div_factor{(real)10000.0};
+        integer patience{2};
+
+        // runtime state, updated at the end of every epoch
+        real last_loss{std::numeric_limits<real>::infinity()};
+        real best_result{-std::numeric_limits<real>::infinity()};
+        integer bad_epochs{0};
+        real current_factor{(real)1.0};
+    };
+
+    /** Learning rate schedule, a base rate scaled by a composition of policies */
+    struct ann_schedule
+    {
+        /** The default schedule, ALR if the settings enable it and a constant rate otherwise */
+        ann_schedule(ann_settings const& settings);
+        ann_schedule(nlohmann::json &cfg);
+
+        /** Parses a comma separated list of policies, each as name[:value], e.g. "warmup:1,cosine:10,plateau:3" */
+        bool parse(std::string const& spec);
+
+        /** Must be called before training, so the schedule can convert optimizer steps to epochs */
+        void begin(integer steps_per_epoch, integer total_epochs);
+
+        /** Learning rate for the given optimizer step, the settings base rate scaled by all policies. Safe to call concurrently */
+        real learning_rate(integer step, ann_settings const& settings) const;
+
+        /** Feeds the epoch results to the stateful policies. result is the evaluation success rate, or the negated loss without an evaluation set */
+        void end_epoch(real avg_loss, real result);
+
+        std::vector<ann_schedule_policy> policies;
+
+        integer steps_per_epoch{1};
+        integer total_epochs{1};
+    };
+
+    bool schedule_type_from_string(std::string const& str, ann_schedule_type &out_type);
+    char const* schedule_type_to_string(ann_schedule_type type);
+}
@@ -48,7 +48,7 @@ prkl::ann_set::ann_set(char const* path)
 }
 
 
-prkl::integer prkl::ann_setpair::min_input_index()
+prkl::integer prkl::ann_setpair::min_input_index() const
 {
     real c_min = std::numeric_limits<prkl::real>::infinity();
     integer c_index = 0;
@@ -64,7 +64,7 @@ prkl::integer prkl::ann_setpair::min_input_index()
     return c_index;
 }
 
-prkl::integer prkl::ann_setpair::max_input_index()
+prkl::integer prkl::ann_setpair::max_input_index() const
 {
     real c_max = 0.0;
     integer c_index = 0;
@@ -80,7 +80,7 @@ prkl::integer prkl::ann_setpair::max_input_index()
     return c_index;
 }
 
-prkl::integer prkl::ann_setpair::min_output_index()
+prkl::integer prkl::ann_setpair::min_output_index() const
 {
     real c_min = std::numeric_limits<prkl::real>::infinity();
     integer c_index = 0;
@@ -95,7 +95,7 @@ prkl::integer prkl::ann_setpair::min_output_index()
 
     return c_index;
 }
-prkl::integer prkl::ann_setpair::max_output_index()
+prkl::integer prkl::ann_setpair::max_output_index() const
 {
     real c_max = 0.0;
     integer c_index = 0;
@@ -8,11 +8,11 @@ namespace prkl
 
     struct ann_setpair 
     {
-        integer min_input_index();
-        integer max_input_index();
+        integer min_input_index() const;
+        integer max_input_index() const;
 
-        integer min_output_index();
-        integer max_output_index();
+        integer min_output_index() const;
+        integer max_output_index() const;
 
         std::vector<real> input;
         std::vector<real> output;
@@ -0,0 +1,363 @@
+
+#include "shared_memory.hpp"
+
+#include <thread>
+#include <limits>
+#include <cerrno>
+#include <csignal>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+#endif
+
+#define ann_shm_magic 0x70726b6c73686d32 // "prklshm2"
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free, "the shared memory transport needs address-free atomics");
+
+namespace
+{
+    using clock_type = std::chrono::steady_clock;
+
+    /** How long each end polls before it sleeps, covers the forward pass of a small model. No spinning at all on a single core */
+    constexpr std::chrono::microseconds spin_duration(50);
+
+    bool can_spin()
+    {
+        static bool const multicore = std::thread::hardware_concurrency() > 1;
+        return multicore;
+    }
+
+    void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#endif
+    }
+
+    /** Spins until the condition holds or spin_duration passes, returns whether it held */
+    template<typename condition_type>
+    bool spin_until(condition_type condition)
+    {
+        if(!can_spin())
+            return condition();
+
+        clock_type::time_point end = clock_type::now() + spin_duration;
+        while(true)
+        {
+            for(int i = 0; i < 64; i++)
+            {
+                if(condition())
+                    return true;
+                cpu_relax();
+            }
+            if(clock_type::now() >= end)
+                return false;
+        }
+    }
+
+    // process-shared futexes, FUTEX_PRIVATE_FLAG would only wake threads of the same process
+    void futex_wait(std::atomic<uint32_t> *address, uint32_t expected, std::chrono::microseconds timeout)
+    {
+        timespec time;
+        time.tv_sec = timeout.count() / 1000000;
+        time.tv_nsec = (timeout.count() % 1000000) * 1000;
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), FUTEX_WAIT, expected, &time, nullptr, 0);
+    }
+
+    void futex_wake(std::atomic<uint32_t> *address, int count)
+    {
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), FUTEX_WAKE, count, nullptr, nullptr, 0);
+    }
+
+    prkl::ann_shm_slot &slot_at(prkl::ann_shm_header *header, prkl::integer slot_index)
+    {
+        char *slots = reinterpret_cast<char*>(header) + sizeof(prkl::ann_shm_header);
+        return *reinterpret_cast<prkl::ann_shm_slot*>(slots + slot_index * header->slot_stride);
+    }
+
+    uint32_t state_value(prkl::ann_shm_slot_state state)
+    {
+        return (uint32_t)state;
+    }
+}
+
+prkl::ann_shm_server::~ann_shm_server()
+{
+    if(!header)
+        return;
+
+    close();
+    ::munmap(header, size);
+    ::shm_unlink(name.c_str());
+}
+
+bool prkl::ann_shm_server::create(std::string const& in_name, integer num_slots, integer slot_capacity)
+{
+    name = in_name;
+    uint64_t slot_stride = (sizeof(ann_shm_slot) + slot_capacity * sizeof(real) + 63) / 64 * 64;
+    size = sizeof(ann_shm_header) + num_slots * slot_stride;
+
+    // a stale segment of a crashed server may have another layout, clients that still map it keep their copy
+    ::shm_unlink(name.c_str());
+    int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0 || ::ftruncate(fd, size) != 0)
+    {
+        std::cerr << "failed to create shared memory segment: " << name << std::endl;
+        if(fd >= 0)
+            ::close(fd);
+        return false;
+    }
+
+    void *mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        std::cerr << "failed to map shared memory segment: " << name << std::endl;
+        ::shm_unlink(name.c_str());
+        return false;
+    }
+
+    // ftruncate zero fills, so every atomic starts at 0 and every slot is free
+    header = static_cast<ann_shm_header*>(mapping);
+    header->num_slots = num_slots;
+    header->slot_capacity = slot_capacity;
+    header->slot_stride = slot_stride;
+
+    // clients check the magic first, so it goes in last
+    std::atomic_thread_fence(std::memory_order_release);
+    reinterpret_cast<std::atomic<uint64_t>*>(&header->magic)->store(ann_shm_magic, std::memory_order_release);
+    return true;
+}
+
+prkl::ann_shm_slot &prkl::ann_shm_server::slot(integer slot_index)
+{
+    return slot_at(header, slot_index);
+}
+
+prkl::integer prkl::ann_shm_server::take_ready(std::vector<integer> &out_slots, integer max_slots)
+{
+    integer num_taken = 0;
+    integer num_slots = header->num_slots;
+    for(integer i = 0; i < num_slots && num_taken < max_slots; i++)
+    {
+        integer slot_index = (next_slot + i) % num_slots;
+        ann_shm_slot &current = slot(slot_index);
+        if(current.state.load(std::memory_order_acquire) != state_value(ann_shm_slot_state::ready))
+            continue;
+
+        // only the server moves a slot on from ready, no compare and swap needed
+        current.state.store(state_value(ann_shm_slot_state::running), std::memory_order_relaxed);
+        out_slots.push_back(slot_index);
+        num_taken++;
+    }
+
+    if(num_taken > 0)
+        next_slot = (out_slots.back() + 1) % num_slots;
+    return num_taken;
+}
+
+prkl::integer prkl::ann_shm_server::wait(std::vector<integer> &out_slots, integer max_slots, std::chrono::microseconds timeout)
+{
+    integer num_taken = 0;
+    if(spin_until([&]{ return (num_taken = take_ready(out_slots, max_slots)) > 0; }))
+        return num_taken;
+
+    // the doorbell is read before the last scan, a client that rings after the scan changes it and the wait returns at once
+    uint32_t doorbell = header->doorbell.load(std::memory_order_seq_cst);
+    header->server_sleeping.store(1, std::memory_order_seq_cst);
+    num_taken = take_ready(out_slots, max_slots);
+    if(num_taken == 0)
+    {
+        futex_wait(&header->doorbell, doorbell, timeout);
+        num_taken = take_ready(out_slots, max_slots);
+    }
+    header->server_sleeping.store(0, std::memory_order_relaxed);
+    return num_taken;
+}
+
+void prkl::ann_shm_server::complete(integer slot_index, ann_shm_status status, uint32_t num_outputs)
+{
+    ann_shm_slot &current = slot(slot_index);
+    current.status = (uint32_t)status;
+    current.count = num_outputs;
+
+    // pairs with the client, which announces its sleep before it reads the state one last time
+    current.state.store(state_value(ann_shm_slot_state::done), std::memory_order_seq_cst);
+    if(current.client_sleeping.load(std::memory_order_seq_cst))
+        futex_wake(&current.state, 1);
+}
+
+prkl::integer prkl::ann_shm_server::reclaim()
+{
+    integer num_reclaimed = 0;
+    for(integer slot_index = 0; slot_index < header->num_slots; slot_index++)
+    {
+        // only writing and done belong to the client, the server finishes a ready or running slot itself and it ends up done
+        ann_shm_slot &current = slot(slot_index);
+        uint32_t state = current.state.load(std::memory_order_acquire);
+        if(state != state_value(ann_shm_slot_state::writing) && state != state_value(ann_shm_slot_state::done))
+            continue;
+
+        // a client that died between its claim and recording its pid leaves 0 behind, that slot can't be told from a live one
+        pid_t owner = (pid_t)current.owner.load(std::memory_order_relaxed);
+        if(owner <= 0 || ::kill(owner, 0) == 0 || errno != ESRCH)
+            continue;
+
+        // nobody else moves a slot on from these states while its owner is gone
+        current.owner.store(0, std::memory_order_relaxed);
+        if(current.state.compare_exchange_strong(state, state_value(ann_shm_slot_state::free), std::memory_order_release))
+        {
+            std::cerr << "shared memory: reclaimed slot " << slot_index << " of exited client " << owner << std::endl;
+            num_reclaimed++;
+        }
+    }
+    return num_reclaimed;
+}
+
+void prkl::ann_shm_server::close()
+{
+    header->closed.store(1, std::memory_order_seq_cst);
+    for(integer slot_index = 0; slot_index < header->num_slots; slot_index++)
+        futex_wake(&slot(slot_index).state, 1);
+}
+
+prkl::ann_shm_client::~ann_shm_client()
+{
+    if(header)
+        ::munmap(header, size);
+}
+
+bool prkl::ann_shm_client::open(std::string const& name)
+{
+    int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    struct stat info;
+    if(fd < 0 || ::fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(ann_shm_header))
+    {
+        std::cerr << "failed to open shared memory segment: " << name << std::endl;
+        if(fd >= 0)
+            ::close(fd);
+        return false;
+    }
+
+    size = info.st_size;
+    void *mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED)
+    {
+        std::cerr << "failed to map shared memory segment: " << name << std::endl;
+        return false;
+    }
+
+    header = static_cast<ann_shm_header*>(mapping);
+    if(reinterpret_cast<std::atomic<uint64_t>*>(&header->magic)->load(std::memory_order_acquire) != ann_shm_magic)
+    {
+        std::cerr << "invalid shared memory segment, magic mismatch: " << name << std::endl;
+        ::munmap(header, size);
+        header = nullptr;
+        return false;
+    }
+
+    // the header can't be trusted any further than the mapping reaches, every slot has to lie inside it
+    uint64_t num_slots = header->num_slots;
+    uint64_t slot_stride = header->slot_stride;
+    uint64_t max_slots_size = std::numeric_limits<uint64_t>::max() - sizeof(ann_shm_header);
+    bool valid_layout = num_slots > 0 && slot_stride >= sizeof(ann_shm_slot) + uint64_t(header->slot_capacity) * sizeof(real) && slot_stride % alignof(ann_shm_slot) == 0
+                     && slot_stride <= max_slots_size / num_slots && sizeof(ann_shm_header) + num_slots * slot_stride <= size;
+    if(!valid_layout)
+    {
+        std::cerr << "invalid shared memory segment, " << num_slots << " slots of " << slot_stride << " bytes don't fit its " << size << " bytes: " << name << std::endl;
+        ::munmap(header, size);
+        header = nullptr;
+        return false;
+    }
+    return true;
+}
+
+prkl::integer prkl::ann_shm_client::infer(uint32_t model_index, std::span<real const> inputs, std::span<real> outputs)
+{
+    if(inputs.size() > header->slot_capacity)
+    {
+        std::cerr << "shared memory inference: " << inputs.size() << " inputs don't fit a slot of " << header->slot_capacity << std::endl;
+        return 0;
+    }
+
+    // claim a slot: tickets spread the clients over the ring, a slot still held by a slow client is skipped
+    ann_shm_slot *current = nullptr;
+    while(!current)
+    {
+        if(header->closed.load(std::memory_order_acquire))
+        {
+            std::cerr << "shared memory inference: the server has closed the transport" << std::endl;
+            return 0;
+        }
+
+        for(integer attempt = 0; attempt < header->num_slots && !current; attempt++)
+        {
+            ann_shm_slot &candidate = slot_at(header, header->head.fetch_add(1, std::memory_order_relaxed) % header->num_slots);
+            uint32_t expected = state_value(ann_shm_slot_state::free);
+            if(candidate.state.compare_exchange_strong(expected, state_value(ann_shm_slot_state::writing), std::memory_order_acquire))
+                current = &candidate;
+        }
+
+        // every slot is in flight
+        if(!current)
+            std::this_thread::yield();
+    }
+
+    // lets the server free the slot should this process die while it holds it
+    current->owner.store((uint32_t)::getpid(), std::memory_order_relaxed);
+    current->model_index = model_index;
+    current->count = inputs.size();
+    std::copy(inputs.begin(), inputs.end(), current->data());
+    current->submit_time = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count();
+    current->state.store(state_value(ann_shm_slot_state::ready), std::memory_order_seq_cst);
+
+    header->doorbell.fetch_add(1, std::memory_order_seq_cst);
+    if(header->server_sleeping.load(std::memory_order_seq_cst))
+        futex_wake(&header->doorbell, 1);
+
+    uint32_t const done = state_value(ann_shm_slot_state::done);
+    if(!spin_until([&]{ return current->state.load(std::memory_order_acquire) == done; }))
+    {
+        current->client_sleeping.store(1, std::memory_order_seq_cst);
+        uint32_t state;
+        while((state = current->state.load(std::memory_order_seq_cst)) != done)
+        {
+            if(header->closed.load(std::memory_order_acquire))
+            {
+                // the slot stays taken, the server is gone
+                std::cerr << "shared memory inference: the server has closed the transport" << std::endl;
+                return 0;
+            }
+            futex_wait(&current->state, state, std::chrono::milliseconds(100));
+        }
+        current->client_sleeping.store(0, std::memory_order_relaxed);
+    }
+
+    integer num_outputs = 0;
+    ann_shm_status status = (ann_shm_status)current->status;
+    if(status != ann_shm_status::ok)
+    {
+        std::cerr << "shared memory inference failed with status " << current->status << std::endl;
+    }
+    else if(current->count > outputs.size())
+    {
+        std::cerr << "shared memory inference: " << current->count << " outputs don't fit a span of " << outputs.size() << std::endl;
+    }
+    else
+    {
+        num_outputs = current->count;
+        std::copy(current->data(), current->data() + num_outputs, outputs.begin());
+    }
+
+    current->owner.store(0, std::memory_order_relaxed);
+    current->state.store(state_value(ann_shm_slot_state::free), std::memory_order_release);
+    return num_outputs;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <span>
+#include <string>
+
+namespace prkl
+{
+
+    /** Lifecycle of a shared memory slot, a client owns it from free to ready and again from done to free, the server in between */
+    enum class ann_shm_slot_state : uint32_t
+    {
+        free = 0,
+        writing,
+        ready,
+        running,
+        done
+    };
+
+    enum class ann_shm_status : uint32_t
+    {
+        ok = 0,
+        unknown_model,
+        input_mismatch,
+        output_overflow
+    };
+
+    /** Start of the segment, followed by num_slots slots of slot_stride bytes */
+    struct ann_shm_header
+    {
+        uint64_t magic;
+        uint32_t num_slots;
+        uint32_t slot_capacity; // floats per slot, inputs go in and outputs come back in the same place
+        uint64_t slot_stride;
+
+        alignas(64) std::atomic<uint64_t> head; // client tickets, ticket % num_slots is the slot a client tries first
+        alignas(64) std::atomic<uint32_t> doorbell; // bumped for every ready slot, the server sleeps on it
+        std::atomic<uint32_t> server_sleeping;
+        std::atomic<uint32_t> closed;
+    };
+
+    struct alignas(64) ann_shm_slot
+    {
+        std::atomic<uint32_t> state; // ann_shm_slot_state, clients sleep on it
+        std::atomic<uint32_t> client_sleeping;
+        std::atomic<uint32_t> owner; // pid of the client holding the slot, 0 while it is free or only just claimed
+        uint32_t model_index;
+        uint32_t count; // inputs while ready, outputs once done
+        uint32_t status; // ann_shm_status, once done
+        uint64_t submit_time; // steady_clock nanoseconds, which is CLOCK_MONOTONIC and comparable across processes on Linux
+
+        real *data() { return reinterpret_cast<real*>(this + 1); }
+    };
+
+    /**
+     * Serving end of a shared memory transport. Owns a POSIX shared memory segment with a ring of fixed-size slots. Clients
+     * claim slots without locks, write their inputs straight into them and ring a futex doorbell, and the server writes the
+     * outputs back in place and wakes the client with a futex on the slot. Both ends spin briefly before they sleep, so a
+     * busy server never pays for a system call. Linux only
+     */
+    struct ann_shm_server
+    {
+        ann_shm_server()=default;
+        ann_shm_server(ann_shm_server const&)=delete;
+        ann_shm_server& operator=(ann_shm_server const&)=delete;
+        /** Closes the transport, waking every waiting client, and unlinks the segment */
+        ~ann_shm_server();
+
+        /** Creates the segment, replacing a stale one of the same name. name is a POSIX shared memory name such as /prkl-serve */
+        bool create(std::string const& name, integer num_slots, integer slot_capacity);
+
+        /**
+         * Waits up to timeout for ready slots and takes up to max_slots of them in ring order, which is roughly arrival order.
+         * Returns the number taken, their indices are appended to out_slots
+         */
+        integer wait(std::vector<integer> &out_slots, integer max_slots, std::chrono::microseconds timeout);
+
+        ann_shm_slot &slot(integer slot_index);
+
+        /** Hands a taken slot back to its client, the outputs are already in its data */
+        void complete(integer slot_index, ann_shm_status status, uint32_t num_outputs);
+
+        /**
+         * Frees the slots held by clients that died before handing them back, which would stay taken forever otherwise. Checks the
+         * owner pid of every client-held slot with a system call, so call it every now and then rather than per batch. Clients must
+         * live in the server's pid namespace. Returns the number of slots freed
+         */
+        integer reclaim();
+
+        /** Marks the transport closed and wakes every client, requests still in flight fail on the client */
+        void close();
+
+        std::string name;
+        ann_shm_header *header{nullptr};
+        size_t size{0};
+        integer next_slot{0}; // where the next scan starts
+
+    private:
+        integer take_ready(std::vector<integer> &out_slots, integer max_slots);
+    };
+
+    /** Client end of a shared memory transport, one per process is enough. Linux only */
+    struct ann_shm_client
+    {
+        ann_shm_client()=default;
+        ann_shm_client(ann_shm_client const&)=delete;
+        ann_shm_client& operator=(ann_shm_client const&)=delete;
+        ~ann_shm_client();
+
+        bool open(std::string const& name);
+
+        /**
+         * Runs one sample through model model_index of the server, writes the outputs and returns how many there are. Several threads
+         * may share a client, every call takes a slot of its own. Returns 0 on failure, after printing the reason
+         */
+        integer infer(uint32_t model_index, std::span<real const> inputs, std::span<real> outputs);
+
+        ann_shm_header *header{nullptr};
+        size_t size{0};
+    };
+
+}
@@ -0,0 +1,534 @@
+
+#include "sparse_layer.hpp"
+
+#include <iostream>
+
+prkl::ann_sparse_layer::ann_sparse_layer(ann_dense_layer const& dense)
+{
+    activation_func = dense.activation_func;
+    leaky_alpha = dense.leaky_alpha;
+    grad_limit = dense.grad_limit;
+    frozen = dense.frozen;
+
+    num_neurons = dense.num_neurons;
+    num_inputs = dense.num_inputs;
+    activations.assign(dense.activations, dense.activations + num_neurons);
+
+    row_offsets.resize(num_neurons + 1, 0);
+    if(num_inputs == 0)
+        return;
+
+    biases.assign(dense.biases, dense.biases + num_neurons);
+    for(integer n = 0; n < num_neurons; n++)
+    {
+        real const* neuron_weights = dense.get_weights_array(n);
+        for(integer i = 0; i < num_inputs; i++)
+        {
+            if(neuron_weights[i] != 0.0f)
+            {
+                columns.push_back(uint32_t(i));
+                values.push_back(neuron_weights[i]);
+            }
+        }
+        row_offsets[n + 1] = uint32_t(values.size());
+    }
+}
+
+prkl::ann_sparse_layer::ann_sparse_layer(std::ifstream &file, ann_model_version)
+{
+    activation_func = (ann_activation)read_uint64_be(file);
+    leaky_alpha = read_float_be(file);
+
+    // Every index below goes straight into forward and backward passes unchecked, so a corrupt or truncated file fails the
+    // load here. The stream is marked failed, which makes the model discard the layer, and the layer is left empty.
+    auto fail = [&](char const* reason)
+    {
+        std::cerr << "invalid sparse layer, " << reason << std::endl;
+        file.setstate(std::ios::failbit);
+        num_neurons = 0;
+        num_inputs = 0;
+        activations.clear();
+        row_offsets.clear();
+        columns.clear();
+        values.clear();
+        biases.clear();
+    };
+
+    // the CSR indices are 32 bit, which also keeps every size product below from overflowing
+    num_neurons = read_uint64_be(file);
+    num_inputs = read_uint64_be(file);
+    if(!file || num_neurons > UINT32_MAX || num_inputs > UINT32_MAX || num_neurons * sizeof(uint32_t) > remaining_bytes(file))
+    {
+        fail("its size exceeds the file");
+        return;
+    }
+
+    activations.resize(num_neurons);
+    for(real &activation : activations)
+    {
+        activation = read_float_be(file);
+    }
+
+    integer num_nonzero = read_uint64_be(file);
+    integer num_biases = num_inputs > 0 ? num_neurons : 0;
+    if(!file || num_nonzero > UINT32_MAX || num_nonzero > num_neurons * num_inputs || (num_neurons + 1 + 2 * num_nonzero + num_biases) * sizeof(uint32_t) > remaining_bytes(file))
+    {
+        fail("its weights exceed the file");
+        return;
+    }
+
+    row_offsets.resize(num_neurons + 1);
+    columns.resize(num_nonzero);
+    values.resize(num_nonzero);
+    biases.resize(num_biases);
+
+    for(uint32_t &offset : row_offsets)
+    {
+        offset = read_uint32_be(file);
+    }
+
+    for(uint32_t &column : columns)
+    {
+        column = read_uint32_be(file);
+    }
+
+    for(real &value : values)
+    {
+        value = read_float_be(file);
+    }
+
+    for(real &bias : biases)
+    {
+        bias = read_float_be(file);
+    }
+
+    if(!file)
+    {
+        fail("the file is truncated");
+        return;
+    }
+
+    if(row_offsets.front() != 0 || row_offsets.back() != num_nonzero)
+    {
+        fail("its row offsets don't span the stored weights");
+        return;
+    }
+
+    for(integer n = 0; n < num_neurons; n++)
+    {
+        if(row_offsets[n + 1] < row_offsets[n])
+        {
+            fail("its row offsets decrease");
+            return;
+        }
+    }
+
+    for(uint32_t column : columns)
+    {
+        if(column >= num_inputs)
+        {
+            fail("a column is out of range");
+            return;
+        }
+    }
+}
+
+void prkl::ann_sparse_layer::write(std::ofstream &file)
+{
+    write_uint64_be(file, (uint64_t)ann_layer_type::sparse);
+
+    write_uint64_be(file, (uint64_t)activation_func);
+    write_float_be(file, leaky_alpha);
+
+    write_uint64_be(file, num_neurons);
+    write_uint64_be(file, num_inputs);
+
+    for(real activation : activations)
+    {
+        write_float_be(file, activation);
+    }
+
+    // column indices are 32 bit, at 4 bytes per value that makes every stored weight cost 8 bytes against 4 for a dense one
+    write_uint64_be(file, values.size());
+    for(uint32_t offset : row_offsets)
+    {
+        write_uint32_be(file, offset);
+    }
+
+    for(uint32_t column : columns)
+    {
+        write_uint32_be(file, column);
+    }
+
+    for(real value : values)
+    {
+        write_float_be(file, value);
+    }
+
+    for(real bias : biases)
+    {
+        write_float_be(file, bias);
+    }
+}
+
+prkl::real prkl::ann_sparse_layer::sparsity() const
+{
+    if(num_inputs == 0)
+        return 0.0f;
+
+    return 1.0f - real(values.size()) / real(num_neurons * num_inputs);
+}
+
+prkl::integer prkl::ann_sparse_layer::min_activation_index() const
+{
+    return std::min_element(activations.begin(), activations.end()) - activations.begin();
+}
+
+prkl::integer prkl::ann_sparse_layer::max_activation_index() const
+{
+    return std::max_element(activations.begin(), activations.end()) - activations.begin();
+}
+
+prkl::ann_layer_base *prkl::ann_sparse_layer::clone() const
+{
+    // like the dense layer, a clone starts without optimizer state
+    ann_sparse_layer *new_layer = new ann_sparse_layer(*this);
+    new_layer->moments1.clear();
+    new_layer->moments2.clear();
+    return new_layer;
+}
+
+prkl::integer prkl::ann_sparse_layer::num_parameters() const
+{
+    return values.size() + biases.size();
+}
+
+void prkl::ann_sparse_layer::read_parameters(real *out_parameters) const
+{
+    std::copy(values.begin(), values.end(), out_parameters);
+    std::copy(biases.begin(), biases.end(), out_parameters + values.size());
+}
+
+void prkl::ann_sparse_layer::write_parameters(real const* parameters)
+{
+    std::copy(parameters, parameters + values.size(), values.begin());
+    std::copy(parameters + values.size(), parameters + values.size() + biases.size(), biases.begin());
+}
+
+prkl::integer prkl::ann_sparse_layer::num_activations() const
+{
+    return num_neurons;
+}
+
+prkl::real prkl::ann_sparse_layer::get_activation(integer activation_index) const
+{
+    assert(activation_index < num_neurons && "activation index out of range");
+    return activations[activation_index];
+}
+
+void prkl::ann_sparse_layer::set_activation(integer activation_index, real new_activation)
+{
+    assert(activation_index < num_neurons && "activation index out of range");
+    activations[activation_index] = new_activation;
+}
+
+void prkl::ann_sparse_layer::forward(ann_layer_base const* prev_layer)
+{
+    forward(prev_layer->get_activations_array(), activations.data());
+}
+
+template<typename access>
+static void sparse_forward(prkl::ann_sparse_layer const* layer, prkl::real const* prev_activations, prkl::real *out_activations)
+{
+    uint32_t const* row_offsets = layer->row_offsets.data();
+    uint32_t const* columns = layer->columns.data();
+    prkl::real const* values = layer->values.data();
+
+    #pragma omp parallel for if(layer->num_neurons >= 128)
+    for(prkl::natural n = 0; n < (prkl::natural)layer->num_neurons; n++)
+    {
+        prkl::real sum = access::load(layer->biases[n]);
+
+        if constexpr(std::is_same_v<access, prkl::ann_plain_access>)
+        {
+            #pragma omp simd reduction(+:sum)
+            for(uint32_t k = row_offsets[n]; k < row_offsets[n + 1]; k++)
+            {
+                sum += values[k] * prev_activations[columns[k]];
+            }
+        }
+        else
+        {
+            // the stored weights of a row are contiguous, so they are copied out in chunks like the dense ones
+            prkl::real partial_sums[access::chunk_size] = {};
+            uint32_t k = row_offsets[n];
+            for(; k + access::chunk_size <= row_offsets[n + 1]; k += access::chunk_size)
+            {
+                prkl::real chunk[access::chunk_size];
+                access::load_chunk(values + k, chunk);
+
+                #pragma omp simd
+                for(uint32_t c = 0; c < access::chunk_size; c++)
+                {
+                    partial_sums[c] += chunk[c] * prev_activations[columns[k + c]];
+                }
+            }
+
+            for(uint32_t c = 0; c < access::chunk_size; c++)
+                sum += partial_sums[c];
+            for(; k < row_offsets[n + 1]; k++)
+                sum += access::load(values[k]) * prev_activations[columns[k]];
+        }
+        out_activations[n] = prkl::activation(layer, sum);
+    }
+}
+
+void prkl::ann_sparse_layer::forward(real const* prev_activations, real *out_activations) const
+{
+    if(num_inputs == 0)
+        return;
+
+    if(shared_parameters)
+        sparse_forward<ann_shared_access>(this, prev_activations, out_activations);
+    else
+        sparse_forward<ann_plain_access>(this, prev_activations, out_activations);
+}
+
+void prkl::ann_sparse_layer::forward_batch(real const* prev_activations, real *out_activations, integer batch) const
+{
+    if(num_inputs == 0)
+        return;
+
+    // The batch is transposed to input-major once, so every stored weight multiplies a contiguous run of batch inputs. 
+    // That vectorizes across the samples without any gathers, the transpose is num_inputs * batch against nnz * batch.
+    // The buffers grow once per thread and are reused after that
+    thread_local std::vector<real> transposed;
+    thread_local std::vector<real> sums;
+    if(transposed.size() < num_inputs * batch)
+        transposed.resize(num_inputs * batch);
+    if(sums.size() < batch)
+        sums.resize(batch);
+
+    for(integer b = 0; b < batch; b++)
+    {
+        real const* sample = prev_activations + b * num_inputs;
+        for(integer i = 0; i < num_inputs; i++)
+        {
+            transposed[i * batch + b] = sample[i];
+        }
+    }
+
+    real *sample_sums = sums.data();
+    for(integer n = 0; n < num_neurons; n++)
+    {
+        std::fill(sample_sums, sample_sums + batch, biases[n]);
+
+        for(uint32_t k = row_offsets[n]; k < row_offsets[n + 1]; k++)
+        {
+            real w = values[k];
+            real const* inputs = transposed.data() + columns[k] * batch;
+
+            #pragma omp simd
+            for(integer b = 0; b < batch; b++)
+            {
+                sample_sums[b] += w * inputs[b];
+            }
+        }
+
+        for(integer b = 0; b < batch; b++)
+        {
+            out_activations[b * num_neurons + n] = activation(this, sample_sums[b]);
+        }
+    }
+}
+
+void prkl::ann_sparse_layer::apply_softmax()
+{
+    apply_softmax(activations.data());
+}
+
+void prkl::ann_sparse_layer::apply_softmax(real *inout_activations) const
+{
+    softmax(inout_activations, num_neurons);
+}
+
+void prkl::ann_sparse_layer::gradients_from_expected_output(ann_evaluation_type evaluation_type, ann_loss_function loss_function, std::vector<real> const& expected_output, ann_gradients &out_gradients, real &out_loss) const
+{
+    if(num_inputs == 0)
+        return;
+
+    out_gradients.resize(num_neurons);
+    gradients_from_expected_output(evaluation_type, loss_function, activations.data(), expected_output, out_gradients.data(), out_loss);
+}
+
+void prkl::ann_sparse_layer::gradients_from_expected_output(ann_evaluation_type evaluation_type, ann_loss_function loss_function, real const* in_activations, std::vector<real> const& expected_output, real *out_gradients, real &out_loss) const
+{
+    if(num_inputs == 0)
+        return;
+
+    output_gradients(this, evaluation_type, loss_function, in_activations, expected_output, out_gradients, out_loss);
+}
+
+void prkl::ann_sparse_layer::gradients_backpropagate(ann_gradients const& next_gradients, ann_layer_base *next_layer, ann_gradients &out_gradients) const
+{
+    if(num_inputs == 0)
+        return;
+
+    out_gradients.resize(num_neurons);
+    gradients_backpropagate(activations.data(), next_gradients.data(), next_layer, out_gradients.data());
+}
+
+void prkl::ann_sparse_layer::gradients_backpropagate(real const* in_activations, real const* next_gradients, ann_layer_base const* next_layer, real *out_gradients) const
+{
+    if(num_inputs == 0)
+        return;
+
+    hidden_gradients(this, in_activations, next_gradients, next_layer, out_gradients);
+}
+
+template<typename access>
+static void sparse_gradients_to_inputs(prkl::ann_sparse_layer const* layer, prkl::real const* gradients, prkl::real *out_input_gradients)
+{
+    uint32_t const* row_offsets = layer->row_offsets.data();
+    uint32_t const* columns = layer->columns.data();
+    prkl::real const* values = layer->values.data();
+
+    std::fill(out_input_gradients, out_input_gradients + layer->num_inputs, (prkl::real)0.0);
+
+    for(prkl::integer n = 0; n < layer->num_neurons; n++)
+    {
+        prkl::real gradient = gradients[n];
+
+        // the columns of a row are unique, so the scattered adds never collide within a vector
+        if constexpr(std::is_same_v<access, prkl::ann_plain_access>)
+        {
+            #pragma omp simd
+            for(uint32_t k = row_offsets[n]; k < row_offsets[n + 1]; k++)
+            {
+                out_input_gradients[columns[k]] += gradient * values[k];
+            }
+        }
+        else
+        {
+            uint32_t k = row_offsets[n];
+            for(; k + access::chunk_size <= row_offsets[n + 1]; k += access::chunk_size)
+            {
+                prkl::real chunk[access::chunk_size];
+                access::load_chunk(values + k, chunk);
+
+                #pragma omp simd
+                for(uint32_t c = 0; c < access::chunk_size; c++)
+                {
+                    out_input_gradients[columns[k + c]] += gradient * chunk[c];
+                }
+            }
+
+            for(; k < row_offsets[n + 1]; k++)
+                out_input_gradients[columns[k]] += gradient * access::load(values[k]);
+        }
+    }
+}
+
+void prkl::ann_sparse_layer::gradients_to_inputs(real const* gradients, real *out_input_gradients) const
+{
+    if(num_inputs == 0)
+        return;
+
+    if(shared_parameters)
+        sparse_gradients_to_inputs<ann_shared_access>(this, gradients, out_input_gradients);
+    else
+        sparse_gradients_to_inputs<ann_plain_access>(this, gradients, out_input_gradients);
+}
+
+void prkl::ann_sparse_layer::update_weights(ann_gradients const &layer_gradients, ann_layer_base const* prev_layer, real learning_rate)
+{
+    ann_optimizer sgd;
+    update_weights(layer_gradients.data(), prev_layer->get_activations_array(), sgd, sgd.step(learning_rate, 0));
+}
+
+void prkl::ann_sparse_layer::update_weights(real const* layer_gradients, real const* prev_activations, ann_optimizer const& optimizer, ann_optimizer_step const& step)
+{
+    update_neurons(layer_gradients, prev_activations, optimizer, step, 0, num_neurons);
+}
+
+void prkl::ann_sparse_layer::update_neurons(real const* layer_gradients, real const* prev_activations, ann_optimizer const& optimizer, ann_optimizer_step const& step, integer first_neuron, integer end_neuron)
+{
+    if(num_inputs == 0)
+        return;
+
+    static real const bias_input = (real)1.0;
+    integer num_values = values.size();
+
+    // the inputs of a row are gathered so the fused optimizer kernel can run over the stored weights as if they were dense,
+    // the buffer grows to the longest row once per thread and is reused after that
+    thread_local std::vector<real> row_inputs;
+
+    for(integer n = first_neuron; n < end_neuron; n++)
+    {
+        uint32_t first = row_offsets[n];
+        uint32_t count = row_offsets[n + 1] - first;
+        if(row_inputs.size() < count)
+            row_inputs.resize(count);
+
+        for(uint32_t k = 0; k < count; k++)
+        {
+            row_inputs[k] = prev_activations[columns[first + k]];
+        }
+
+        real *weight_moments1 = moments1.empty() ? nullptr : moments1.data() + first;
+        real *weight_moments2 = moments2.empty() ? nullptr : moments2.data() + first;
+        optimizer.update(step, layer_gradients[n], row_inputs.data(), values.data() + first, weight_moments1, weight_moments2, count, true, shared_parameters);
+
+        real *bias_moments1 = moments1.empty() ? nullptr : moments1.data() + num_values + n;
+        real *bias_moments2 = moments2.empty() ? nullptr : moments2.data() + num_values + n;
+        optimizer.update(step, layer_gradients[n], &bias_input, biases.data() + n, bias_moments1, bias_moments2, 1, false, shared_parameters);
+    }
+}
+
+void prkl::ann_sparse_layer::set_precision(ann_precision)
+{
+    // the stored weights are a fraction of the dense ones already, a reduced precision copy isn't worth its index overhead
+}
+
+void prkl::ann_sparse_layer::prepare_optimizer(ann_optimizer const& optimizer)
+{
+    if(num_inputs == 0)
+        return;
+
+    integer num_moments = optimizer.num_moments();
+    if(num_moments >= 1 && moments1.empty())
+        moments1.resize(num_parameters(), 0.0f);
+
+    if(num_moments >= 2 && moments2.empty())
+        moments2.resize(num_parameters(), 0.0f);
+}
+
+prkl::integer prkl::ann_sparse_layer::num_training_state() const
+{
+    return moments1.size() + moments2.size();
+}
+
+void prkl::ann_sparse_layer::read_training_state(real *out_state) const
+{
+    std::copy(moments1.begin(), moments1.end(), out_state);
+    std::copy(moments2.begin(), moments2.end(), out_state + moments1.size());
+}
+
+void prkl::ann_sparse_layer::write_training_state(real const* state)
+{
+    std::copy(state, state + moments1.size(), moments1.begin());
+    std::copy(state + moments1.size(), state + moments1.size() + moments2.size(), moments2.begin());
+}
+
+prkl::real* prkl::ann_sparse_layer::get_weights_array(integer neuron_index) const
+{
+    if(num_inputs > 0)
+        return const_cast<real*>(values.data()) + row_offsets[neuron_index];
+
+    return nullptr;
+}
+
+prkl::real* prkl::ann_sparse_layer::get_activations_array() const
+{
+    return const_cast<real*>(activations.data());
+}
@@ -0,0 +1,74 @@
+
+#pragma once
+
+#include "layer.hpp"
+
+namespace prkl
+{
+
+    /**
+     * Fully connected layer with its weights in CSR form, for pruned layers. Only the stored weights exist: training updates
+     * them in place and never regrows pruned ones, so fine-tuning a pruned model keeps its sparsity. Weights are always fp32
+     */
+    struct ann_sparse_layer : public ann_layer_base
+    {
+        /** Keeps the nonzero weights of a dense layer, along with its activation settings and biases */
+        ann_sparse_layer(ann_dense_layer const& dense);
+        ann_sparse_layer(std::ifstream &file, ann_model_version version);
+        ann_sparse_layer(ann_sparse_layer const&)=default;
+        virtual ~ann_sparse_layer()=default;
+        virtual void write(std::ofstream &file) override;
+
+        /** Fraction of the num_neurons * num_inputs weights that are not stored */
+        real sparsity() const;
+        integer num_nonzero() const { return values.size(); }
+
+        virtual integer min_activation_index() const override;
+        virtual integer max_activation_index() const override;
+
+        virtual ann_layer_base *clone() const override;
+        virtual integer num_parameters() const override;
+        virtual void read_parameters(real *out_parameters) const override;
+        virtual void write_parameters(real const* parameters) override;
+        virtual integer num_activations() const override;
+        virtual real get_activation(integer activation_index) const override;
+        virtual void set_activation(integer activation_index, real new_activation) override;
+
+        virtual void forward(ann_layer_base const*prev_layer) override;
+        virtual void apply_softmax() override;
+        virtual void gradients_from_expected_output(ann_evaluation_type evaluation_type, ann_loss_function loss_function, std::vector<real> const& expected_output, ann_gradients &out_gradients, real &out_loss) const override;
+        virtual void gradients_backpropagate(ann_gradients const& next_gradients, ann_layer_base *next_layer,  ann_gradients &out_gradients) const override;
+        virtual void update_weights(ann_gradients const &layer_gradients, ann_layer_base const* prev_layer, real learning_rate) override;
+
+        virtual void forward(real const* prev_activations, real *out_activations) const override;
+        virtual void forward_batch(real const* prev_activations, real *out_activations, integer batch) const override;
+        virtual void apply_softmax(real *inout_activations) const override;
+        virtual void gradients_from_expected_output(ann_evaluation_type evaluation_type, ann_loss_function loss_function, real const* in_activations, std::vector<real> const& expected_output, real *out_gradients, real &out_loss) const override;
+        virtual void gradients_backpropagate(real const* in_activations, real const* next_gradients, ann_layer_base const* next_layer, real *out_gradients) const override;
+        virtual void update_weights(real const* layer_gradients, real const* prev_activations, ann_optimizer const& optimizer, ann_optimizer_step const& step) override;
+        virtual void update_neurons(real const* layer_gradients, real const* prev_activations, ann_optimizer const& optimizer, ann_optimizer_step const& step, integer first_neuron, integer end_neuron) override;
+        virtual void prepare_optimizer(ann_optimizer const& optimizer) override;
+        virtual void gradients_to_inputs(real const* gradients, real *out_input_gradients) const override;
+        virtual void set_precision(ann_precision precision) override;
+        virtual integer num_training_state() const override;
+        virtual void read_training_state(real *out_state) const override;
+        virtual void write_training_state(real const* state) override;
+
+        /** The stored weights of a neuron, row_offsets tells how many there are and columns which inputs they belong to */
+        virtual real* get_weights_array(integer neuron_index) const override;
+        virtual real* get_activations_array() const override;
+
+        integer num_neurons{0};
+        integer num_inputs{0};
+
+        std::vector<real> activations; // num_neurons
+        std::vector<real> biases; // num_neurons
+        std::vector<uint32_t> row_offsets; // num_neurons + 1, the weights of neuron n are [row_offsets[n], row_offsets[n + 1])
+        std::vector<uint32_t> columns; // input index of every stored weight
+        std::vector<real> values; // stored weights, row by row
+
+        std::vector<real> moments1; // optimizer state, one per stored weight followed by one per bias, empty if unused
+        std::vector<real> moments2; // optimizer state, same layout as moments1
+    };
+
+}
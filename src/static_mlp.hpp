@@ -0,0 +1,513 @@
+
+#pragma once
+
+#include "common.hpp"
+#include "random.hpp"
+
+#include <array>
+#include <tuple>
+#include <utility>
+
+namespace prkl
+{
+
+    /** A fully connected layer of a static_mlp, its size and activation are fixed at compile time */
+    template<integer Neurons, ann_activation Activation = ann_activation::linear>
+    struct static_dense
+    {
+        static_assert(Neurons > 0, "a static_dense layer needs at least one neuron");
+
+        static constexpr integer num_neurons = Neurons;
+        static constexpr ann_activation activation_func = Activation;
+    };
+
+    namespace detail
+    {
+        template<ann_activation Activation>
+        inline real static_activation(real x, real leaky_alpha)
+        {
+            if constexpr (Activation == ann_activation::swish)
+                return swish(x);
+            else if constexpr (Activation == ann_activation::tanh)
+                return prkl::tanh(x);
+            else if constexpr (Activation == ann_activation::relu)
+                return relu(x);
+            else if constexpr (Activation == ann_activation::leaky_relu)
+                return leaky_relu(x, leaky_alpha);
+            else if constexpr (Activation == ann_activation::sigmoid)
+                return sigmoid(x);
+            else
+                return linear(x);
+        }
+
+        /** Called with the activation output, like activation_derivative of the dynamic layers */
+        template<ann_activation Activation>
+        inline real static_activation_derivative(real x, real leaky_alpha, real grad_limit)
+        {
+            if constexpr (Activation == ann_activation::swish)
+                return swish_derivative(x, grad_limit);
+            else if constexpr (Activation == ann_activation::tanh)
+                return tanh_derivative(x);
+            else if constexpr (Activation == ann_activation::relu)
+                return relu_derivative(x);
+            else if constexpr (Activation == ann_activation::leaky_relu)
+                return leaky_relu_derivative(x, leaky_alpha);
+            else if constexpr (Activation == ann_activation::sigmoid)
+                return sigmoid_derivative(x);
+            else
+                return linear_derivative(x);
+        }
+
+        /**
+         * Dot product with 16 independent partial sums. A fixed summation order the compiler can vectorize without fast-math or
+         * OpenMP, which a header can't count on its includer to enable
+         */
+        template<integer Count>
+        inline real static_dot(real const* a, real const* b)
+        {
+            constexpr integer num_lanes = 16;
+            constexpr integer num_vectorized = Count / num_lanes * num_lanes;
+
+            real sum = 0.0f;
+            if constexpr (num_vectorized > 0)
+            {
+                real lanes[num_lanes] = {};
+                for(integer i = 0; i < num_vectorized; i += num_lanes)
+                    for(integer l = 0; l < num_lanes; l++)
+                        lanes[l] += a[i + l] * b[i + l];
+                for(integer l = 0; l < num_lanes; l++)
+                    sum += lanes[l];
+            }
+            for(integer i = num_vectorized; i < Count; i++)
+                sum += a[i] * b[i];
+            return sum;
+        }
+
+        /** Same as prkl::softmax, copied so the header stands on its own */
+        template<integer Count>
+        inline void static_softmax(real *inout_activations)
+        {
+            real max_activation = inout_activations[0];
+            for(integer i = 1; i < Count; i++)
+                max_activation = std::max(max_activation, inout_activations[i]);
+
+            real sum_exp = 0.0f;
+            for(integer i = 0; i < Count; i++)
+            {
+                inout_activations[i] = std::exp(std::max(inout_activations[i] - max_activation, -80.0f));
+                sum_exp += inout_activations[i];
+            }
+
+            sum_exp += 1e-08f;
+            for(integer i = 0; i < Count; i++)
+                inout_activations[i] /= sum_exp;
+        }
+    }
+
+    /** Parameters and training buffers of one static_dense layer, with the input count of the layer in front of it */
+    template<integer Inputs, typename Layer>
+    struct static_dense_state
+    {
+        static constexpr integer num_inputs = Inputs;
+        static constexpr integer num_neurons = Layer::num_neurons;
+        static constexpr ann_activation activation_func = Layer::activation_func;
+
+        void forward(real const* inputs, real *out_activations) const
+        {
+            for(integer n = 0; n < num_neurons; n++)
+                out_activations[n] = biases[n] + detail::static_dot<num_inputs>(weights.data() + n * num_inputs, inputs);
+
+            // separate pass, so the activation function vectorizes across the neurons
+            for(integer n = 0; n < num_neurons; n++)
+                out_activations[n] = detail::static_activation<activation_func>(out_activations[n], leaky_alpha);
+        }
+
+        /** Multiplies in the activation derivative of this layer, inout_gradients arrive as the gradients of its outputs */
+        void apply_derivative(real *inout_gradients) const
+        {
+            for(integer n = 0; n < num_neurons; n++)
+                inout_gradients[n] *= detail::static_activation_derivative<activation_func>(activations[n], leaky_alpha, grad_limit);
+        }
+
+        void gradients_to_inputs(real const* in_gradients, real *out_input_gradients) const
+        {
+            std::fill(out_input_gradients, out_input_gradients + num_inputs, (real)0.0);
+
+            // row by row, so the weights are streamed in storage order
+            for(integer n = 0; n < num_neurons; n++)
+            {
+                real gradient = in_gradients[n];
+                real const* neuron_weights = weights.data() + n * num_inputs;
+                for(integer i = 0; i < num_inputs; i++)
+                    out_input_gradients[i] += gradient * neuron_weights[i];
+            }
+        }
+
+        /** Plain SGD, the same update as ann_optimizer_type::sgd */
+        void update_weights(real const* inputs, real learning_rate)
+        {
+            for(integer n = 0; n < num_neurons; n++)
+            {
+                real const scaled = learning_rate * gradients[n];
+                real *neuron_weights = weights.data() + n * num_inputs;
+                for(integer i = 0; i < num_inputs; i++)
+                    neuron_weights[i] += scaled * inputs[i];
+                biases[n] += scaled;
+            }
+        }
+
+        /** Draws the same weights as ann_dense_layer::randomize_weights for the same seed and stream */
+        void randomize_weights(uint64_t seed, integer stream)
+        {
+            ann_random_stream rnd(seed, ann_random_purpose::weights, stream);
+            real weight_range = std::sqrt(2.0f / num_inputs);
+
+            for(integer n = 0; n < num_neurons; n++)
+            {
+                uint64_t first = n * (num_inputs + 1);
+                for(integer w = 0; w < num_inputs; w++)
+                    weights[n * num_inputs + w] = rnd.uniform_at(first + w, -weight_range, weight_range);
+
+                biases[n] = rnd.uniform_at(first + num_inputs, -0.1f, 0.1f);
+            }
+        }
+
+        void write(std::ofstream &file) const
+        {
+            write_uint64_be(file, (uint64_t)ann_layer_type::dense);
+            write_uint64_be(file, (uint64_t)activation_func);
+            write_float_be(file, leaky_alpha);
+            write_uint64_be(file, num_neurons);
+            write_uint64_be(file, num_inputs);
+
+            for(real activation : activations)
+                write_float_be(file, activation);
+            for(real weight : weights)
+                write_float_be(file, weight);
+            for(real bias : biases)
+                write_float_be(file, bias);
+        }
+
+        /** Reads a layer written by ann_dense_layer, fails on anything that doesn't match the compile-time shape */
+        bool read(std::ifstream &file, ann_model_version version)
+        {
+            ann_layer_type layer_type = (ann_layer_type)read_uint64_be(file);
+            if(layer_type != ann_layer_type::dense)
+            {
+                std::cerr << "static_mlp only loads dense layers, got layer type " << (integer)layer_type << std::endl;
+                return false;
+            }
+
+            if(version >= ann_model_version::layer_parameters)
+            {
+                ann_activation file_activation = (ann_activation)read_uint64_be(file);
+                leaky_alpha = read_float_be(file);
+                if(file_activation != activation_func)
+                {
+                    std::cerr << "activation mismatch, the model has " << (integer)file_activation << " where the template has " << (integer)activation_func << std::endl;
+                    return false;
+                }
+            }
+
+            integer file_neurons = read_uint64_be(file);
+            integer file_inputs = read_uint64_be(file);
+            if(file_neurons != num_neurons || file_inputs != num_inputs)
+            {
+                std::cerr << "layer shape mismatch, the model has " << file_neurons << "x" << file_inputs << " where the template has " << num_neurons << "x" << num_inputs << std::endl;
+                return false;
+            }
+
+            for(real &activation : activations)
+                activation = read_float_be(file);
+            for(real &weight : weights)
+                weight = read_float_be(file);
+            for(real &bias : biases)
+                bias = read_float_be(file);
+
+            return bool(file);
+        }
+
+        alignas(64) std::array<real, num_neurons * num_inputs> weights{}; // row-major, like ann_dense_layer
+        alignas(64) std::array<real, num_neurons> biases{};
+        alignas(64) std::array<real, num_neurons> activations{}; // outputs of the last train_step, the derivatives read them
+        alignas(64) std::array<real, num_neurons> gradients{};
+
+        real leaky_alpha{(real)0.01};
+        real grad_limit{(real)0.75}; // swish derivative clip
+    };
+
+    namespace detail
+    {
+        /** Chains the layer specs into states, every layer takes the neuron count of the one in front as its inputs */
+        template<integer Inputs, typename... Layers>
+        struct static_layer_states
+        {
+            using type = std::tuple<>;
+        };
+
+        template<integer Inputs, typename First, typename... Rest>
+        struct static_layer_states<Inputs, First, Rest...>
+        {
+            using type = decltype(std::tuple_cat(std::declval<std::tuple<static_dense_state<Inputs, First>>>(), std::declval<typename static_layer_states<First::num_neurons, Rest...>::type>()));
+        };
+    }
+
+    /**
+     * Multilayer perceptron with its topology fixed at compile time, e.g. static_mlp<6, static_dense<64, ann_activation::relu>,
+     * static_dense<1>>. Parameters live in std::arrays inside the object, nothing is allocated and every loop bound is a constant,
+     * so the compiler can unroll and vectorize the forward and backward passes and inline the activation functions.
+     * Reads and writes the .prklmodel format of ann_model, with the input layer stored as a dense layer without inputs like
+     * ann_model does, so models move freely between the two. Trains with per-sample SGD, the loss and gradients follow
+     * output_gradients of the dynamic layers
+     */
+    template<integer Inputs, typename... Layers>
+    struct static_mlp
+    {
+        static_assert(Inputs > 0, "a static_mlp needs at least one input");
+        static_assert(sizeof...(Layers) > 0, "a static_mlp needs at least one layer");
+
+        using layer_states = typename detail::static_layer_states<Inputs, Layers...>::type;
+
+        static constexpr integer num_inputs = Inputs;
+        static constexpr integer num_layers = sizeof...(Layers);
+        static constexpr integer num_outputs = std::tuple_element_t<num_layers - 1, layer_states>::num_neurons;
+
+        using input_array = std::array<real, num_inputs>;
+        using output_array = std::array<real, num_outputs>;
+
+        /** Same initialization as an ann_model built layer by layer with this seed */
+        void randomize_weights(uint64_t seed)
+        {
+            randomize_from<0>(seed);
+        }
+
+        /** Inference, intermediate activations stay on the stack so one model serves any number of threads */
+        output_array forward(input_array const& inputs) const
+        {
+            output_array outputs;
+            forward_from<0>(inputs.data(), outputs.data());
+            if(evaluation_type == ann_evaluation_type::multiclass_classification)
+                detail::static_softmax<num_outputs>(outputs.data());
+            return outputs;
+        }
+
+        /** One forward and backward pass and an SGD update, returns the loss of the sample before the update */
+        real train_step(input_array const& inputs, output_array const& expected, real learning_rate)
+        {
+            forward_training<0>(inputs.data());
+
+            auto &output = std::get<num_layers - 1>(layers);
+            if(evaluation_type == ann_evaluation_type::multiclass_classification)
+                detail::static_softmax<num_outputs>(output.activations.data());
+
+            real loss = output_gradients(output, expected);
+            backward_from<num_layers - 1>(inputs.data(), learning_rate);
+            return loss;
+        }
+
+        /** Outputs of the last train_step */
+        output_array const& outputs() const
+        {
+            return std::get<num_layers - 1>(layers).activations;
+        }
+
+        template<std::size_t Index>
+        auto &layer() { return std::get<Index>(layers); }
+
+        template<std::size_t Index>
+        auto const& layer() const { return std::get<Index>(layers); }
+
+        bool read_file(char const* path)
+        {
+            std::ifstream file(path, std::ios::binary);
+            if(!file)
+            {
+                std::cerr << "failed to open file for reading: " << path << std::endl;
+                return false;
+            }
+
+            if(read_uint64_be(file) != ann_model_magic)
+            {
+                std::cerr << "invalid model, magic mismatch" << std::endl;
+                return false;
+            }
+
+            integer version = read_uint64_be(file);
+            if(version > (integer)ann_model_version::latest)
+            {
+                std::cerr << "unsupported model version, please update this software to the latest version in order to load this model" << std::endl;
+                return false;
+            }
+
+            regression_loss_function = (ann_loss_function)read_uint64_be(file);
+            evaluation_type = (ann_evaluation_type)read_uint64_be(file);
+
+            integer file_layers = read_uint64_be(file);
+            if(file_layers != num_layers + 1)
+            {
+                std::cerr << "layer count mismatch, the model has " << file_layers << " layers where the template has " << (num_layers + 1) << std::endl;
+                return false;
+            }
+
+            // the input layer only carries its size
+            if((ann_layer_type)read_uint64_be(file) != ann_layer_type::dense)
+            {
+                std::cerr << "invalid model, the input layer is not a dense layer" << std::endl;
+                return false;
+            }
+            if((ann_model_version)version >= ann_model_version::layer_parameters)
+            {
+                read_uint64_be(file);
+                read_float_be(file);
+            }
+            integer file_inputs = read_uint64_be(file);
+            if(file_inputs != num_inputs || read_uint64_be(file) != 0)
+            {
+                std::cerr << "input mismatch, the model has " << file_inputs << " inputs where the template has " << num_inputs << std::endl;
+                return false;
+            }
+            for(integer i = 0; i < num_inputs; i++)
+                read_float_be(file);
+
+            return read_from<0>(file, (ann_model_version)version);
+        }
+
+        bool write_file(char const* path) const
+        {
+            std::ofstream file(path, std::ios::binary);
+            if(!file)
+            {
+                std::cerr << "failed to open file for writing: " << path << std::endl;
+                return false;
+            }
+
+            write_uint64_be(file, ann_model_magic);
+            write_uint64_be(file, (uint64_t)ann_model_version::latest);
+            write_uint64_be(file, (uint64_t)regression_loss_function);
+            write_uint64_be(file, (uint64_t)evaluation_type);
+            write_uint64_be(file, num_layers + 1);
+
+            // input layer, as ann_model writes it
+            write_uint64_be(file, (uint64_t)ann_layer_type::dense);
+            write_uint64_be(file, (uint64_t)ann_activation::linear);
+            write_float_be(file, (real)0.01);
+            write_uint64_be(file, num_inputs);
+            write_uint64_be(file, 0);
+            for(integer i = 0; i < num_inputs; i++)
+                write_float_be(file, (real)0.0);
+
+            std::apply([&file](auto const&... layer_states) { (layer_states.write(file), ...); }, layers);
+            return bool(file);
+        }
+
+        ann_evaluation_type evaluation_type{ann_evaluation_type::regression};
+        ann_loss_function regression_loss_function{ann_loss_function::mean_squared_error};
+
+        layer_states layers;
+
+    private:
+        template<std::size_t Index>
+        void randomize_from(uint64_t seed)
+        {
+            // stream is the layer index in ann_model, where the input layer is layer 0
+            std::get<Index>(layers).randomize_weights(seed, Index + 1);
+            if constexpr (Index + 1 < num_layers)
+                randomize_from<Index + 1>(seed);
+        }
+
+        template<std::size_t Index>
+        void forward_from(real const* inputs, real *outputs) const
+        {
+            auto const& current = std::get<Index>(layers);
+            if constexpr (Index + 1 == num_layers)
+            {
+                current.forward(inputs, outputs);
+            }
+            else
+            {
+                alignas(64) std::array<real, std::tuple_element_t<Index, layer_states>::num_neurons> activations;
+                current.forward(inputs, activations.data());
+                forward_from<Index + 1>(activations.data(), outputs);
+            }
+        }
+
+        template<std::size_t Index>
+        void forward_training(real const* inputs)
+        {
+            auto &current = std::get<Index>(layers);
+            current.forward(inputs, current.activations.data());
+            if constexpr (Index + 1 < num_layers)
+                forward_training<Index + 1>(current.activations.data());
+        }
+
+        template<typename Output>
+        real output_gradients(Output &output, output_array const& expected) const
+        {
+            // serial on purpose: the loss is summed in neuron order, like output_gradients of the dynamic layers
+            real loss = 0.0f;
+            for(integer i = 0; i < num_outputs; i++)
+            {
+                real actual = output.activations[i];
+                real output_error = expected[i] - actual;
+                real derivative = detail::static_activation_derivative<Output::activation_func>(actual, output.leaky_alpha, output.grad_limit);
+
+                switch(evaluation_type)
+                {
+                    case ann_evaluation_type::regression:
+                        if(regression_loss_function == ann_loss_function::mean_absolute_error)
+                        {
+                            loss += std::abs(output_error);
+                            output.gradients[i] = (output_error >= 0 ? 1.0f : -1.0f) * derivative;
+                        }
+                        else
+                        {
+                            loss += output_error * output_error;
+                            output.gradients[i] = output_error * derivative;
+                        }
+                        break;
+                    case ann_evaluation_type::multiclass_classification:
+                        loss -= expected[i] * std::log(std::max(actual, 1e-08f));
+                        output.gradients[i] = output_error * derivative;
+                        break;
+                    case ann_evaluation_type::binary_classification:
+                    case ann_evaluation_type::multilabel_classification:
+                        loss -= expected[i] * std::log(actual + 1e-5f) + (1 - expected[i]) * std::log(1 - actual + 1e-5f);
+                        output.gradients[i] = output_error * derivative;
+                        break;
+                }
+            }
+            return loss;
+        }
+
+        /** The gradients of a layer go to the layer in front of it before its weights change, so the update never leaks into them */
+        template<std::size_t Index>
+        void backward_from(real const* inputs, real learning_rate)
+        {
+            auto &current = std::get<Index>(layers);
+            if constexpr (Index > 0)
+            {
+                auto &previous = std::get<Index - 1>(layers);
+                current.gradients_to_inputs(current.gradients.data(), previous.gradients.data());
+                previous.apply_derivative(previous.gradients.data());
+                current.update_weights(previous.activations.data(), learning_rate);
+                backward_from<Index - 1>(inputs, learning_rate);
+            }
+            else
+            {
+                current.update_weights(inputs, learning_rate);
+            }
+        }
+
+        template<std::size_t Index>
+        bool read_from(std::ifstream &file, ann_model_version version)
+        {
+            if(!std::get<Index>(layers).read(file, version))
+                return false;
+            if constexpr (Index + 1 < num_layers)
+                return read_from<Index + 1>(file, version);
+            else
+                return true;
+        }
+    };
+
+}
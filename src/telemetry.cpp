@@ -0,0 +1,153 @@
+
+#include "telemetry.hpp"
+#include "model.hpp"
+
+#include <iostream>
+
+namespace
+{
+    // arithmetic per parameter of one optimizer update, including the gradient times input product
+    double update_flops(prkl::ann_optimizer_type type)
+    {
+        switch(type)
+        {
+            default:
+            case prkl::ann_optimizer_type::sgd:
+                return 2.0;
+            case prkl::ann_optimizer_type::momentum:
+                return 4.0;
+            case prkl::ann_optimizer_type::nesterov:
+                return 5.0;
+            case prkl::ann_optimizer_type::rmsprop:
+                return 7.0;
+            case prkl::ann_optimizer_type::adam:
+                return 12.0;
+            case prkl::ann_optimizer_type::adamw:
+                return 14.0;
+        }
+    }
+}
+
+char const* prkl::phase_to_string(ann_phase phase)
+{
+    switch(phase)
+    {
+        case ann_phase::forward:
+            return "forward";
+        case ann_phase::backpropagate:
+            return "backpropagate";
+        case ann_phase::update:
+            return "update";
+        case ann_phase::snapshot:
+            return "snapshot";
+        case ann_phase::evaluation:
+            return "evaluation";
+        case ann_phase::checkpoint:
+            return "checkpoint";
+        case ann_phase::calibration:
+            return "calibration";
+        default:
+            return "unknown";
+    }
+}
+
+bool prkl::ann_telemetry::open(std::string const& path)
+{
+    file.open(path);
+    if(!file)
+    {
+        std::cerr << "failed to open file for writing: " << path << std::endl;
+        return false;
+    }
+
+    csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+    if(csv)
+    {
+        file << "epoch,loss,learning_rate,evaluated_epoch,success_rate,epoch_seconds";
+        for(integer p = 0; p < (integer)ann_phase::num_phases; p++)
+        {
+            file << "," << phase_to_string((ann_phase)p) << "_seconds";
+        }
+        file << ",samples_per_second,flops_per_second,bytes_per_second,eta_seconds" << std::endl;
+    }
+
+    return true;
+}
+
+void prkl::ann_telemetry::begin(ann_model const& model, integer in_samples_per_epoch, integer in_first_epoch, integer in_total_epochs, integer first_layer)
+{
+    samples_per_epoch = in_samples_per_epoch;
+    first_epoch = in_first_epoch;
+    total_epochs = in_total_epochs;
+    start = std::chrono::steady_clock::now();
+
+    bool half_weights = model.precision == ann_precision::bf16 || model.precision == ann_precision::fp16;
+    double weight_bytes = half_weights ? 2.0 : 4.0;
+    double moment_bytes = 8.0 * model.optimizer.num_moments(); // read and written once per update
+    double master_bytes = model.precision == ann_precision::fp32 ? 8.0 : 8.0 + weight_bytes; // fp32 read and write, plus the rounded copy
+
+    flops_per_sample = 0.0;
+    bytes_per_sample = 0.0;
+    integer first_trainable = model.first_trainable_layer();
+    for(integer layer_index = first_layer; layer_index < model.layers.size(); layer_index++)
+    {
+        ann_layer_base const* layer = model.layers[layer_index];
+        double num_parameters = layer->num_parameters();
+
+        // forward, and W^T * gradients for every layer that has a trainable layer in front of it
+        double num_passes = layer_index > first_trainable ? 2.0 : 1.0;
+        flops_per_sample += num_parameters * 2.0 * num_passes;
+        bytes_per_sample += num_parameters * weight_bytes * num_passes;
+        if(!layer->frozen)
+        {
+            flops_per_sample += num_parameters * update_flops(model.optimizer.type);
+            bytes_per_sample += num_parameters * (master_bytes + moment_bytes);
+        }
+    }
+}
+
+void prkl::ann_telemetry::record_epoch(integer epoch, real loss, real learning_rate, bool evaluated, integer evaluated_epoch, real success_rate, ann_phase_timer const& timer, double epoch_seconds)
+{
+    double samples_per_second = double(samples_per_epoch) / epoch_seconds;
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    integer epochs_done = epoch + 1 - first_epoch;
+    double eta_seconds = elapsed.count() / double(epochs_done) * double(total_epochs - epoch - 1);
+
+    if(csv)
+    {
+        file << epoch << "," << loss << "," << learning_rate << ",";
+        if(evaluated)
+            file << evaluated_epoch << "," << success_rate;
+        else
+            file << ",";
+        file << "," << epoch_seconds;
+        for(double seconds : timer.seconds)
+        {
+            file << "," << seconds;
+        }
+        file << "," << samples_per_second << "," << (flops_per_sample * samples_per_second) << "," << (bytes_per_sample * samples_per_second) << "," << eta_seconds << std::endl;
+        return;
+    }
+
+    nlohmann::json record;
+    record["epoch"] = epoch;
+    record["loss"] = loss;
+    record["learning_rate"] = learning_rate;
+    if(evaluated)
+    {
+        record["evaluated_epoch"] = evaluated_epoch;
+        record["success_rate"] = success_rate;
+    }
+    record["epoch_seconds"] = epoch_seconds;
+    for(integer p = 0; p < (integer)ann_phase::num_phases; p++)
+    {
+        record["phase_seconds"][phase_to_string((ann_phase)p)] = timer.seconds[p];
+    }
+    record["samples_per_second"] = samples_per_second;
+    record["flops_per_second"] = flops_per_sample * samples_per_second;
+    record["bytes_per_second"] = bytes_per_sample * samples_per_second;
+    record["eta_seconds"] = eta_seconds;
+
+    file << record.dump() << std::endl;
+}
@@ -0,0 +1,92 @@
+
+#pragma once
+
+#include "common.hpp"
+
+#include <array>
+#include <chrono>
+
+namespace prkl
+{
+
+    struct ann_model;
+
+    enum class ann_phase : integer
+    {
+        forward = 0,
+        backpropagate,
+        update,
+        snapshot,
+        evaluation,
+        checkpoint,
+        calibration, // activation ranges for quantization-aware training
+        num_phases
+    };
+
+    char const* phase_to_string(ann_phase phase);
+
+    /** Accumulates wall time per phase. A disabled timer costs a single branch per call */
+    struct ann_phase_timer
+    {
+        using clock = std::chrono::steady_clock;
+
+        /** Starts timing the next phase from now */
+        void start()
+        {
+            if(enabled)
+                mark = clock::now();
+        }
+
+        /** Adds the time since the last start or lap to the phase, and starts timing the next one */
+        void lap(ann_phase phase)
+        {
+            if(!enabled)
+                return;
+
+            clock::time_point now = clock::now();
+            seconds[(integer)phase] += std::chrono::duration<double>(now - mark).count();
+            mark = now;
+        }
+
+        void add(ann_phase_timer const& other)
+        {
+            for(integer p = 0; p < (integer)ann_phase::num_phases; p++)
+                seconds[p] += other.seconds[p];
+        }
+
+        void reset()
+        {
+            seconds.fill(0.0);
+        }
+
+        bool enabled{false};
+        std::array<double, (integer)ann_phase::num_phases> seconds{};
+        clock::time_point mark;
+    };
+
+    /** Per epoch training records written as JSON lines, or CSV when the path ends in .csv */
+    struct ann_telemetry
+    {
+        bool open(std::string const& path);
+        bool is_open() const { return file.is_open(); }
+
+        /** Derives the per sample cost model from the topology, optimizer, precision and frozen layers, and starts the ETA clock. Layers before first_layer are served from the frozen prefix cache */
+        void begin(ann_model const& model, integer samples_per_epoch, integer first_epoch, integer total_epochs, integer first_layer = 1);
+
+        /** Writes one record. When an evaluation finished this epoch, evaluated_epoch is the epoch its success_rate belongs to */
+        void record_epoch(integer epoch, real loss, real learning_rate, bool evaluated, integer evaluated_epoch, real success_rate, ann_phase_timer const& timer, double epoch_seconds);
+
+        // estimated arithmetic and parameter memory traffic per trained sample, activation traffic is ignored
+        double flops_per_sample{0.0};
+        double bytes_per_sample{0.0};
+
+        integer samples_per_epoch{0};
+        integer first_epoch{0};
+        integer total_epochs{0};
+        std::chrono::steady_clock::time_point start;
+
+        bool csv{false};
+        std::ofstream file;
+    };
+
+}
@@ -0,0 +1,30 @@
+#include "workspace.hpp"
+#include "model.hpp"
+
+prkl::ann_workspace::ann_workspace(ann_model const& model)
+{
+    resize(model);
+}
+
+void prkl::ann_workspace::resize(ann_model const& model)
+{
+    integer num_layers = model.layers.size();
+    activation_offsets.resize(num_layers);
+    gradient_offsets.resize(num_layers);
+
+    integer size = 0;
+    for(integer layer_index = 0; layer_index < num_layers; layer_index++)
+    {
+        activation_offsets[layer_index] = size;
+        size += model.layers[layer_index]->num_activations();
+    }
+
+    for(integer layer_index = 0; layer_index < num_layers; layer_index++)
+    {
+        gradient_offsets[layer_index] = size;
+        if(layer_index > 0)
+            size += model.layers[layer_index]->num_activations();
+    }
+
+    buffer.assign(size, (real)0.0);
+}
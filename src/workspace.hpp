@@ -0,0 +1,31 @@
+#pragma once
+
+#include "layer.hpp"
+#include "telemetry.hpp"
+
+namespace prkl 
+{
+
+    struct ann_model;
+
+    /** Activation and gradient buffers for one training step, sized once from the model topology and reused for every sample */
+    struct ann_workspace
+    {
+        ann_workspace()=default;
+        ann_workspace(ann_model const& model);
+
+        void resize(ann_model const& model);
+
+        real *activations(integer layer_index) { return buffer.data() + activation_offsets[layer_index]; }
+        real *gradients(integer layer_index) { return buffer.data() + gradient_offsets[layer_index]; }
+        real const* activations(integer layer_index) const { return buffer.data() + activation_offsets[layer_index]; }
+        real const* gradients(integer layer_index) const { return buffer.data() + gradient_offsets[layer_index]; }
+
+        std::vector<real> buffer; // all activations followed by all gradients, in layer order
+        std::vector<integer> activation_offsets; // one per layer
+        std::vector<integer> gradient_offsets; // one per layer, the input layer has no gradients and gets an empty range
+
+        ann_phase_timer timer; // forward, backpropagate and update time of the steps run on this workspace
+    };
+
+}